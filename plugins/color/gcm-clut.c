@@ -0,0 +1,103 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ * vim: set et sw=8 ts=8:
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+
+#include "gcm-clut.h"
+
+GcmClut *
+gcm_clut_new (guint size)
+{
+        GcmClut *clut = g_new0 (GcmClut, 1);
+        clut->size = size;
+        clut->data = g_new (guint16, size * 3);
+        return clut;
+}
+
+void
+gcm_clut_free (GcmClut *clut)
+{
+        g_free (clut->data);
+        g_free (clut);
+}
+
+/* Fills the ramp from curves sampled at the ramp size, or a linear ramp
+ * if curves is NULL, scaled by the blackbody color. These are kept as
+ * flat loops without branches so the compiler can vectorize them. */
+void
+gcm_clut_fill (GcmClut *clut, const gfloat *curves, const CdColorRGB *temp)
+{
+        const gfloat scale[3] = { temp->R * 65535.f,
+                                  temp->G * 65535.f,
+                                  temp->B * 65535.f };
+        const gfloat *in;
+        const guint size = clut->size;
+        const gfloat step = size > 1 ? 1.f / (gfloat) (size - 1) : 0.f;
+        guint16 *out;
+        gfloat value;
+        guint c, i;
+
+        for (c = 0; c < 3; c++) {
+                out = clut->data + c * size;
+                if (curves != NULL) {
+                        in = curves + c * size;
+                        for (i = 0; i < size; i++) {
+                                value = in[i] * scale[c];
+                                out[i] = CLAMP (value, 0.f, 65535.f);
+                        }
+                } else {
+                        for (i = 0; i < size; i++) {
+                                value = (gfloat) i * step * scale[c];
+                                out[i] = CLAMP (value, 0.f, 65535.f);
+                        }
+                }
+        }
+}
+
+guint32
+gcm_clut_hash (const GcmClut *clut)
+{
+        guint32 hash = 2166136261u;
+        guint i;
+
+        /* FNV-1a */
+        for (i = 0; i < clut->size * 3; i++) {
+                hash ^= clut->data[i];
+                hash *= 16777619u;
+        }
+        return hash;
+}
+
+/* Returns the three VCGT curves sampled at size points, for use with
+ * gcm_clut_fill() */
+gfloat *
+gcm_clut_sample_vcgt (const cmsToneCurve **vcgt, guint size)
+{
+        cmsFloat32Number in;
+        gfloat *curves;
+        guint i;
+
+        curves = g_new (gfloat, size * 3);
+        for (i = 0; i < size; i++) {
+                in = size > 1 ? (gdouble) i / (gdouble) (size - 1) : 0.f;
+                curves[i] = cmsEvalToneCurveFloat (vcgt[0], in);
+                curves[size + i] = cmsEvalToneCurveFloat (vcgt[1], in);
+                curves[size * 2 + i] = cmsEvalToneCurveFloat (vcgt[2], in);
+        }
+        return curves;
+}
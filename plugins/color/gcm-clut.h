@@ -0,0 +1,45 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ * vim: set et sw=8 ts=8:
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __GCM_CLUT_H
+#define __GCM_CLUT_H
+
+#include <glib.h>
+#include <colord.h>
+#include <lcms2.h>
+
+G_BEGIN_DECLS
+
+/* a gamma ramp in the layout the CRTC takes it */
+typedef struct {
+        guint            size;
+        guint16         *data;          /* red, then green, then blue */
+} GcmClut;
+
+GcmClut         *gcm_clut_new                           (guint                   size);
+void             gcm_clut_free                          (GcmClut                *clut);
+void             gcm_clut_fill                          (GcmClut                *clut,
+                                                         const gfloat           *curves,
+                                                         const CdColorRGB       *temp);
+guint32          gcm_clut_hash                          (const GcmClut          *clut);
+gfloat          *gcm_clut_sample_vcgt                   (const cmsToneCurve    **vcgt,
+                                                         guint                   size);
+
+G_END_DECLS
+
+#endif /* __GCM_CLUT_H */
@@ -406,6 +406,119 @@ out:
         return ret;
 }
 
+static void
+gcm_edid_set_key_file_string (GKeyFile *key_file,
+                              const gchar *group,
+                              const gchar *key,
+                              const gchar *value)
+{
+        if (value != NULL)
+                g_key_file_set_string (key_file, group, key, value);
+}
+
+static void
+gcm_edid_set_key_file_yxy (GKeyFile *key_file,
+                           const gchar *group,
+                           const gchar *key,
+                           const CdColorYxy *yxy)
+{
+        gdouble values[3] = { yxy->Y, yxy->x, yxy->y };
+        g_key_file_set_double_list (key_file, group, key, values, 3);
+}
+
+static gboolean
+gcm_edid_get_key_file_yxy (GKeyFile *key_file,
+                           const gchar *group,
+                           const gchar *key,
+                           CdColorYxy *yxy,
+                           GError **error)
+{
+        gdouble *values;
+        gsize length = 0;
+
+        values = g_key_file_get_double_list (key_file, group, key, &length, error);
+        if (values == NULL)
+                return FALSE;
+        if (length != 3) {
+                g_set_error (error,
+                             GCM_EDID_ERROR,
+                             GCM_EDID_ERROR_FAILED_TO_PARSE,
+                             "invalid %s color", key);
+                g_free (values);
+                return FALSE;
+        }
+        cd_color_yxy_set (yxy, values[0], values[1], values[2]);
+        g_free (values);
+        return TRUE;
+}
+
+/* Saves the parsed fields into the group, so they can be restored
+ * later without the EDID data. The vendor name is saved resolved, as
+ * looking it up means loading the PNP ID database. */
+void
+gcm_edid_save_to_key_file (GcmEdid *edid, GKeyFile *key_file, const gchar *group)
+{
+        GcmEdidPrivate *priv = edid->priv;
+
+        g_return_if_fail (GCM_IS_EDID (edid));
+
+        gcm_edid_set_key_file_string (key_file, group, "MonitorName", priv->monitor_name);
+        gcm_edid_set_key_file_string (key_file, group, "VendorName", gcm_edid_get_vendor_name (edid));
+        gcm_edid_set_key_file_string (key_file, group, "SerialNumber", priv->serial_number);
+        gcm_edid_set_key_file_string (key_file, group, "EisaId", priv->eisa_id);
+        gcm_edid_set_key_file_string (key_file, group, "Checksum", priv->checksum);
+        gcm_edid_set_key_file_string (key_file, group, "PnpId", priv->pnp_id);
+        g_key_file_set_integer (key_file, group, "Width", priv->width);
+        g_key_file_set_integer (key_file, group, "Height", priv->height);
+        g_key_file_set_double (key_file, group, "Gamma", priv->gamma);
+        gcm_edid_set_key_file_yxy (key_file, group, "Red", priv->red);
+        gcm_edid_set_key_file_yxy (key_file, group, "Green", priv->green);
+        gcm_edid_set_key_file_yxy (key_file, group, "Blue", priv->blue);
+        gcm_edid_set_key_file_yxy (key_file, group, "White", priv->white);
+}
+
+gboolean
+gcm_edid_load_from_key_file (GcmEdid *edid,
+                             GKeyFile *key_file,
+                             const gchar *group,
+                             GError **error)
+{
+        GcmEdidPrivate *priv = edid->priv;
+        gchar *pnp_id;
+
+        g_return_val_if_fail (GCM_IS_EDID (edid), FALSE);
+
+        /* a parsed EDID always has this */
+        pnp_id = g_key_file_get_string (key_file, group, "PnpId", error);
+        if (pnp_id == NULL)
+                return FALSE;
+
+        /* free old data */
+        gcm_edid_reset (edid);
+
+        g_strlcpy (priv->pnp_id, pnp_id, 4);
+        g_free (pnp_id);
+        priv->monitor_name = g_key_file_get_string (key_file, group, "MonitorName", NULL);
+        priv->vendor_name = g_key_file_get_string (key_file, group, "VendorName", NULL);
+        priv->serial_number = g_key_file_get_string (key_file, group, "SerialNumber", NULL);
+        priv->eisa_id = g_key_file_get_string (key_file, group, "EisaId", NULL);
+        priv->checksum = g_key_file_get_string (key_file, group, "Checksum", error);
+        if (priv->checksum == NULL)
+                return FALSE;
+        priv->width = g_key_file_get_integer (key_file, group, "Width", NULL);
+        priv->height = g_key_file_get_integer (key_file, group, "Height", NULL);
+        priv->gamma = g_key_file_get_double (key_file, group, "Gamma", NULL);
+        if (!gcm_edid_get_key_file_yxy (key_file, group, "Red", priv->red, error))
+                return FALSE;
+        if (!gcm_edid_get_key_file_yxy (key_file, group, "Green", priv->green, error))
+                return FALSE;
+        if (!gcm_edid_get_key_file_yxy (key_file, group, "Blue", priv->blue, error))
+                return FALSE;
+        if (!gcm_edid_get_key_file_yxy (key_file, group, "White", priv->white, error))
+                return FALSE;
+        return TRUE;
+}
+
 static void
 gcm_edid_class_init (GcmEdidClass *klass)
 {
@@ -76,6 +76,13 @@ const CdColorYxy *gcm_edid_get_red                      (GcmEdid
 const CdColorYxy *gcm_edid_get_green                    (GcmEdid                *edid);
 const CdColorYxy *gcm_edid_get_blue                     (GcmEdid                *edid);
 const CdColorYxy *gcm_edid_get_white                    (GcmEdid                *edid);
+void             gcm_edid_save_to_key_file              (GcmEdid                *edid,
+                                                         GKeyFile               *key_file,
+                                                         const gchar            *group);
+gboolean         gcm_edid_load_from_key_file            (GcmEdid                *edid,
+                                                         GKeyFile               *key_file,
+                                                         const gchar            *group,
+                                                         GError                 **error);
 
 G_END_DECLS
 
@@ -25,6 +25,7 @@
 #include <stdlib.h>
 #include <gtk/gtk.h>
 
+#include "gcm-clut.h"
 #include "gcm-edid.h"
 #include "gsd-color-state.h"
 #include "gsd-night-light.h"
@@ -214,6 +215,57 @@ gcm_test_edid_func (void)
         g_object_unref (edid);
 }
 
+static void
+gcm_test_edid_key_file_func (void)
+{
+        GcmEdid *edid;
+        GcmEdid *edid_cached;
+        g_autoptr(GKeyFile) key_file = NULL;
+        g_autoptr(GError) error = NULL;
+        g_autofree gchar *data = NULL;
+        gboolean ret;
+        gsize length = 0;
+
+        ret = g_file_get_contents (TESTDATADIR "/LG-L225W-External.bin",
+                                   &data, &length, &error);
+        g_assert_no_error (error);
+        g_assert (ret);
+        edid = gcm_edid_new ();
+        ret = gcm_edid_parse (edid, (const guint8 *) data, length, &error);
+        g_assert_no_error (error);
+        g_assert (ret);
+
+        /* save and restore without the EDID data */
+        key_file = g_key_file_new ();
+        gcm_edid_save_to_key_file (edid, key_file, gcm_edid_get_checksum (edid));
+        edid_cached = gcm_edid_new ();
+        ret = gcm_edid_load_from_key_file (edid_cached, key_file,
+                                           "0bb44865bb29984a4bae620656c31368",
+                                           &error);
+        g_assert_no_error (error);
+        g_assert (ret);
+
+        g_assert_cmpstr (gcm_edid_get_monitor_name (edid_cached), ==, "L225W");
+        g_assert_cmpstr (gcm_edid_get_vendor_name (edid_cached), ==, "Goldstar Company Ltd");
+        g_assert_cmpstr (gcm_edid_get_serial_number (edid_cached), ==, "34398");
+        g_assert_cmpstr (gcm_edid_get_eisa_id (edid_cached), ==, NULL);
+        g_assert_cmpstr (gcm_edid_get_checksum (edid_cached), ==, "0bb44865bb29984a4bae620656c31368");
+        g_assert_cmpstr (gcm_edid_get_pnp_id (edid_cached), ==, "GSM");
+        g_assert_cmpint (gcm_edid_get_height (edid_cached), ==, 30);
+        g_assert_cmpint (gcm_edid_get_width (edid_cached), ==, 47);
+        g_assert_cmpfloat (gcm_edid_get_gamma (edid_cached), ==, gcm_edid_get_gamma (edid));
+        g_assert_cmpfloat (gcm_edid_get_red (edid_cached)->x, ==, gcm_edid_get_red (edid)->x);
+        g_assert_cmpfloat (gcm_edid_get_white (edid_cached)->y, ==, gcm_edid_get_white (edid)->y);
+
+        /* missing group */
+        ret = gcm_edid_load_from_key_file (edid_cached, key_file, "nonexistent", &error);
+        g_assert_error (error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_GROUP_NOT_FOUND);
+        g_assert (!ret);
+
+        g_object_unref (edid_cached);
+        g_object_unref (edid);
+}
+
 static void
 gcm_test_sunset_sunrise (void)
 {
@@ -278,13 +330,250 @@ gcm_test_frac_day (void)
         g_assert (gsd_night_light_frac_day_is_between (5, 16, 8));
 }
 
+/* with -m perf the benchmarks run for longer, and with --machine-readable
+ * each result is printed as a tab separated name, value and unit */
+static gboolean machine_readable = FALSE;
+
+static guint
+gcm_test_benchmark_iterations (guint quick, guint perf)
+{
+        return g_test_perf () ? perf : quick;
+}
+
+static void
+gcm_test_benchmark_report (const gchar *name, gdouble value, const gchar *unit)
+{
+        if (machine_readable)
+                g_print ("%s\t%.3f\t%s\n", name, value, unit);
+        else
+                g_test_message ("%s: %.3f %s", name, value, unit);
+}
+
+static void
+gcm_test_benchmark_edid_func (void)
+{
+        const gchar *filenames[] = { TESTDATADIR "/LG-L225W-External.bin",
+                                     TESTDATADIR "/Lenovo-T61-Internal.bin" };
+        guint iterations = gcm_test_benchmark_iterations (100, 100000);
+        guint i, j;
+        gdouble elapsed;
+        GcmEdid *edid;
+        g_autoptr(GTimer) timer = NULL;
+
+        edid = gcm_edid_new ();
+        for (i = 0; i < G_N_ELEMENTS (filenames); i++) {
+                g_autofree gchar *basename = NULL;
+                g_autofree gchar *data = NULL;
+                g_autofree gchar *name = NULL;
+                g_autoptr(GError) error = NULL;
+                gsize length = 0;
+                gboolean ret;
+
+                ret = g_file_get_contents (filenames[i], &data, &length, &error);
+                g_assert_no_error (error);
+                g_assert (ret);
+
+                timer = g_timer_new ();
+                for (j = 0; j < iterations; j++) {
+                        ret = gcm_edid_parse (edid, (const guint8 *) data, length, &error);
+                        g_assert_no_error (error);
+                        g_assert (ret);
+                }
+                elapsed = g_timer_elapsed (timer, NULL);
+                g_clear_pointer (&timer, g_timer_destroy);
+
+                basename = g_path_get_basename (filenames[i]);
+                g_test_minimized_result (elapsed / iterations, "parse %s", basename);
+                name = g_strdup_printf ("edid-parse-%s", basename);
+                gcm_test_benchmark_report (name, iterations / elapsed, "parses/s");
+        }
+        g_object_unref (edid);
+}
+
+static gboolean
+gcm_test_get_blackbody (guint temperature, CdColorRGB *result)
+{
+#if CD_CHECK_VERSION(1,3,5)
+        return cd_color_get_blackbody_rgb_full (temperature, result,
+                                                CD_COLOR_BLACKBODY_FLAG_USE_PLANCKIAN);
+#else
+        return cd_color_get_blackbody_rgb (temperature, result);
+#endif
+}
+
+static void
+gcm_test_benchmark_vcgt_func (void)
+{
+        const guint sizes[] = { 256, 1024, 4096 };
+        guint iterations = gcm_test_benchmark_iterations (10, 10000);
+        const cmsToneCurve *vcgt[3];
+        cmsToneCurve *curves[3];
+        CdColorRGB temp;
+        gdouble elapsed;
+        guint i, j;
+
+        /* a plausible calibration, slightly different per channel */
+        curves[0] = cmsBuildGamma (NULL, 1.0 / 2.2);
+        curves[1] = cmsBuildGamma (NULL, 1.0 / 2.1);
+        curves[2] = cmsBuildGamma (NULL, 1.0 / 2.0);
+        for (i = 0; i < 3; i++)
+                vcgt[i] = curves[i];
+
+        for (i = 0; i < G_N_ELEMENTS (sizes); i++) {
+                g_autoptr(GTimer) timer = NULL;
+                g_autofree gfloat *sampled = NULL;
+                g_autofree gchar *name = NULL;
+                GcmClut *clut;
+
+                /* decoding the curves, once per profile */
+                timer = g_timer_new ();
+                for (j = 0; j < iterations; j++) {
+                        g_free (sampled);
+                        sampled = gcm_clut_sample_vcgt (vcgt, sizes[i]);
+                }
+                elapsed = g_timer_elapsed (timer, NULL);
+                g_test_minimized_result (elapsed / iterations,
+                                         "sample VCGT at %u", sizes[i]);
+                name = g_strdup_printf ("vcgt-sample-%u", sizes[i]);
+                gcm_test_benchmark_report (name, elapsed * G_USEC_PER_SEC / iterations, "us");
+                g_clear_pointer (&name, g_free);
+
+                /* generating the ramp, once per temperature */
+                clut = gcm_clut_new (sizes[i]);
+                g_timer_start (timer);
+                for (j = 0; j < iterations; j++) {
+                        guint temperature = GSD_COLOR_TEMPERATURE_MIN +
+                                j % (GSD_COLOR_TEMPERATURE_MAX - GSD_COLOR_TEMPERATURE_MIN);
+                        gboolean ret = gcm_test_get_blackbody (temperature, &temp);
+                        g_assert (ret);
+                        gcm_clut_fill (clut, sampled, &temp);
+                }
+                elapsed = g_timer_elapsed (timer, NULL);
+                g_test_minimized_result (elapsed / iterations,
+                                         "generate ramp at %u", sizes[i]);
+                name = g_strdup_printf ("vcgt-ramp-%u", sizes[i]);
+                gcm_test_benchmark_report (name, elapsed * G_USEC_PER_SEC / iterations, "us");
+
+                /* sanity check the last one */
+                g_assert_cmpint (clut->data[0], ==, 0);
+                g_assert_cmpint (clut->data[sizes[i] - 1], <=, 0xffff * temp.R);
+                gcm_clut_free (clut);
+        }
+
+        for (i = 0; i < 3; i++)
+                cmsFreeToneCurve (curves[i]);
+}
+
+typedef struct {
+        GsdNightLight   *nlight;
+        GcmClut         *clut;
+        guint32          applied_hash;
+        guint            n_notify;
+        guint            n_applied;
+} GcmTestSunset;
+
+static void
+on_sunset_temperature_notify (GsdNightLight *nlight,
+                              GParamSpec    *pspec,
+                              gpointer       user_data)
+{
+        GcmTestSunset *sunset = (GcmTestSunset *) user_data;
+        CdColorRGB temp;
+        gboolean ret;
+        guint32 hash;
+
+        /* do what the color state does with a linear profile */
+        sunset->n_notify++;
+        ret = gcm_test_get_blackbody (gsd_night_light_get_temperature (nlight), &temp);
+        g_assert (ret);
+        gcm_clut_fill (sunset->clut, NULL, &temp);
+        hash = gcm_clut_hash (sunset->clut);
+        if (hash == sunset->applied_hash)
+                return;
+        sunset->applied_hash = hash;
+        sunset->n_applied++;
+}
+
+static void
+gcm_test_benchmark_sunset_func (void)
+{
+        GcmTestSunset sunset = { NULL };
+        const guint target = 4000;
+        gboolean ret;
+        const guint steps = 2 * 60 * 60;
+        gdouble elapsed;
+        guint i;
+        g_autoptr(GDateTime) start = NULL;
+        g_autoptr(GError) error = NULL;
+        g_autoptr(GSettings) settings = NULL;
+        g_autoptr(GTimer) timer = NULL;
+
+        /* manual schedule, so the transition is from 19:00 to 20:00 */
+        settings = g_settings_new ("org.gnome.settings-daemon.plugins.color");
+        g_settings_set_boolean (settings, "night-light-enabled", FALSE);
+        g_settings_set_boolean (settings, "night-light-schedule-automatic", FALSE);
+        g_settings_set_double (settings, "night-light-schedule-from", 20.f);
+        g_settings_set_double (settings, "night-light-schedule-to", 6.f);
+        g_settings_set_uint (settings, "night-light-temperature", target);
+
+        sunset.nlight = gsd_night_light_new ();
+        sunset.clut = gcm_clut_new (1024);
+        gsd_night_light_set_geoclue_enabled (sunset.nlight, FALSE);
+        gsd_night_light_set_smooth_enabled (sunset.nlight, FALSE);
+        start = g_date_time_new_utc (2017, 2, 8, 18, 30, 0);
+        gsd_night_light_set_date_time_now (sunset.nlight, start);
+        ret = gsd_night_light_start (sunset.nlight, &error);
+        g_assert_no_error (error);
+        g_assert (ret);
+        g_settings_set_boolean (settings, "night-light-enabled", TRUE);
+        g_assert (!gsd_night_light_get_active (sunset.nlight));
+        g_signal_connect (sunset.nlight, "notify::temperature",
+                          G_CALLBACK (on_sunset_temperature_notify), &sunset);
+
+        /* one simulated second at a time, from 18:30 to 20:30 */
+        timer = g_timer_new ();
+        for (i = 1; i <= steps; i++) {
+                g_autoptr(GDateTime) dt = g_date_time_add_seconds (start, i);
+                gsd_night_light_set_date_time_now (sunset.nlight, dt);
+        }
+        elapsed = g_timer_elapsed (timer, NULL);
+
+        g_assert (gsd_night_light_get_active (sunset.nlight));
+        g_assert_cmpfloat (ABS (gsd_night_light_get_temperature (sunset.nlight) - target), <=, 10.f);
+        g_assert_cmpint (sunset.n_notify, >, 0);
+        g_assert_cmpint (sunset.n_applied, <=, sunset.n_notify);
+
+        /* each notification is at least 10K from the last */
+        g_assert_cmpint (sunset.n_notify, <=, (GSD_COLOR_TEMPERATURE_DEFAULT - target) / 10 + 1);
+
+        g_test_minimized_result (elapsed / steps, "simulated second of sunset");
+        gcm_test_benchmark_report ("sunset-notify", sunset.n_notify / 3600.f, "notifications/s");
+        gcm_test_benchmark_report ("sunset-gamma", sunset.n_applied / 3600.f, "applications/s");
+        gcm_test_benchmark_report ("sunset-step", elapsed * G_USEC_PER_SEC / steps, "us");
+
+        g_settings_set_boolean (settings, "night-light-enabled", FALSE);
+        gcm_clut_free (sunset.clut);
+        g_object_unref (sunset.nlight);
+}
+
 int
 main (int argc, char **argv)
 {
         char *schema_dir;
+        gint i, j;
 
         g_setenv ("GSETTINGS_BACKEND", "memory", TRUE);
 
+        /* our own option, which GTK and GTest should not see */
+        for (i = 1, j = 1; i < argc; i++) {
+                if (g_strcmp0 (argv[i], "--machine-readable") == 0)
+                        machine_readable = TRUE;
+                else
+                        argv[j++] = argv[i];
+        }
+        argv[j] = NULL;
+        argc = j;
+
         gtk_init (&argc, &argv);
         g_test_init (&argc, &argv, NULL);
 
@@ -293,10 +582,14 @@ main (int argc, char **argv)
         g_free (schema_dir);
 
         g_test_add_func ("/color/edid", gcm_test_edid_func);
+        g_test_add_func ("/color/edid/key-file", gcm_test_edid_key_file_func);
         g_test_add_func ("/color/sunset-sunrise", gcm_test_sunset_sunrise);
         g_test_add_func ("/color/sunset-sunrise/fractional-timezone", gcm_test_sunset_sunrise_fractional_timezone);
         g_test_add_func ("/color/fractional-day", gcm_test_frac_day);
         g_test_add_func ("/color/night-light", gcm_test_night_light);
+        g_test_add_func ("/color/benchmark/edid", gcm_test_benchmark_edid_func);
+        g_test_add_func ("/color/benchmark/vcgt", gcm_test_benchmark_vcgt_func);
+        g_test_add_func ("/color/benchmark/sunset", gcm_test_benchmark_sunset_func);
 
         return g_test_run ();
 }
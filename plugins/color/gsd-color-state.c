@@ -24,6 +24,8 @@
 #include <colord.h>
 #include <gdk/gdk.h>
 #include <stdlib.h>
+#include <string.h>
+#include <glib/gstdio.h>
 #include <lcms2.h>
 #include <canberra-gtk.h>
 
@@ -38,6 +40,7 @@
 
 #include "gsd-color-manager.h"
 #include "gsd-color-state.h"
+#include "gcm-clut.h"
 #include "gcm-edid.h"
 
 #define GSD_COLOR_STATE_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), GSD_TYPE_COLOR_STATE, GsdColorStatePrivate))
@@ -47,6 +50,7 @@
 #define GSD_DBUS_BASE_INTERFACE "org.gnome.SettingsDaemon"
 
 static void gcm_session_set_gamma_for_all_devices (GsdColorState *state);
+static void gcm_session_set_temperature_for_all_outputs (GsdColorState *state);
 
 struct GsdColorStatePrivate
 {
@@ -55,6 +59,13 @@ struct GsdColorStatePrivate
         CdClient        *client;
         GnomeRRScreen   *state_screen;
         GHashTable      *edid_cache;
+        GKeyFile        *edid_store;
+        gchar           *edid_store_path;
+        GHashTable      *vcgt_cache;
+        GHashTable      *output_profiles;
+        GHashTable      *output_cluts;
+        GHashTable      *crtc_gamma;
+        guint            crtc_gamma_id;
         GdkWindow       *gdk_window;
         gboolean         session_is_active;
         GHashTable      *device_assign_hash;
@@ -71,11 +82,8 @@ G_DEFINE_TYPE (GsdColorState, gsd_color_state, G_TYPE_OBJECT)
 #define GCM_ICC_PROFILE_IN_X_VERSION_MAJOR      0
 #define GCM_ICC_PROFILE_IN_X_VERSION_MINOR      3
 
-typedef struct {
-        guint32          red;
-        guint32          green;
-        guint32          blue;
-} GnomeRROutputClutItem;
+#define GCM_VCGT_TEMPERATURE_STEP               10      /* Kelvin */
+#define GCM_VCGT_MAX_RAMPS                      32
 
 GQuark
 gsd_color_state_error_quark (void)
@@ -86,6 +94,65 @@ gsd_color_state_error_quark (void)
         return quark;
 }
 
+static void
+gcm_session_edid_store_save (GsdColorState *state)
+{
+        GsdColorStatePrivate *priv = state->priv;
+        GError *error = NULL;
+        gchar *dirname;
+
+        dirname = g_path_get_dirname (priv->edid_store_path);
+        g_mkdir_with_parents (dirname, 0700);
+        g_free (dirname);
+        if (!g_key_file_save_to_file (priv->edid_store, priv->edid_store_path, &error)) {
+                g_warning ("failed to save EDID cache: %s", error->message);
+                g_error_free (error);
+        }
+}
+
+static gint64
+gcm_session_get_file_mtime (const gchar *filename)
+{
+        GStatBuf buf;
+
+        if (g_stat (filename, &buf) != 0)
+                return -1;
+        return buf.st_mtime;
+}
+
+/* is the profile we created for this EDID still the one on disk */
+static gboolean
+gcm_session_edid_store_has_profile (GsdColorState *state,
+                                    const gchar *checksum,
+                                    const gchar *filename)
+{
+        GsdColorStatePrivate *priv = state->priv;
+        gchar *profile_path;
+        gint64 mtime;
+        gboolean ret;
+
+        profile_path = g_key_file_get_string (priv->edid_store, checksum, "ProfilePath", NULL);
+        mtime = g_key_file_get_int64 (priv->edid_store, checksum, "ProfileMtime", NULL);
+        ret = g_strcmp0 (profile_path, filename) == 0 &&
+              mtime > 0 &&
+              mtime == gcm_session_get_file_mtime (filename);
+        g_free (profile_path);
+        return ret;
+}
+
+static void
+gcm_session_edid_store_set_profile (GsdColorState *state,
+                                    const gchar *checksum,
+                                    const gchar *filename)
+{
+        GsdColorStatePrivate *priv = state->priv;
+
+        g_key_file_set_string (priv->edid_store, checksum, "ProfilePath", filename);
+        g_key_file_set_int64 (priv->edid_store, checksum, "ProfileMtime",
+                              gcm_session_get_file_mtime (filename));
+        gcm_session_edid_store_save (state);
+}
+
 static GcmEdid *
 gcm_session_get_output_edid (GsdColorState *state, GnomeRROutput *output, GError **error)
 {
@@ -93,6 +160,8 @@ gcm_session_get_output_edid (GsdColorState *state, GnomeRROutput *output, GError
         gsize size;
         GcmEdid *edid = NULL;
         gboolean ret;
+        gchar *checksum;
+        GsdColorStatePrivate *priv = state->priv;
 
         /* can we find it in the cache */
         edid = g_hash_table_lookup (state->priv->edid_cache,
@@ -112,12 +181,26 @@ gcm_session_get_output_edid (GsdColorState *state, GnomeRROutput *output, GError
                 return NULL;
         }
         edid = gcm_edid_new ();
+
+        /* did we parse it in an earlier session */
+        checksum = g_compute_checksum_for_data (G_CHECKSUM_MD5, data, size);
+        if (g_key_file_has_group (priv->edid_store, checksum) &&
+            gcm_edid_load_from_key_file (edid, priv->edid_store, checksum, NULL)) {
+                g_debug ("using cached EDID %s for %s",
+                         checksum, gnome_rr_output_get_name (output));
+                g_free (checksum);
+                goto out;
+        }
+        g_free (checksum);
+
         ret = gcm_edid_parse (edid, data, size, error);
         if (!ret) {
                 g_object_unref (edid);
                 return NULL;
         }
-
+        gcm_edid_save_to_key_file (edid, priv->edid_store, gcm_edid_get_checksum (edid));
+        gcm_session_edid_store_save (state);
+out:
         /* add to cache */
         g_hash_table_insert (state->priv->edid_cache,
                              g_strdup (gnome_rr_output_get_name (output)),
@@ -182,7 +265,7 @@ gsd_color_state_set_temperature (GsdColorState *state, guint temperature)
                 return;
 
         priv->color_temperature = temperature;
-        gcm_session_set_gamma_for_all_devices (state);
+        gcm_session_set_temperature_for_all_outputs (state);
 }
 
 guint
@@ -264,6 +347,13 @@ gcm_session_async_helper_free (GcmSessionAsyncHelper *helper)
         g_free (helper);
 }
 
+static void
+gcm_session_object_unref (gpointer object)
+{
+        if (object != NULL)
+                g_object_unref (object);
+}
+
 static gboolean
 gcm_utils_mkdir_for_filename (GFile *file, GError **error)
 {
@@ -383,20 +473,48 @@ out:
         return ret;
 }
 
-static GPtrArray *
-gcm_session_generate_vcgt (CdProfile *profile, guint color_temperature, guint size)
+/* TODO: remove when we can dep on a released version of colord */
+#ifndef CD_PROFILE_METADATA_FILE_CHECKSUM
+#define CD_PROFILE_METADATA_FILE_CHECKSUM	"FILE_checksum"
+#endif
+
+/* decoded VCGT curves for one profile, sampled at the CRTC gamma size */
+typedef struct {
+        guint            size;
+        gfloat          *curves;        /* red, then green, then blue */
+        GHashTable      *ramps;         /* rounded temperature to CLUT */
+} GcmVcgtCacheItem;
+
+static void
+gcm_vcgt_cache_item_free (GcmVcgtCacheItem *item)
+{
+        g_free (item->curves);
+        g_hash_table_unref (item->ramps);
+        g_free (item);
+}
+
+static GcmVcgtCacheItem *
+gcm_session_get_vcgt_cache_item (GsdColorState *state, CdProfile *profile, guint size)
 {
-        GnomeRROutputClutItem *tmp;
-        GPtrArray *array = NULL;
+        GcmVcgtCacheItem *item;
+        GsdColorStatePrivate *priv = state->priv;
         const cmsToneCurve **vcgt;
-        cmsFloat32Number in;
-        guint i;
+        const gchar *checksum;
         cmsHPROFILE lcms_profile;
         CdIcc *icc = NULL;
-        CdColorRGB temp;
+        gchar *key;
 
-        /* invalid size */
-        if (size == 0)
+        /* the file checksum is set by colord, but fall back to the path */
+        checksum = cd_profile_get_metadata_item (profile, CD_PROFILE_METADATA_FILE_CHECKSUM);
+        if (checksum == NULL)
+                checksum = cd_profile_get_filename (profile);
+        if (checksum == NULL)
+                checksum = cd_profile_get_id (profile);
+        key = g_strdup_printf ("%s:%u", checksum, size);
+
+        /* can we find it in the cache */
+        item = g_hash_table_lookup (priv->vcgt_cache, key);
+        if (item != NULL)
                 goto out;
 
         /* open file */
@@ -412,6 +530,51 @@ gcm_session_generate_vcgt (CdProfile *profile, guint color_temperature, guint si
                 goto out;
         }
 
+        /* the curves do not depend on the color temperature, so sample
+         * them once rather than re-reading the profile on every change */
+        g_debug ("decoding VCGT of %s for gamma size %u", checksum, size);
+        item = g_new0 (GcmVcgtCacheItem, 1);
+        item->size = size;
+        item->curves = gcm_clut_sample_vcgt (vcgt, size);
+        item->ramps = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                                             NULL, (GDestroyNotify) gcm_clut_free);
+        g_hash_table_insert (priv->vcgt_cache, key, item);
+        key = NULL;
+out:
+        g_free (key);
+        if (icc != NULL)
+                g_object_unref (icc);
+        return item;
+}
+
+/* the returned ramp is owned by the cache */
+static const GcmClut *
+gcm_session_generate_vcgt (GsdColorState *state,
+                           CdProfile *profile,
+                           guint color_temperature,
+                           guint size)
+{
+        GcmVcgtCacheItem *item;
+        GcmClut *clut;
+        CdColorRGB temp;
+
+        /* invalid size */
+        if (size == 0)
+                return NULL;
+
+        /* get the decoded tone curves */
+        item = gcm_session_get_vcgt_cache_item (state, profile, size);
+        if (item == NULL)
+                return NULL;
+
+        /* a smaller change than this is not visible, and night light
+         * would otherwise generate a new ramp for every frame */
+        color_temperature = ((color_temperature + GCM_VCGT_TEMPERATURE_STEP / 2) /
+                             GCM_VCGT_TEMPERATURE_STEP) * GCM_VCGT_TEMPERATURE_STEP;
+        clut = g_hash_table_lookup (item->ramps, GUINT_TO_POINTER (color_temperature));
+        if (clut != NULL)
+                return clut;
+
         /* get the color temperature */
 #if CD_CHECK_VERSION(1,3,5)
         if (!cd_color_get_blackbody_rgb_full (color_temperature,
@@ -427,147 +590,229 @@ gcm_session_generate_vcgt (CdProfile *profile, guint color_temperature, guint si
                          color_temperature, temp.R, temp.G, temp.B);
         }
 
-        /* create array */
-        array = g_ptr_array_new_with_free_func (g_free);
-        for (i = 0; i < size; i++) {
-                in = (gdouble) i / (gdouble) (size - 1);
-                tmp = g_new0 (GnomeRROutputClutItem, 1);
-                tmp->red = cmsEvalToneCurveFloat(vcgt[0], in) * temp.R * (gdouble) 0xffff;
-                tmp->green = cmsEvalToneCurveFloat(vcgt[1], in) * temp.G * (gdouble) 0xffff;
-                tmp->blue = cmsEvalToneCurveFloat(vcgt[2], in) * temp.B * (gdouble) 0xffff;
-                g_ptr_array_add (array, tmp);
-        }
-out:
-        if (icc != NULL)
-                g_object_unref (icc);
-        return array;
+        /* create ramp */
+        clut = gcm_clut_new (size);
+        gcm_clut_fill (clut, item->curves, &temp);
+
+        /* a transition only passes each temperature once, so just keep
+         * the most recent ramps rather than every one ever generated */
+        if (g_hash_table_size (item->ramps) >= GCM_VCGT_MAX_RAMPS)
+                g_hash_table_remove_all (item->ramps);
+        g_hash_table_insert (item->ramps,
+                             GUINT_TO_POINTER (color_temperature),
+                             clut);
+        return clut;
+}
+
+/* what we last sent to a CRTC, and what we will send next */
+typedef struct {
+        guint            size;
+        gboolean         applied;
+        guint32          applied_hash;
+        gboolean         pending;
+        guint32          pending_hash;
+        GcmClut         *clut;
+} GcmCrtcGamma;
+
+static void
+gcm_crtc_gamma_free (GcmCrtcGamma *gamma)
+{
+        if (gamma->clut != NULL)
+                gcm_clut_free (gamma->clut);
+        g_free (gamma);
+}
+
+static GcmCrtcGamma *
+gcm_session_get_crtc_gamma (GsdColorState *state, GnomeRRCrtc *crtc)
+{
+        GcmCrtcGamma *gamma;
+        GsdColorStatePrivate *priv = state->priv;
+        gint len = 0;
+
+        gamma = g_hash_table_lookup (priv->crtc_gamma,
+                                     GUINT_TO_POINTER (gnome_rr_crtc_get_id (crtc)));
+        if (gamma != NULL)
+                return gamma;
+
+        /* this fetches the whole ramp, so only do it once per CRTC */
+        gnome_rr_crtc_get_gamma (crtc,
+                                 &len,
+                                 NULL, NULL, NULL);
+        gamma = g_new0 (GcmCrtcGamma, 1);
+        gamma->size = len;
+        g_hash_table_insert (priv->crtc_gamma,
+                             GUINT_TO_POINTER (gnome_rr_crtc_get_id (crtc)),
+                             gamma);
+        return gamma;
 }
 
 static guint
-gnome_rr_output_get_gamma_size (GnomeRROutput *output)
+gcm_session_get_output_gamma_size (GsdColorState *state, GnomeRROutput *output)
 {
         GnomeRRCrtc *crtc;
-        gint len = 0;
 
         crtc = gnome_rr_output_get_crtc (output);
         if (crtc == NULL)
                 return 0;
-        gnome_rr_crtc_get_gamma (crtc,
-                                 &len,
-                                 NULL, NULL, NULL);
-        return (guint) len;
+        return gcm_session_get_crtc_gamma (state, crtc)->size;
 }
 
 static gboolean
-gcm_session_output_set_gamma (GnomeRROutput *output,
-                              GPtrArray *array,
+gcm_session_flush_gamma_cb (gpointer user_data)
+{
+        GsdColorState *state = GSD_COLOR_STATE (user_data);
+        GsdColorStatePrivate *priv = state->priv;
+        GcmCrtcGamma *gamma;
+        GHashTableIter iter;
+        GnomeRRCrtc *crtc;
+        gpointer key;
+        guint n_applied = 0;
+
+        priv->crtc_gamma_id = 0;
+
+        g_hash_table_iter_init (&iter, priv->crtc_gamma);
+        while (g_hash_table_iter_next (&iter, &key, (gpointer *) &gamma)) {
+                if (!gamma->pending)
+                        continue;
+                gamma->pending = FALSE;
+                crtc = gnome_rr_screen_get_crtc_by_id (priv->state_screen,
+                                                       GPOINTER_TO_UINT (key));
+                if (crtc == NULL)
+                        continue;
+                gnome_rr_crtc_set_gamma (crtc, gamma->clut->size,
+                                         gamma->clut->data,
+                                         gamma->clut->data + gamma->clut->size,
+                                         gamma->clut->data + gamma->clut->size * 2);
+                gamma->applied = TRUE;
+                gamma->applied_hash = gamma->pending_hash;
+                n_applied++;
+        }
+
+        /* send all the CRTCs to the server together */
+        if (n_applied > 0) {
+                g_debug ("applied gamma to %u CRTCs", n_applied);
+                gdk_display_flush (gdk_display_get_default ());
+        }
+        return G_SOURCE_REMOVE;
+}
+
+/* forget what we sent, as the server may have reset it */
+static void
+gcm_session_invalidate_crtc_gamma (GsdColorState *state)
+{
+        GsdColorStatePrivate *priv = state->priv;
+
+        if (priv->crtc_gamma_id != 0) {
+                g_source_remove (priv->crtc_gamma_id);
+                priv->crtc_gamma_id = 0;
+        }
+        g_hash_table_remove_all (priv->crtc_gamma);
+}
+
+/* The ramp is uploaded from an idle so all the CRTCs that change in
+ * one main loop iteration are sent together, and not at all if the
+ * CRTC already has it */
+static gboolean
+gcm_session_output_set_gamma (GsdColorState *state,
+                              GnomeRROutput *output,
+                              const GcmClut *clut,
                               GError **error)
 {
-        gboolean ret = TRUE;
-        guint16 *red = NULL;
-        guint16 *green = NULL;
-        guint16 *blue = NULL;
-        guint i;
-        GnomeRROutputClutItem *data;
+        GcmCrtcGamma *gamma;
         GnomeRRCrtc *crtc;
+        GsdColorStatePrivate *priv = state->priv;
+        guint32 hash;
 
         /* no length? */
-        if (array->len == 0) {
-                ret = FALSE;
+        if (clut->size == 0) {
                 g_set_error_literal (error,
                                      GSD_COLOR_MANAGER_ERROR,
                                      GSD_COLOR_MANAGER_ERROR_FAILED,
                                      "no data in the CLUT array");
-                goto out;
-        }
-
-        /* convert to a type X understands */
-        red = g_new (guint16, array->len);
-        green = g_new (guint16, array->len);
-        blue = g_new (guint16, array->len);
-        for (i = 0; i < array->len; i++) {
-                data = g_ptr_array_index (array, i);
-                red[i] = data->red;
-                green[i] = data->green;
-                blue[i] = data->blue;
+                return FALSE;
         }
 
-        /* send to LUT */
         crtc = gnome_rr_output_get_crtc (output);
         if (crtc == NULL) {
-                ret = FALSE;
                 g_set_error (error,
                              GSD_COLOR_MANAGER_ERROR,
                              GSD_COLOR_MANAGER_ERROR_FAILED,
                              "failed to get ctrc for %s",
                              gnome_rr_output_get_name (output));
-                goto out;
+                return FALSE;
         }
-        gnome_rr_crtc_set_gamma (crtc, array->len,
-                                 red, green, blue);
-out:
-        g_free (red);
-        g_free (green);
-        g_free (blue);
-        return ret;
+
+        /* unchanged since the last upload? */
+        gamma = gcm_session_get_crtc_gamma (state, crtc);
+        hash = gcm_clut_hash (clut);
+        if (gamma->applied &&
+            gamma->clut->size == clut->size &&
+            gamma->applied_hash == hash) {
+                gamma->pending = FALSE;
+                return TRUE;
+        }
+
+        /* copy, as the ramp may be replaced before the idle runs */
+        if (gamma->clut == NULL || gamma->clut->size != clut->size) {
+                if (gamma->clut != NULL)
+                        gcm_clut_free (gamma->clut);
+                gamma->clut = gcm_clut_new (clut->size);
+                gamma->applied = FALSE;
+        }
+        memcpy (gamma->clut->data, clut->data, clut->size * 3 * sizeof (guint16));
+        gamma->pending_hash = hash;
+        gamma->pending = TRUE;
+
+        if (priv->crtc_gamma_id == 0) {
+                priv->crtc_gamma_id = g_idle_add (gcm_session_flush_gamma_cb, state);
+                g_source_set_name_by_id (priv->crtc_gamma_id, "[gnome-settings-daemon] gcm_session_flush_gamma_cb");
+        }
+        return TRUE;
 }
 
 static gboolean
-gcm_session_device_set_gamma (GnomeRROutput *output,
+gcm_session_device_set_gamma (GsdColorState *state,
+                              GnomeRROutput *output,
                               CdProfile *profile,
                               guint color_temperature,
                               GError **error)
 {
-        gboolean ret = FALSE;
         guint size;
-        GPtrArray *clut = NULL;
+        const GcmClut *clut;
 
         /* create a lookup table */
-        size = gnome_rr_output_get_gamma_size (output);
-        if (size == 0) {
-                ret = TRUE;
-                goto out;
-        }
-        clut = gcm_session_generate_vcgt (profile, color_temperature, size);
+        size = gcm_session_get_output_gamma_size (state, output);
+        if (size == 0)
+                return TRUE;
+        clut = gcm_session_generate_vcgt (state, profile, color_temperature, size);
         if (clut == NULL) {
                 g_set_error_literal (error,
                                      GSD_COLOR_MANAGER_ERROR,
                                      GSD_COLOR_MANAGER_ERROR_FAILED,
                                      "failed to generate vcgt");
-                goto out;
+                return FALSE;
         }
 
         /* apply the vcgt to this output */
-        ret = gcm_session_output_set_gamma (output, clut, error);
-        if (!ret)
-                goto out;
-out:
-        if (clut != NULL)
-                g_ptr_array_unref (clut);
-        return ret;
+        return gcm_session_output_set_gamma (state, output, clut, error);
 }
 
 static gboolean
-gcm_session_device_reset_gamma (GnomeRROutput *output,
+gcm_session_device_reset_gamma (GsdColorState *state,
+                                GnomeRROutput *output,
                                 guint color_temperature,
                                 GError **error)
 {
-        gboolean ret;
-        guint i;
         guint size;
-        guint32 value;
-        GPtrArray *clut;
-        GnomeRROutputClutItem *data;
+        GcmClut *clut;
         CdColorRGB temp;
+        GsdColorStatePrivate *priv = state->priv;
 
         /* create a linear ramp */
         g_debug ("falling back to dummy ramp");
-        clut = g_ptr_array_new_with_free_func (g_free);
-        size = gnome_rr_output_get_gamma_size (output);
-        if (size == 0) {
-                ret = TRUE;
-                goto out;
-        }
+        size = gcm_session_get_output_gamma_size (state, output);
+        if (size == 0)
+                return TRUE;
 
         /* get the color temperature */
         if (!cd_color_get_blackbody_rgb (color_temperature, &temp)) {
@@ -578,22 +823,19 @@ gcm_session_device_reset_gamma (GnomeRROutput *output,
                          color_temperature, temp.R, temp.G, temp.B);
         }
 
-        for (i = 0; i < size; i++) {
-                value = (i * 0xffff) / (size - 1);
-                data = g_new0 (GnomeRROutputClutItem, 1);
-                data->red = value * temp.R;
-                data->green = value * temp.G;
-                data->blue = value * temp.B;
-                g_ptr_array_add (clut, data);
+        /* reuse the buffer from the last time for this output */
+        clut = g_hash_table_lookup (priv->output_cluts,
+                                    gnome_rr_output_get_name (output));
+        if (clut == NULL || clut->size != size) {
+                clut = gcm_clut_new (size);
+                g_hash_table_insert (priv->output_cluts,
+                                     g_strdup (gnome_rr_output_get_name (output)),
+                                     clut);
         }
+        gcm_clut_fill (clut, NULL, &temp);
 
         /* apply the vcgt to this output */
-        ret = gcm_session_output_set_gamma (output, clut, error);
-        if (!ret)
-                goto out;
-out:
-        g_ptr_array_unref (clut);
-        return ret;
+        return gcm_session_output_set_gamma (state, output, clut, error);
 }
 
 static GnomeRROutput *
@@ -771,8 +1013,12 @@ gcm_session_device_assign_profile_connect_cb (GObject *object,
 
         /* create a vcgt for this icc file */
         ret = cd_profile_get_has_vcgt (profile);
+        g_hash_table_insert (priv->output_profiles,
+                             g_strdup (gnome_rr_output_get_name (output)),
+                             ret ? g_object_ref (profile) : NULL);
         if (ret) {
-                ret = gcm_session_device_set_gamma (output,
+                ret = gcm_session_device_set_gamma (state,
+                                                    output,
                                                     profile,
                                                     priv->color_temperature,
                                                     &error);
@@ -784,7 +1030,8 @@ gcm_session_device_assign_profile_connect_cb (GObject *object,
                         goto out;
                 }
         } else {
-                ret = gcm_session_device_reset_gamma (output,
+                ret = gcm_session_device_reset_gamma (state,
+                                                      output,
                                                       priv->color_temperature,
                                                       &error);
                 if (!ret) {
@@ -895,8 +1142,15 @@ gcm_session_device_assign_connect_cb (GObject *object,
 
                 /* check if auto-profile has up-to-date metadata */
                 file = g_file_new_for_path (autogen_path);
-                if (gcm_session_check_profile_device_md (file)) {
+                if (gcm_session_edid_store_has_profile (state,
+                                                        gcm_edid_get_checksum (edid),
+                                                        autogen_path)) {
+                        g_debug ("auto-profile edid %s unchanged", autogen_path);
+                } else if (gcm_session_check_profile_device_md (file)) {
                         g_debug ("auto-profile edid %s exists with md", autogen_path);
+                        gcm_session_edid_store_set_profile (state,
+                                                            gcm_edid_get_checksum (edid),
+                                                            autogen_path);
                 } else {
                         g_debug ("auto-profile edid does not exist, creating as %s",
                                  autogen_path);
@@ -909,6 +1163,10 @@ gcm_session_device_assign_connect_cb (GObject *object,
                                 g_warning ("failed to create profile from EDID data: %s",
                                              error->message);
                                 g_clear_error (&error);
+                        } else {
+                                gcm_session_edid_store_set_profile (state,
+                                                                    gcm_edid_get_checksum (edid),
+                                                                    autogen_path);
                         }
                 }
         }
@@ -929,7 +1187,11 @@ gcm_session_device_assign_connect_cb (GObject *object,
                 }
 
                 /* reset, as we want linear profiles for profiling */
-                ret = gcm_session_device_reset_gamma (output,
+                g_hash_table_insert (priv->output_profiles,
+                                     g_strdup (gnome_rr_output_get_name (output)),
+                                     NULL);
+                ret = gcm_session_device_reset_gamma (state,
+                                                      output,
                                                       priv->color_temperature,
                                                       &error);
                 if (!ret) {
@@ -1195,6 +1457,10 @@ gnome_rr_screen_output_removed_cb (GnomeRRScreen *screen,
                  gnome_rr_output_get_name (output));
         g_hash_table_remove (state->priv->edid_cache,
                              gnome_rr_output_get_name (output));
+        g_hash_table_remove (state->priv->output_profiles,
+                             gnome_rr_output_get_name (output));
+        g_hash_table_remove (state->priv->output_cluts,
+                             gnome_rr_output_get_name (output));
         cd_client_find_device_by_property (state->priv->client,
                                            CD_DEVICE_METADATA_XRANDR_NAME,
                                            gnome_rr_output_get_name (output),
@@ -1258,6 +1524,20 @@ gcm_session_profile_gamma_find_device_cb (GObject *object,
                 g_object_unref (device);
 }
 
+static void
+gcm_session_set_gamma_for_output (GsdColorState *state, GnomeRROutput *output)
+{
+        GsdColorStatePrivate *priv = state->priv;
+
+        /* get CdDevice for this output */
+        cd_client_find_device_by_property (priv->client,
+                                           CD_DEVICE_METADATA_XRANDR_NAME,
+                                           gnome_rr_output_get_name (output),
+                                           priv->cancellable,
+                                           gcm_session_profile_gamma_find_device_cb,
+                                           state);
+}
+
 static void
 gcm_session_set_gamma_for_all_devices (GsdColorState *state)
 {
@@ -1271,19 +1551,64 @@ gcm_session_set_gamma_for_all_devices (GsdColorState *state)
                 return;
 
         /* get STATE outputs */
+        outputs = gnome_rr_screen_list_outputs (priv->state_screen);
+        if (outputs == NULL) {
+                g_warning ("failed to get outputs");
+                return;
+        }
+        for (i = 0; outputs[i] != NULL; i++)
+                gcm_session_set_gamma_for_output (state, outputs[i]);
+}
+
+/* Only the temperature changed, so use the profiles we assigned last
+ * rather than asking colord again, as night light does this many
+ * times a second during a transition. The mapping is refreshed when
+ * colord or RandR tell us something changed. */
+static void
+gcm_session_set_temperature_for_all_outputs (GsdColorState *state)
+{
+        CdProfile *profile;
+        GError *error = NULL;
+        GnomeRROutput **outputs;
+        GsdColorStatePrivate *priv = state->priv;
+        gboolean ret;
+        guint i;
+
+        if (priv->state_screen == NULL)
+                return;
+
         outputs = gnome_rr_screen_list_outputs (priv->state_screen);
         if (outputs == NULL) {
                 g_warning ("failed to get outputs");
                 return;
         }
         for (i = 0; outputs[i] != NULL; i++) {
-                /* get CdDevice for this output */
-                cd_client_find_device_by_property (state->priv->client,
-                                                   CD_DEVICE_METADATA_XRANDR_NAME,
+                /* not assigned yet, so do it the slow way */
+                if (!g_hash_table_lookup_extended (priv->output_profiles,
                                                    gnome_rr_output_get_name (outputs[i]),
-                                                   priv->cancellable,
-                                                   gcm_session_profile_gamma_find_device_cb,
-                                                   state);
+                                                   NULL,
+                                                   (gpointer *) &profile)) {
+                        gcm_session_set_gamma_for_output (state, outputs[i]);
+                        continue;
+                }
+                if (profile != NULL) {
+                        ret = gcm_session_device_set_gamma (state,
+                                                            outputs[i],
+                                                            profile,
+                                                            priv->color_temperature,
+                                                            &error);
+                } else {
+                        ret = gcm_session_device_reset_gamma (state,
+                                                              outputs[i],
+                                                              priv->color_temperature,
+                                                              &error);
+                }
+                if (!ret) {
+                        g_warning ("failed to set %s gamma tables: %s",
+                                   gnome_rr_output_get_name (outputs[i]),
+                                   error->message);
+                        g_clear_error (&error);
+                }
         }
 }
 
@@ -1294,6 +1619,7 @@ static void
 gnome_rr_screen_output_changed_cb (GnomeRRScreen *screen,
                                    GsdColorState *state)
 {
+        gcm_session_invalidate_crtc_gamma (state);
         gcm_session_set_gamma_for_all_devices (state);
 }
 
@@ -1340,6 +1666,9 @@ gcm_session_active_changed_cb (GDBusProxy      *session,
          */
         if (is_active && !priv->session_is_active) {
                 g_debug ("Done switch to new account, reload devices");
+                /* the ramps may have been reset while we were away, so
+                 * don't trust what we last uploaded */
+                gcm_session_invalidate_crtc_gamma (state);
                 cd_client_get_devices (priv->client,
                                        priv->cancellable,
                                        gcm_session_get_devices_cb,
@@ -1509,6 +1838,39 @@ gsd_color_state_init (GsdColorState *state)
                                                   g_free,
                                                   g_object_unref);
 
+        /* decoding the VCGT means loading the whole profile */
+        priv->vcgt_cache = g_hash_table_new_full (g_str_hash,
+                                                  g_str_equal,
+                                                  g_free,
+                                                  (GDestroyNotify) gcm_vcgt_cache_item_free);
+
+        /* the profile assigned to each output, or NULL for a linear ramp */
+        priv->output_profiles = g_hash_table_new_full (g_str_hash,
+                                                       g_str_equal,
+                                                       g_free,
+                                                       (GDestroyNotify) gcm_session_object_unref);
+
+        /* linear ramps are regenerated in place */
+        priv->output_cluts = g_hash_table_new_full (g_str_hash,
+                                                    g_str_equal,
+                                                    g_free,
+                                                    (GDestroyNotify) gcm_clut_free);
+
+        /* the ramp last sent to each CRTC */
+        priv->crtc_gamma = g_hash_table_new_full (g_direct_hash,
+                                                  g_direct_equal,
+                                                  NULL,
+                                                  (GDestroyNotify) gcm_crtc_gamma_free);
+
+        /* parsed EDIDs and the profiles made from them, by EDID checksum */
+        priv->edid_store = g_key_file_new ();
+        priv->edid_store_path = g_build_filename (g_get_user_cache_dir (),
+                                                  "gnome-settings-daemon",
+                                                  "edid-cache",
+                                                  NULL);
+        g_key_file_load_from_file (priv->edid_store, priv->edid_store_path,
+                                   G_KEY_FILE_NONE, NULL);
+
         /* we don't want to assign devices multiple times at startup */
         priv->device_assign_hash = g_hash_table_new_full (g_str_hash,
                                                           g_str_equal,
@@ -1536,6 +1898,14 @@ gsd_color_state_finalize (GObject *object)
         g_clear_object (&state->priv->client);
         g_clear_object (&state->priv->session);
         g_clear_pointer (&state->priv->edid_cache, g_hash_table_destroy);
+        g_clear_pointer (&state->priv->edid_store, g_key_file_unref);
+        g_clear_pointer (&state->priv->edid_store_path, g_free);
+        g_clear_pointer (&state->priv->vcgt_cache, g_hash_table_destroy);
+        g_clear_pointer (&state->priv->output_profiles, g_hash_table_destroy);
+        g_clear_pointer (&state->priv->output_cluts, g_hash_table_destroy);
+        if (state->priv->crtc_gamma_id != 0)
+                g_source_remove (state->priv->crtc_gamma_id);
+        g_clear_pointer (&state->priv->crtc_gamma, g_hash_table_destroy);
         g_clear_pointer (&state->priv->device_assign_hash, g_hash_table_destroy);
         g_clear_object (&state->priv->state_screen);
 
@@ -21,6 +21,7 @@
 #include "config.h"
 
 #include <geoclue.h>
+#include <math.h>
 
 #define GNOME_DESKTOP_USE_UNSTABLE_API
 #include "gnome-datetime-source.h"
@@ -51,6 +52,7 @@ struct _GsdNightLight {
         gdouble            smooth_target_temperature;
         GCancellable      *cancellable;
         GDateTime         *datetime_override;
+        gboolean           started;
 };
 
 enum {
@@ -64,8 +66,8 @@ enum {
 };
 
 #define GSD_NIGHT_LIGHT_SCHEDULE_TIMEOUT      5       /* seconds */
-#define GSD_NIGHT_LIGHT_POLL_TIMEOUT          60      /* seconds */
 #define GSD_NIGHT_LIGHT_POLL_SMEAR            1       /* hours */
+#define GSD_NIGHT_LIGHT_SMEAR_STEP            20.f    /* Kelvin */
 #define GSD_NIGHT_LIGHT_SMOOTH_SMEAR          5.f     /* seconds */
 
 #define GSD_FRAC_DAY_MAX_DELTA                  (1.f/60.f)     /* 1 minute */
@@ -73,8 +75,9 @@ enum {
 
 #define DESKTOP_ID "gnome-color-panel"
 
+static void night_light_recheck (GsdNightLight *self);
 static void poll_timeout_destroy (GsdNightLight *self);
-static void poll_timeout_create (GsdNightLight *self);
+static void poll_timeout_create (GsdNightLight *self, gdouble hours);
 
 G_DEFINE_TYPE (GsdNightLight, gsd_night_light, G_TYPE_OBJECT);
 
@@ -92,6 +95,10 @@ gsd_night_light_set_date_time_now (GsdNightLight *self, GDateTime *datetime)
         if (self->datetime_override != NULL)
                 g_date_time_unref (self->datetime_override);
         self->datetime_override = g_date_time_ref (datetime);
+
+        /* act on the new time as if the clock had been set */
+        if (self->started)
+                night_light_recheck (self);
 }
 
 static void
@@ -118,8 +125,8 @@ gsd_night_light_set_smooth_enabled (GsdNightLight *self,
 static gdouble
 linear_interpolate (gdouble val1, gdouble val2, gdouble factor)
 {
-        g_return_val_if_fail (factor > 0.f, -1.f);
-        g_return_val_if_fail (factor < 1.f, -1.f);
+        g_return_val_if_fail (factor >= 0.f, -1.f);
+        g_return_val_if_fail (factor <= 1.f, -1.f);
         return ((val1 - val2) * factor) + val2;
 }
 
@@ -238,10 +245,33 @@ gsd_night_light_set_active (GsdNightLight *self, gboolean active)
         g_object_notify (G_OBJECT (self), "active");
 }
 
-static void
-night_light_recheck (GsdNightLight *self)
+/* hours between smear steps that are large enough to be seen */
+static gdouble
+night_light_smear_frame (gdouble smear, guint temperature)
+{
+        gdouble range = ABS ((gdouble) GSD_COLOR_TEMPERATURE_DEFAULT - temperature);
+        if (range < GSD_NIGHT_LIGHT_SMEAR_STEP)
+                return smear;
+        return MAX (smear * GSD_NIGHT_LIGHT_SMEAR_STEP / range, 1.f / 3600.f);
+}
+
+/* hours until the fractional hour target next comes round */
+static gdouble
+frac_day_until (gdouble frac_day, gdouble target)
+{
+        gdouble delta = fmod (target - frac_day, 24.f);
+        if (delta <= 0.f)
+                delta += 24.f;
+        return delta;
+}
+
+/* Returns the hours until the state next needs to be rechecked, or
+ * a negative value if only a settings change can alter it */
+static gdouble
+night_light_recheck_state (GsdNightLight *self)
 {
         gdouble frac_day;
+        gdouble next;
         gdouble schedule_from = -1.f;
         gdouble schedule_to = -1.f;
         gdouble smear = GSD_NIGHT_LIGHT_POLL_SMEAR; /* hours */
@@ -253,7 +283,7 @@ night_light_recheck (GsdNightLight *self)
         if (!g_settings_get_boolean (self->settings, "night-light-enabled")) {
                 g_debug ("night light disabled, resetting");
                 gsd_night_light_set_active (self, FALSE);
-                return;
+                return -1.f;
         }
 
         /* disabled until tomorrow */
@@ -263,7 +293,7 @@ night_light_recheck (GsdNightLight *self)
                         g_debug ("night light still day-disabled, resetting");
                         gsd_night_light_set_temperature (self,
                                                          GSD_COLOR_TEMPERATURE_DEFAULT);
-                        return;
+                        return 24.f - gsd_night_light_frac_day_from_dt (dt_now);
                 }
 
                 /* no longer valid */
@@ -293,12 +323,16 @@ night_light_recheck (GsdNightLight *self)
         frac_day = gsd_night_light_frac_day_from_dt (dt_now);
         g_debug ("fractional day = %.3f, limits = %.3f->%.3f",
                  frac_day, schedule_from, schedule_to);
+
+        /* the sunrise and sunset move each day */
+        next = 24.f - frac_day;
+
         if (!gsd_night_light_frac_day_is_between (frac_day,
                                                     schedule_from - smear,
                                                     schedule_to)) {
                 g_debug ("not time for night-light");
                 gsd_night_light_set_active (self, FALSE);
-                return;
+                return MIN (next, frac_day_until (frac_day, schedule_from - smear));
         }
 
         /* smear the temperature for a short duration before the set limits
@@ -318,19 +352,36 @@ night_light_recheck (GsdNightLight *self)
                 gdouble factor = 1.f - ((frac_day - (schedule_from - smear)) / smear);
                 temp_smeared = linear_interpolate (GSD_COLOR_TEMPERATURE_DEFAULT,
                                                    temperature, factor);
+                next = MIN (next, frac_day_until (frac_day, schedule_from));
+                next = MIN (next, night_light_smear_frame (smear, temperature));
         } else if (gsd_night_light_frac_day_is_between (frac_day,
                                                           schedule_to - smear,
                                                           schedule_to)) {
                 gdouble factor = (frac_day - (schedule_to - smear)) / smear;
                 temp_smeared = linear_interpolate (GSD_COLOR_TEMPERATURE_DEFAULT,
                                                    temperature, factor);
+                next = MIN (next, frac_day_until (frac_day, schedule_to));
+                next = MIN (next, night_light_smear_frame (smear, temperature));
         } else {
                 temp_smeared = temperature;
+                next = MIN (next, frac_day_until (frac_day, schedule_to - smear));
         }
         g_debug ("night light mode on, using temperature of %uK (aiming for %uK)",
                  temp_smeared, temperature);
         gsd_night_light_set_active (self, TRUE);
         gsd_night_light_set_temperature (self, temp_smeared);
+        return next;
+}
+
+static void
+night_light_recheck (GsdNightLight *self)
+{
+        gdouble next = night_light_recheck_state (self);
+
+        /* wake up only when something is due to change */
+        poll_timeout_destroy (self);
+        if (next > 0.f)
+                poll_timeout_create (self, next);
 }
 
 static gboolean
@@ -354,35 +405,63 @@ night_light_recheck_schedule (GsdNightLight *self)
                                        self);
 }
 
-/* called when the time may have changed */
+/* called when the next change is due, or the time may have changed */
 static gboolean
 night_light_recheck_cb (gpointer user_data)
 {
         GsdNightLight *self = GSD_NIGHT_LIGHT (user_data);
 
-        /* recheck parameters, then reschedule a new timeout */
+        /* the source is destroyed after this returns */
+        g_clear_pointer (&self->source, g_source_unref);
+
+        /* recheck parameters, which schedules the next wakeup */
         night_light_recheck (self);
-        poll_timeout_destroy (self);
-        poll_timeout_create (self);
 
         /* return value ignored for a one-time watch */
         return G_SOURCE_REMOVE;
 }
 
 static void
-poll_timeout_create (GsdNightLight *self)
+poll_timeout_create (GsdNightLight *self, gdouble hours)
 {
         g_autoptr(GDateTime) dt_now = NULL;
+        g_autoptr(GDateTime) dt_day = NULL;
         g_autoptr(GDateTime) dt_expiry = NULL;
+        gint64 secs;
 
         if (self->source != NULL)
                 return;
 
+        /* the schedule is in local wall-clock time, so aim for the time
+         * of day it names rather than a number of seconds from now, which
+         * would be off by the difference across a DST change; round up,
+         * as waking just before the boundary is pointless */
         dt_now = gsd_night_light_get_date_time_now (self);
-        dt_expiry = g_date_time_add_seconds (dt_now, GSD_NIGHT_LIGHT_POLL_TIMEOUT);
+        secs = ceil ((gsd_night_light_frac_day_from_dt (dt_now) + hours) * 3600.f) + 1;
+        dt_day = g_date_time_add_days (dt_now, secs / 86400);
+        secs %= 86400;
+        dt_expiry = g_date_time_new_local (g_date_time_get_year (dt_day),
+                                           g_date_time_get_month (dt_day),
+                                           g_date_time_get_day_of_month (dt_day),
+                                           secs / 3600,
+                                           (secs / 60) % 60,
+                                           secs % 60);
+
+        /* the first of a repeated hour may already have passed */
+        if (g_date_time_compare (dt_expiry, dt_now) <= 0) {
+                GDateTime *tmp = g_date_time_add_hours (dt_expiry, 1);
+                g_date_time_unref (dt_expiry);
+                dt_expiry = tmp;
+        }
+        g_debug ("next night light check at %02i:%02i:%02i",
+                 g_date_time_get_hour (dt_expiry),
+                 g_date_time_get_minute (dt_expiry),
+                 g_date_time_get_second (dt_expiry));
+
+        /* also wake up if the wall clock is changed */
         self->source = _gnome_datetime_source_new (dt_now,
-                                                                 dt_expiry,
-                                                                 FALSE);
+                                                   dt_expiry,
+                                                   TRUE);
         g_source_set_callback (self->source,
                                night_light_recheck_cb,
                                self, NULL);
@@ -397,6 +476,7 @@ poll_timeout_destroy (GsdNightLight *self)
                 return;
 
         g_source_destroy (self->source);
+        g_source_unref (self->source);
         self->source = NULL;
 }
 
@@ -546,8 +626,8 @@ gsd_night_light_set_geoclue_enabled (GsdNightLight *self, gboolean enabled)
 gboolean
 gsd_night_light_start (GsdNightLight *self, GError **error)
 {
+        self->started = TRUE;
         night_light_recheck (self);
-        poll_timeout_create (self);
 
         /* care about changes */
         g_signal_connect (self->settings, "changed",
@@ -36,10 +36,17 @@
 
 #include "gsd-disk-space.h"
 #include "gsd-disk-space-helper.h"
+#include "gsd-purge.h"
+#include "gsd-disk-usage.h"
 
 #define GIGABYTE                   1024 * 1024 * 1024
 
 #define CHECK_EVERY_X_SECONDS      60
+#define LDSM_PROBE_TIMEOUT         5    /* seconds */
+#define LDSM_MAX_BACKOFF           3600 /* seconds */
+#define LDSM_MIN_INTERVAL          10   /* seconds */
+#define LDSM_MAX_INTERVAL          900  /* seconds */
+#define LDSM_HISTORY_LENGTH        8
 
 #define DISK_SPACE_ANALYZER        "baobab"
 
@@ -62,9 +69,52 @@ typedef struct
         time_t notify_time;
 } LdsmMountInfo;
 
+/* Each mount is probed again when it might get low on space, going by
+ * how fast its free space went down over the last few probes.
+ *
+ * Mounts that didn't answer a statvfs() in time are stale, and are
+ * probed again after a backoff that doubles with every timeout. */
+typedef struct
+{
+        gboolean         in_flight;
+        gpointer         check;         /* the check that started it, not a reference */
+        gboolean         stale;
+        guint            failures;
+        gint64           next_probe;    /* monotonic time */
+        gboolean         seen;          /* still a candidate in the last check */
+
+        /* ring buffer of the space available to users */
+        gint64           history_time[LDSM_HISTORY_LENGTH];
+        guint64          history_free[LDSM_HISTORY_LENGTH];
+        guint            history_len;
+        guint            history_pos;   /* next slot */
+} LdsmProbeState;
+
+typedef struct
+{
+        gint             ref_count;
+        GList           *mounts;        /* LdsmMountInfo of the answered probes */
+        guint            pending;
+        guint            timeout_id;
+        gboolean         done;
+} LdsmCheck;
+
+typedef struct
+{
+        LdsmCheck       *check;
+        LdsmMountInfo   *mount_info;
+        gchar           *path;
+        int              result;
+} LdsmProbe;
+
 static GHashTable        *ldsm_notified_hash = NULL;
 static unsigned int       ldsm_timeout_id = 0;
 static GUnixMountMonitor *ldsm_monitor = NULL;
+static GHashTable        *ldsm_probe_hash = NULL;
+static GThreadPool       *ldsm_probe_pool = NULL;
+static LdsmCheck         *ldsm_check = NULL;
+static gboolean           ldsm_check_again = FALSE;
+static GsdDiskUsage      *ldsm_usage = NULL;
 static double             free_percent_notify = 0.05;
 static double             free_percent_notify_again = 0.01;
 static unsigned int       free_size_gb_no_notify = 2;
@@ -81,6 +131,7 @@ static gboolean           purge_temp_files;
 static guint              purge_after;
 static guint              purge_trash_id = 0;
 static guint              purge_temp_id = 0;
+static GCancellable      *purge_cancellable = NULL;
 
 static gchar*
 ldsm_get_fs_id_for_path (const gchar *path)
@@ -200,310 +251,102 @@ examine_callback (NotifyNotification *n,
         notify_notification_close (n, NULL);
 }
 
-static gboolean
-should_purge_file (GFile        *file,
-                   GCancellable *cancellable,
-                   GDateTime    *old)
-{
-        GFileInfo *info;
-        GDateTime *date;
-        gboolean should_purge;
-
-        should_purge = FALSE;
-
-        info = g_file_query_info (file,
-                                  G_FILE_ATTRIBUTE_TRASH_DELETION_DATE ","
-                                  G_FILE_ATTRIBUTE_UNIX_UID ","
-                                  G_FILE_ATTRIBUTE_TIME_CHANGED,
-                                  G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
-                                  cancellable,
-                                  NULL);
-        if (!info)
-                return FALSE;
-
-        date = g_file_info_get_deletion_date (info);
-        if (date == NULL) {
-                guint uid;
-                guint64 ctime;
-
-                uid = g_file_info_get_attribute_uint32 (info, G_FILE_ATTRIBUTE_UNIX_UID);
-                if (uid != getuid ()) {
-                        should_purge = FALSE;
-                        goto out;
-                }
-
-                ctime = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_CHANGED);
-                date = g_date_time_new_from_unix_local ((gint64) ctime);
-        }
-
-        should_purge = g_date_time_difference (old, date) >= 0;
-        g_date_time_unref (date);
-
-out:
-        g_object_unref (info);
-
-        return should_purge;
-}
-
-DeleteData *
-delete_data_new (GFile        *file,
-                 GCancellable *cancellable,
-                 GDateTime    *old,
-                 gboolean      dry_run,
-                 gboolean      trash,
-                 gint          depth)
+static gchar **
+ldsm_get_temp_dirs (void)
 {
-        DeleteData *data;
-
-        data = g_new (DeleteData, 1);
-        data->ref_count = 1;
-        data->file = g_object_ref (file);
-        data->cancellable = cancellable ? g_object_ref (cancellable) : NULL;
-        data->old = g_date_time_ref (old);
-        data->dry_run = dry_run;
-        data->trash = trash;
-        data->depth = depth;
-        data->name = g_file_get_parse_name (data->file);
-
-        return data;
-}
+        GPtrArray *dirs;
 
-static DeleteData *
-delete_data_ref (DeleteData *data)
-{
-  data->ref_count += 1;
-  return data;
-}
-
-void
-delete_data_unref (DeleteData *data)
-{
-        data->ref_count -= 1;
-        if (data->ref_count > 0)
-                return;
+        dirs = g_ptr_array_new ();
+        g_ptr_array_add (dirs, g_strdup (g_get_tmp_dir ()));
+        if (g_strcmp0 (g_get_tmp_dir (), "/var/tmp") != 0)
+                g_ptr_array_add (dirs, g_strdup ("/var/tmp"));
+        if (g_strcmp0 (g_get_tmp_dir (), "/tmp") != 0)
+                g_ptr_array_add (dirs, g_strdup ("/tmp"));
+        g_ptr_array_add (dirs, NULL);
 
-        g_object_unref (data->file);
-        if (data->cancellable)
-                g_object_unref (data->cancellable);
-        g_date_time_unref (data->old);
-        g_free (data->name);
-        g_free (data);
+        return (gchar **) g_ptr_array_free (dirs, FALSE);
 }
 
 static void
-delete_batch (GObject      *source,
-              GAsyncResult *res,
-              gpointer      user_data)
+ldsm_purge_progress (const GsdPurgeStats *stats,
+                     gpointer             user_data)
 {
-        GFileEnumerator *enumerator = G_FILE_ENUMERATOR (source);
-        DeleteData *data = user_data;
-        GList *files, *f;
-        GFile *child_file;
-        DeleteData *child;
-        GFileInfo *info;
-        GError *error = NULL;
-
-        files = g_file_enumerator_next_files_finish (enumerator, res, &error);
-
-        g_debug ("GsdHousekeeping: purging %d children of %s", g_list_length (files), data->name);
-
-        if (files) {
-                for (f = files; f; f = f->next) {
-                        if (g_cancellable_is_cancelled (data->cancellable))
-                                break;
-                        info = f->data;
-
-                        child_file = g_file_get_child (data->file, g_file_info_get_name (info));
-                        child = delete_data_new (child_file,
-                                                 data->cancellable,
-                                                 data->old,
-                                                 data->dry_run,
-                                                 data->trash,
-                                                 data->depth + 1);
-                        delete_recursively_by_age (child);
-                        delete_data_unref (child);
-                        g_object_unref (child_file);
-                }
-                g_list_free_full (files, g_object_unref);
-                if (!g_cancellable_is_cancelled (data->cancellable)) {
-                        g_file_enumerator_next_files_async (enumerator, 20,
-                                                            0,
-                                                            data->cancellable,
-                                                            delete_batch,
-                                                            data);
-                        return;
-                }
-        }
+        const gchar *what = user_data;
+        gchar *size;
 
-        g_file_enumerator_close (enumerator, data->cancellable, NULL);
-        g_object_unref (enumerator);
-
-        if (data->depth > 0 && !g_cancellable_is_cancelled (data->cancellable)) {
-                if ((data->trash && data->depth > 1) ||
-                     should_purge_file (data->file, data->cancellable, data->old)) {
-                        g_debug ("GsdHousekeeping: purging %s\n", data->name);
-                        if (!data->dry_run) {
-                                g_file_delete (data->file, data->cancellable, NULL);
-                        }
-                }
-        }
-        delete_data_unref (data);
+        size = g_format_size (stats->bytes_freed);
+        g_debug ("housekeeping: purging %s: %" G_GUINT64_FORMAT " scanned, %" G_GUINT64_FORMAT " removed, %s freed",
+                 what, stats->n_scanned, stats->n_deleted, size);
+        g_free (size);
 }
 
 static void
-delete_subdir (GObject      *source,
-               GAsyncResult *res,
-               gpointer      user_data)
+ldsm_purge_done (GObject      *source_object,
+                 GAsyncResult *res,
+                 gpointer      user_data)
 {
-        GFile *file = G_FILE (source);
-        DeleteData *data = user_data;
-        GFileEnumerator *enumerator;
+        const gchar *what = user_data;
+        GsdPurgeStats stats;
         GError *error = NULL;
+        gchar *size;
 
-        g_debug ("GsdHousekeeping: purging %s in %s\n",
-                 data->trash ? "trash" : "temporary files", data->name);
-
-        enumerator = g_file_enumerate_children_finish (file, res, &error);
-        if (error) {
-                if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_NOT_DIRECTORY) &&
-                    !g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
-                        g_warning ("Failed to enumerate children of %s: %s\n", data->name, error->message);
-        }
-        if (enumerator) {
-                g_file_enumerator_next_files_async (enumerator, 20,
-                                                    0,
-                                                    data->cancellable,
-                                                    delete_batch,
-                                                    delete_data_ref (data));
-        } else if (data->depth > 0 && g_error_matches (error, G_IO_ERROR, G_IO_ERROR_NOT_DIRECTORY)) {
-                if ((data->trash && data->depth > 1) ||
-                     should_purge_file (data->file, data->cancellable, data->old)) {
-                        g_debug ("Purging %s leaf node", data->name);
-                        if (!data->dry_run) {
-                                g_file_delete (data->file, data->cancellable, NULL);
-                        }
-                }
+        if (!gsd_purge_finish (res, &stats, &error)) {
+                if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+                        g_warning ("Failed to purge %s: %s", what, error->message);
+                g_error_free (error);
         }
 
-        if (error)
-                g_error_free (error);
-        delete_data_unref (data);
+        size = g_format_size (stats.bytes_freed);
+        g_debug ("housekeeping: purged %s: %" G_GUINT64_FORMAT " scanned, %" G_GUINT64_FORMAT " removed, %s freed",
+                 what, stats.n_scanned, stats.n_deleted, size);
+        g_free (size);
 }
 
 static void
-delete_subdir_check_symlink (GObject      *source,
-                             GAsyncResult *res,
-                             gpointer      user_data)
+ldsm_purge (GsdPurgeKind  kind,
+            GDateTime    *old,
+            gboolean      dry_run)
 {
-        GFile *file = G_FILE (source);
-        DeleteData *data = user_data;
-        GFileInfo *info;
-
-        info = g_file_query_info_finish (file, res, NULL);
-        if (!info) {
-                delete_data_unref (data);
-                return;
-        }
-
-        if (g_file_info_get_file_type (info) == G_FILE_TYPE_SYMBOLIC_LINK) {
-                if (should_purge_file (data->file, data->cancellable, data->old)) {
-                        g_debug ("Purging %s leaf node", data->name);
-                        if (!data->dry_run) {
-                                g_file_delete (data->file, data->cancellable, NULL);
-                        }
-                }
-        } else if (g_strcmp0 (g_file_info_get_name (info), ".X11-unix") == 0) {
-                g_debug ("Skipping X11 socket directory");
+        const gchar *what;
+        gchar **dirs;
+
+        /* the trash directories are found in the purge thread, as
+         * looking at each mount could block on network file systems */
+        if (kind == GSD_PURGE_TRASH) {
+                dirs = NULL;
+                what = dry_run ? "trash (dry run)" : "trash";
         } else {
-                g_file_enumerate_children_async (data->file,
-                                                 G_FILE_ATTRIBUTE_STANDARD_NAME ","
-                                                 G_FILE_ATTRIBUTE_STANDARD_TYPE,
-                                                 G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
-                                                 0,
-                                                 data->cancellable,
-                                                 delete_subdir,
-                                                 delete_data_ref (data));
-        }
-        g_object_unref (info);
-        delete_data_unref (data);
-}
-
-void
-delete_recursively_by_age (DeleteData *data)
-{
-        if (data->trash && (data->depth == 1) &&
-            !should_purge_file (data->file, data->cancellable, data->old)) {
-                /* no need to recurse into trashed directories */
-                return;
+                dirs = ldsm_get_temp_dirs ();
+                what = dry_run ? "temporary files (dry run)" : "temporary files";
         }
 
-        g_file_query_info_async (data->file,
-                                 G_FILE_ATTRIBUTE_STANDARD_NAME ","
-                                 G_FILE_ATTRIBUTE_STANDARD_TYPE,
-                                 G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
-                                 0,
-                                 data->cancellable,
-                                 delete_subdir_check_symlink,
-                                 delete_data_ref (data));
+        gsd_purge_async (kind, (const gchar * const *) dirs, old, dry_run,
+                         purge_cancellable,
+                         ldsm_purge_progress, (gpointer) what,
+                         ldsm_purge_done, (gpointer) what);
+        g_strfreev (dirs);
 }
 
 void
 gsd_ldsm_purge_trash (GDateTime *old)
 {
-        GFile *file;
-        DeleteData *data;
-
-        file = g_file_new_for_uri ("trash:");
-        data = delete_data_new (file, NULL, old, FALSE, TRUE, 0);
-        delete_recursively_by_age (data);
-        delete_data_unref (data);
-        g_object_unref (file);
+        ldsm_purge (GSD_PURGE_TRASH, old, FALSE);
 }
 
 void
 gsd_ldsm_purge_temp_files (GDateTime *old)
 {
-        DeleteData *data;
-        GFile *file;
-
-        file = g_file_new_for_path (g_get_tmp_dir ());
-        data = delete_data_new (file, NULL, old, FALSE, FALSE, 0);
-        delete_recursively_by_age (data);
-        delete_data_unref (data);
-        g_object_unref (file);
-
-        if (g_strcmp0 (g_get_tmp_dir (), "/var/tmp") != 0) {
-                file = g_file_new_for_path ("/var/tmp");
-                data = delete_data_new (file, NULL, old, FALSE, FALSE, 0);
-                delete_recursively_by_age (data);
-                delete_data_unref (data);
-                g_object_unref (file);
-        }
-
-        if (g_strcmp0 (g_get_tmp_dir (), "/tmp") != 0) {
-                file = g_file_new_for_path ("/tmp");
-                data = delete_data_new (file, NULL, old, FALSE, FALSE, 0);
-                delete_recursively_by_age (data);
-                delete_data_unref (data);
-                g_object_unref (file);
-        }
+        ldsm_purge (GSD_PURGE_TEMP_FILES, old, FALSE);
 }
 
 void
 gsd_ldsm_show_empty_trash (void)
 {
-        GFile *file;
         GDateTime *old;
-        DeleteData *data;
 
         old = g_date_time_new_now_local ();
-        file = g_file_new_for_uri ("trash:");
-        data = delete_data_new (file, NULL, old, TRUE, TRUE, 0);
-        g_object_unref (file);
+        ldsm_purge (GSD_PURGE_TRASH, old, TRUE);
         g_date_time_unref (old);
-
-        delete_recursively_by_age (data);
-        delete_data_unref (data);
 }
 
 static gboolean
@@ -656,6 +499,9 @@ ldsm_notify_for_mount (LdsmMountInfo *mount,
 
         ldsm_notify (summary, body, path);
 
+        /* so that asking where the space went is quick */
+        gsd_disk_usage_query_async (ldsm_usage, path, 0, purge_cancellable, NULL, NULL);
+
         g_free (free_space_str);
         g_free (summary);
         g_free (body);
@@ -783,16 +629,310 @@ ldsm_maybe_warn_mounts (GList *mounts,
         }
 }
 
+static gboolean ldsm_check_all_mounts (gpointer data);
+
 static gboolean
-ldsm_check_all_mounts (gpointer data)
+ldsm_scheduled_check_cb (gpointer data)
+{
+        ldsm_timeout_id = 0;
+        ldsm_check_all_mounts (NULL);
+
+        return G_SOURCE_REMOVE;
+}
+
+/* Arms the timer for the first mount due a probe */
+static void
+ldsm_schedule (void)
+{
+        GHashTableIter iter;
+        gpointer value;
+        gint64 now, next;
+        guint delay;
+
+        if (ldsm_timeout_id)
+                g_source_remove (ldsm_timeout_id);
+        ldsm_timeout_id = 0;
+
+        now = g_get_monotonic_time ();
+        /* look for new fstab entries now and then */
+        next = now + (gint64) LDSM_MAX_INTERVAL * G_USEC_PER_SEC;
+        if (g_hash_table_size (ldsm_probe_hash) == 0)
+                next = now + (gint64) CHECK_EVERY_X_SECONDS * G_USEC_PER_SEC;
+
+        g_hash_table_iter_init (&iter, ldsm_probe_hash);
+        while (g_hash_table_iter_next (&iter, NULL, &value)) {
+                LdsmProbeState *state = value;
+
+                /* hung, it will be scheduled once it answers */
+                if (state->in_flight)
+                        continue;
+                next = MIN (next, state->next_probe);
+        }
+
+        delay = (guint) MAX ((next - now + G_USEC_PER_SEC - 1) / G_USEC_PER_SEC, 1);
+        g_debug ("housekeeping: next disk space check in %u seconds", delay);
+
+        ldsm_timeout_id = g_timeout_add_seconds (delay, ldsm_scheduled_check_cb, NULL);
+        g_source_set_name_by_id (ldsm_timeout_id, "[gnome-settings-daemon] ldsm_check_all_mounts");
+}
+
+/* Records a sample, and returns how long to wait before probing again */
+static guint
+ldsm_probe_state_update (LdsmProbeState *state,
+                         const gchar    *path,
+                         struct statvfs *buf,
+                         gint64          now)
+{
+        guint64 free_space, total, threshold;
+        gdouble rate, recent_rate;
+        guint oldest, previous;
+        gdouble interval;
+
+        free_space = (guint64) buf->f_frsize * buf->f_bavail;
+        total = (guint64) buf->f_frsize * buf->f_blocks;
+
+        state->history_time[state->history_pos] = now;
+        state->history_free[state->history_pos] = free_space;
+        previous = (state->history_pos + LDSM_HISTORY_LENGTH - 1) % LDSM_HISTORY_LENGTH;
+        state->history_pos = (state->history_pos + 1) % LDSM_HISTORY_LENGTH;
+        state->history_len = MIN (state->history_len + 1, LDSM_HISTORY_LENGTH);
+
+        if (state->history_len < 2)
+                return CHECK_EVERY_X_SECONDS;
+
+        /* below this, ldsm_mount_has_space() is FALSE */
+        threshold = MIN ((guint64) (free_percent_notify * total),
+                         (guint64) free_size_gb_no_notify * GIGABYTE);
+
+        /* already low, keep an eye on it for the next notification */
+        if (free_space <= threshold)
+                return CHECK_EVERY_X_SECONDS;
+
+        /* bytes per second, over the whole history and over the last
+         * interval, so that a sudden writer gets noticed quickly */
+        oldest = (state->history_pos + LDSM_HISTORY_LENGTH - state->history_len) % LDSM_HISTORY_LENGTH;
+        rate = ((gdouble) state->history_free[oldest] - (gdouble) free_space) /
+                ((gdouble) (now - state->history_time[oldest]) / G_USEC_PER_SEC);
+        recent_rate = ((gdouble) state->history_free[previous] - (gdouble) free_space) /
+                ((gdouble) (now - state->history_time[previous]) / G_USEC_PER_SEC);
+        rate = MAX (rate, recent_rate);
+
+        if (rate <= 0) {
+                /* not filling up, but don't stray too far if it's close */
+                if (free_space < 2 * threshold)
+                        return CHECK_EVERY_X_SECONDS;
+                return LDSM_MAX_INTERVAL;
+        }
+
+        /* half the predicted time to the threshold */
+        interval = ((gdouble) (free_space - threshold) / rate) / 2;
+        interval = CLAMP (interval, LDSM_MIN_INTERVAL, LDSM_MAX_INTERVAL);
+
+        g_debug ("housekeeping: %s loses %.0f bytes/s, checking again in %.0f seconds",
+                 path, rate, interval);
+
+        return (guint) interval;
+}
+
+static void
+ldsm_check_unref (LdsmCheck *check)
+{
+        check->ref_count -= 1;
+        if (check->ref_count > 0)
+                return;
+
+        g_list_free_full (check->mounts, ldsm_free_mount_info);
+        g_free (check);
+}
+
+static void
+ldsm_check_finish (LdsmCheck *check)
 {
-        GList *mounts;
         GList *l;
-        GList *check_mounts = NULL;
         GList *full_mounts = NULL;
         guint number_of_mounts;
         gboolean multiple_volumes = FALSE;
 
+        check->done = TRUE;
+        if (check->timeout_id) {
+                g_source_remove (check->timeout_id);
+                check->timeout_id = 0;
+        }
+
+        number_of_mounts = g_list_length (check->mounts);
+        if (number_of_mounts > 1)
+                multiple_volumes = TRUE;
+
+        for (l = check->mounts; l != NULL; l = l->next) {
+                LdsmMountInfo *mount_info = l->data;
+
+                if (!ldsm_mount_has_space (mount_info)) {
+                        full_mounts = g_list_prepend (full_mounts, mount_info);
+                } else {
+                        g_hash_table_remove (ldsm_notified_hash, g_unix_mount_get_mount_path (mount_info->mount));
+                        ldsm_free_mount_info (mount_info);
+                }
+        }
+        g_clear_pointer (&check->mounts, g_list_free);
+
+        ldsm_maybe_warn_mounts (full_mounts, multiple_volumes);
+        g_list_free (full_mounts);
+
+        if (ldsm_check == check) {
+                ldsm_check = NULL;
+                ldsm_check_unref (check);
+        }
+
+        if (ldsm_check_again) {
+                ldsm_check_again = FALSE;
+                ldsm_check_all_mounts (NULL);
+        } else {
+                ldsm_schedule ();
+        }
+}
+
+static void
+ldsm_probe_mark_stale (const gchar    *path,
+                       LdsmProbeState *state)
+{
+        guint backoff;
+
+        state->stale = TRUE;
+        state->failures++;
+
+        backoff = CHECK_EVERY_X_SECONDS << MIN (state->failures, 6);
+        backoff = MIN (backoff, LDSM_MAX_BACKOFF);
+        state->next_probe = g_get_monotonic_time () + (gint64) backoff * G_USEC_PER_SEC;
+
+        g_warning ("%s did not respond within %d seconds, not checking it again for %u seconds",
+                   path, LDSM_PROBE_TIMEOUT, backoff);
+}
+
+static gboolean
+ldsm_check_timeout_cb (gpointer data)
+{
+        LdsmCheck *check = data;
+        GHashTableIter iter;
+        gpointer key, value;
+
+        check->timeout_id = 0;
+
+        /* whatever this check is still waiting for is stuck */
+        g_hash_table_iter_init (&iter, ldsm_probe_hash);
+        while (g_hash_table_iter_next (&iter, &key, &value)) {
+                LdsmProbeState *state = value;
+
+                if (state->in_flight && state->check == check)
+                        ldsm_probe_mark_stale (key, state);
+        }
+
+        ldsm_check_finish (check);
+
+        return G_SOURCE_REMOVE;
+}
+
+static gboolean
+ldsm_probe_done (gpointer data)
+{
+        LdsmProbe *probe = data;
+        LdsmCheck *check = probe->check;
+        LdsmProbeState *state = NULL;
+
+        if (ldsm_probe_hash != NULL)
+                state = g_hash_table_lookup (ldsm_probe_hash, probe->path);
+        if (state != NULL && state->check == check) {
+                state->in_flight = FALSE;
+                state->check = NULL;
+
+                /* a late answer doesn't undo the backoff, the
+                 * next probe has to make it in time */
+                if (!check->done) {
+                        guint interval = LDSM_MAX_INTERVAL;
+
+                        if (state->stale)
+                                g_debug ("housekeeping: %s is responding again", probe->path);
+                        state->stale = FALSE;
+                        state->failures = 0;
+
+                        if (probe->result != 0)
+                                interval = CHECK_EVERY_X_SECONDS;
+                        else if (!ldsm_mount_is_virtual (probe->mount_info))
+                                interval = ldsm_probe_state_update (state, probe->path,
+                                                                    &probe->mount_info->buf,
+                                                                    g_get_monotonic_time ());
+                        state->next_probe = g_get_monotonic_time () + (gint64) interval * G_USEC_PER_SEC;
+                }
+        }
+
+        if (check->done ||
+            probe->result != 0 ||
+            ldsm_mount_is_virtual (probe->mount_info)) {
+                ldsm_free_mount_info (probe->mount_info);
+        } else {
+                check->mounts = g_list_prepend (check->mounts, probe->mount_info);
+        }
+
+        if (!check->done) {
+                check->pending -= 1;
+                if (check->pending == 0)
+                        ldsm_check_finish (check);
+        }
+
+        ldsm_check_unref (check);
+        g_free (probe->path);
+        g_free (probe);
+
+        return G_SOURCE_REMOVE;
+}
+
+/* Runs in the probe pool, statvfs() can block for as long as the
+ * file system wants to */
+static void
+ldsm_probe_thread (gpointer data,
+                   gpointer user_data)
+{
+        LdsmProbe *probe = data;
+
+        probe->result = statvfs (probe->path, &probe->mount_info->buf);
+        g_idle_add (ldsm_probe_done, probe);
+}
+
+static gboolean
+ldsm_is_probe_state_unused (gpointer key,
+                            gpointer value,
+                            gpointer user_data)
+{
+        LdsmProbeState *state = value;
+
+        return !state->seen && !state->in_flight;
+}
+
+static gboolean
+ldsm_check_all_mounts (gpointer data)
+{
+        GList *mounts;
+        GList *l;
+        LdsmCheck *check;
+        GHashTableIter iter;
+        gpointer value;
+        gint64 now;
+
+        if (ldsm_check != NULL) {
+                /* still waiting on the probes of the last check */
+                ldsm_check_again = TRUE;
+                return TRUE;
+        }
+
+        check = g_new0 (LdsmCheck, 1);
+        check->ref_count = 1;
+        ldsm_check = check;
+
+        now = g_get_monotonic_time ();
+
+        g_hash_table_iter_init (&iter, ldsm_probe_hash);
+        while (g_hash_table_iter_next (&iter, NULL, &value))
+                ((LdsmProbeState *) value)->seen = FALSE;
+
         /* We iterate through the static mounts in /etc/fstab first, seeing if
          * they're mounted by checking if the GUnixMountPoint has a corresponding GUnixMountEntry.
          * Iterating through the static mounts means we automatically ignore dynamically mounted media.
@@ -803,6 +943,8 @@ ldsm_check_all_mounts (gpointer data)
                 GUnixMountPoint *mount_point = l->data;
                 GUnixMountEntry *mount;
                 LdsmMountInfo *mount_info;
+                LdsmProbeState *state;
+                LdsmProbe *probe;
                 const gchar *path;
 
                 path = g_unix_mount_point_get_mount_path (mount_point);
@@ -833,41 +975,44 @@ ldsm_check_all_mounts (gpointer data)
                         continue;
                 }
 
-                if (statvfs (path, &mount_info->buf) != 0) {
-                        ldsm_free_mount_info (mount_info);
-                        continue;
+                state = g_hash_table_lookup (ldsm_probe_hash, path);
+                if (state == NULL) {
+                        state = g_new0 (LdsmProbeState, 1);
+                        g_hash_table_insert (ldsm_probe_hash, g_strdup (path), state);
                 }
+                state->seen = TRUE;
 
-                if (ldsm_mount_is_virtual (mount_info)) {
+                /* Don't pile up threads behind a hung mount */
+                if (state->in_flight || now < state->next_probe) {
                         ldsm_free_mount_info (mount_info);
                         continue;
                 }
 
-                check_mounts = g_list_prepend (check_mounts, mount_info);
+                state->in_flight = TRUE;
+                state->check = check;
+
+                probe = g_new0 (LdsmProbe, 1);
+                probe->check = check;
+                probe->mount_info = mount_info;
+                probe->path = g_strdup (path);
+                check->ref_count += 1;
+                check->pending += 1;
+                g_thread_pool_push (ldsm_probe_pool, probe, NULL);
         }
 
         g_list_free (mounts);
 
-        number_of_mounts = g_list_length (check_mounts);
-        if (number_of_mounts > 1)
-                multiple_volumes = TRUE;
-
-        for (l = check_mounts; l != NULL; l = l->next) {
-                LdsmMountInfo *mount_info = l->data;
+        /* forget about mounts that went away or are ignored now */
+        g_hash_table_foreach_remove (ldsm_probe_hash, ldsm_is_probe_state_unused, NULL);
 
-                if (!ldsm_mount_has_space (mount_info)) {
-                        full_mounts = g_list_prepend (full_mounts, mount_info);
-                } else {
-                        g_hash_table_remove (ldsm_notified_hash, g_unix_mount_get_mount_path (mount_info->mount));
-                        ldsm_free_mount_info (mount_info);
-                }
+        if (check->pending == 0) {
+                ldsm_check_finish (check);
+        } else {
+                check->timeout_id = g_timeout_add_seconds (LDSM_PROBE_TIMEOUT,
+                                                           ldsm_check_timeout_cb, check);
+                g_source_set_name_by_id (check->timeout_id, "[gnome-settings-daemon] ldsm_check_timeout_cb");
         }
 
-        ldsm_maybe_warn_mounts (full_mounts, multiple_volumes);
-
-        g_list_free (check_mounts);
-        g_list_free (full_mounts);
-
         return TRUE;
 }
 
@@ -901,17 +1046,13 @@ ldsm_mounts_changed (GObject  *monitor,
         mounts = g_unix_mounts_get (time_read);
         g_hash_table_foreach_remove (ldsm_notified_hash,
                                      ldsm_is_hash_item_not_in_mounts, mounts);
+        g_hash_table_foreach_remove (ldsm_probe_hash,
+                                     ldsm_is_hash_item_not_in_mounts, mounts);
         g_list_free_full (mounts, (GDestroyNotify) g_unix_mount_free);
 
-        /* check the status now, for the new mounts */
+        /* check the status now, for the new mounts, this
+         * reschedules the timeout */
         ldsm_check_all_mounts (NULL);
-
-        /* and reset the timeout */
-        if (ldsm_timeout_id)
-                g_source_remove (ldsm_timeout_id);
-        ldsm_timeout_id = g_timeout_add_seconds (CHECK_EVERY_X_SECONDS,
-                                                 ldsm_check_all_mounts, NULL);
-        g_source_set_name_by_id (ldsm_timeout_id, "[gnome-settings-daemon] ldsm_check_all_mounts");
 }
 
 static gboolean
@@ -962,7 +1103,21 @@ gsd_ldsm_update_config (GSettings *settings,
                         const gchar *key,
                         gpointer user_data)
 {
+        GHashTableIter iter;
+        gpointer value;
+
         gsd_ldsm_get_config ();
+
+        /* the predictions were made against the old thresholds */
+        g_hash_table_iter_init (&iter, ldsm_probe_hash);
+        while (g_hash_table_iter_next (&iter, NULL, &value)) {
+                LdsmProbeState *state = value;
+
+                if (!state->stale)
+                        state->next_probe = 0;
+        }
+        if (ldsm_check == NULL)
+                ldsm_schedule ();
 }
 
 void
@@ -976,6 +1131,10 @@ gsd_ldsm_setup (gboolean check_now)
         ldsm_notified_hash = g_hash_table_new_full (g_str_hash, g_str_equal,
                                                     g_free,
                                                     ldsm_free_mount_info);
+        ldsm_probe_hash = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                 g_free, g_free);
+        ldsm_probe_pool = g_thread_pool_new (ldsm_probe_thread, NULL, -1, FALSE, NULL);
+        ldsm_usage = gsd_disk_usage_new ();
 
         settings = g_settings_new (SETTINGS_HOUSEKEEPING_DIR);
         privacy_settings = g_settings_new (PRIVACY_SETTINGS);
@@ -989,15 +1148,20 @@ gsd_ldsm_setup (gboolean check_now)
 
         if (check_now)
                 ldsm_check_all_mounts (NULL);
+        else
+                ldsm_schedule ();
 
-        ldsm_timeout_id = g_timeout_add_seconds (CHECK_EVERY_X_SECONDS,
-                                                 ldsm_check_all_mounts, NULL);
-        g_source_set_name_by_id (ldsm_timeout_id, "[gnome-settings-daemon] ldsm_check_all_mounts");
-
+        purge_cancellable = g_cancellable_new ();
         purge_trash_id = g_timeout_add_seconds (3600, ldsm_purge_trash_and_temp, NULL);
         g_source_set_name_by_id (purge_trash_id, "[gnome-settings-daemon] ldsm_purge_trash_and_temp");
 }
 
+GsdDiskUsage *
+gsd_ldsm_get_disk_usage (void)
+{
+        return ldsm_usage;
+}
+
 void
 gsd_ldsm_clean (void)
 {
@@ -1009,11 +1173,33 @@ gsd_ldsm_clean (void)
                 g_source_remove (purge_temp_id);
         purge_temp_id = 0;
 
+        if (purge_cancellable) {
+                g_cancellable_cancel (purge_cancellable);
+                g_clear_object (&purge_cancellable);
+        }
+
         if (ldsm_timeout_id)
                 g_source_remove (ldsm_timeout_id);
         ldsm_timeout_id = 0;
 
+        if (ldsm_check) {
+                /* the probes still out will see it is done */
+                ldsm_check->done = TRUE;
+                if (ldsm_check->timeout_id)
+                        g_source_remove (ldsm_check->timeout_id);
+                ldsm_check->timeout_id = 0;
+                g_clear_pointer (&ldsm_check, ldsm_check_unref);
+        }
+        ldsm_check_again = FALSE;
+
+        /* doesn't wait for the probes, a hung one would never return */
+        if (ldsm_probe_pool)
+                g_thread_pool_free (ldsm_probe_pool, FALSE, FALSE);
+        ldsm_probe_pool = NULL;
+
         g_clear_pointer (&ldsm_notified_hash, g_hash_table_destroy);
+        g_clear_pointer (&ldsm_probe_hash, g_hash_table_destroy);
+        g_clear_object (&ldsm_usage);
         g_clear_object (&ldsm_monitor);
         g_clear_object (&settings);
         g_clear_object (&privacy_settings);
@@ -25,31 +25,15 @@
 
 #include <glib.h>
 
-G_BEGIN_DECLS
+#include "gsd-disk-usage.h"
 
-typedef struct {
-        gint ref_count;
-        GFile           *file;
-        GCancellable    *cancellable;
-        GDateTime       *old;
-        gboolean         dry_run;
-        gboolean         trash;
-        gchar           *name;
-        gint             depth;
-} DeleteData;
-
-void delete_data_unref (DeleteData *data);
-DeleteData *delete_data_new (GFile        *file,
-                             GCancellable *cancellable,
-                             GDateTime    *old,
-                             gboolean      dry_run,
-                             gboolean      trash,
-                             gint          depth);
-void delete_recursively_by_age (DeleteData *data);
+G_BEGIN_DECLS
 
 void gsd_ldsm_setup (gboolean check_now);
 void gsd_ldsm_clean (void);
 
+GsdDiskUsage *gsd_ldsm_get_disk_usage (void);
+
 /* for the test */
 void gsd_ldsm_show_empty_trash (void);
 void gsd_ldsm_purge_trash      (GDateTime *old);
@@ -0,0 +1,66 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ * vim: set et sw=8 ts=8:
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+#include <gio/gio.h>
+#include "gsd-disk-usage.h"
+
+int
+main (int    argc,
+      char **argv)
+{
+        GsdDiskUsage *usage;
+        GVariant *result;
+        GVariantIter iter;
+        const gchar *path;
+        guint64 size;
+        GError *error = NULL;
+        gint i;
+
+        g_setenv ("G_MESSAGES_DEBUG", "all", TRUE);
+
+        if (argc < 2) {
+                g_printerr ("Usage: %s PATH\n", argv[0]);
+                return 1;
+        }
+
+        usage = gsd_disk_usage_new ();
+
+        /* the second time round shows what the cache saves */
+        for (i = 0; i < 2; i++) {
+                result = gsd_disk_usage_query (usage, argv[1], 10, NULL, &error);
+                if (result == NULL) {
+                        g_printerr ("%s\n", error->message);
+                        g_error_free (error);
+                        g_object_unref (usage);
+                        return 1;
+                }
+
+                g_variant_iter_init (&iter, result);
+                while (g_variant_iter_next (&iter, "(&st)", &path, &size)) {
+                        gchar *size_str = g_format_size (size);
+                        g_print ("%10s  %s\n", size_str, path);
+                        g_free (size_str);
+                }
+                g_variant_unref (result);
+        }
+
+        g_object_unref (usage);
+
+        return 0;
+}
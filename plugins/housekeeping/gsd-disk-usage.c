@@ -0,0 +1,676 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ * vim: set et sw=8 ts=8:
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#include "gsd-disk-usage.h"
+
+/*
+ * Keeps the size of every directory below the queried paths, without
+ * crossing into other mounts. Only directories get a node: the files
+ * directly inside a directory are summed into it.
+ *
+ * A refresh walks the tree with fstatat(). A directory whose mtime
+ * didn't change since it was last read has the same entries, so only
+ * its subdirectories are looked at, and those without subdirectories
+ * of their own cost a single fstatat(). Files that grow in place don't
+ * touch the mtime of their directory, so every directory is read again
+ * once an hour.
+ *
+ * To report the largest consumers, the walk starts at the top and goes
+ * down into a directory while most of it is in a single subdirectory,
+ * so the results point at where the space actually went rather than at
+ * its parents.
+ *
+ * Each queried path keeps its own tree and lock, so a long walk of one
+ * doesn't hold up queries for the others. A tree is dropped once it has
+ * gone unused for a while, and only a few are kept at once.
+ */
+
+#define DU_MAX_AGE      (30 * G_USEC_PER_SEC)   /* answer from the cache */
+#define DU_FULL_REFRESH (3600 * G_USEC_PER_SEC) /* read every directory again */
+#define DU_MAX_RESULTS  100
+#define DU_MAX_ROOTS    8
+#define DU_ROOT_EXPIRY  (10 * 60)               /* seconds unused */
+
+typedef struct _DuNode DuNode;
+
+struct _DuNode {
+        DuNode  *parent;
+        DuNode  *children;
+        DuNode  *next;
+        gchar   *name;
+        gint64   mtime;         /* of the directory when it was read, in µs */
+        guint64  own;           /* bytes used by the files directly inside */
+        guint64  total;         /* own, and all the subdirectories */
+};
+
+typedef struct {
+        volatile gint ref_count;
+        GMutex   lock;          /* for the tree, and the times below */
+        gchar   *path;
+        DuNode  *node;
+        dev_t    dev;
+        gint64   refreshed;     /* monotonic time */
+        gint64   full_refreshed;
+        gint64   last_used;     /* protected by the GsdDiskUsage lock */
+} DuRoot;
+
+typedef struct {
+        gboolean      full;
+        dev_t         dev;
+        GCancellable *cancellable;
+
+        guint         n_read;   /* directories */
+        guint         n_stat;
+} DuRefresh;
+
+typedef struct {
+        gchar   *path;
+        guint    max_results;
+} DuQuery;
+
+struct _GsdDiskUsage
+{
+        GObject          parent_instance;
+
+        GMutex           lock;          /* for the table */
+        GHashTable      *roots;         /* path → DuRoot */
+        guint            expire_id;
+};
+
+G_DEFINE_TYPE (GsdDiskUsage, gsd_disk_usage, G_TYPE_OBJECT)
+
+static DuNode *
+du_node_new (DuNode      *parent,
+             const gchar *name)
+{
+        DuNode *node;
+
+        node = g_new0 (DuNode, 1);
+        node->parent = parent;
+        node->name = g_strdup (name);
+        node->mtime = -1;
+
+        return node;
+}
+
+static void
+du_node_free (DuNode *node)
+{
+        DuNode *child, *next;
+
+        for (child = node->children; child != NULL; child = next) {
+                next = child->next;
+                du_node_free (child);
+        }
+        g_free (node->name);
+        g_free (node);
+}
+
+static DuRoot *
+du_root_new (const gchar *path,
+             dev_t        dev)
+{
+        DuRoot *root;
+
+        root = g_new0 (DuRoot, 1);
+        root->ref_count = 1;
+        g_mutex_init (&root->lock);
+        root->path = g_strdup (path);
+        root->node = du_node_new (NULL, path);
+        root->dev = dev;
+
+        return root;
+}
+
+static DuRoot *
+du_root_ref (DuRoot *root)
+{
+        g_atomic_int_inc (&root->ref_count);
+        return root;
+}
+
+static void
+du_root_unref (DuRoot *root)
+{
+        if (!g_atomic_int_dec_and_test (&root->ref_count))
+                return;
+
+        du_node_free (root->node);
+        g_mutex_clear (&root->lock);
+        g_free (root->path);
+        g_free (root);
+}
+
+static gboolean du_node_refresh (DuRefresh  *r,
+                                 DuNode     *node,
+                                 int         parent_fd,
+                                 const char *name);
+
+/* Reads the directory again, returns FALSE if it couldn't */
+static gboolean
+du_node_read (DuRefresh  *r,
+              DuNode     *node,
+              int         parent_fd,
+              const char *name)
+{
+        GHashTable *previous;
+        GHashTableIter iter;
+        gpointer value;
+        DuNode *child;
+        DuNode *children = NULL;
+        struct dirent *ent;
+        struct stat st;
+        DIR *dir;
+        int fd;
+
+        fd = openat (parent_fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (fd < 0)
+                return FALSE;
+        dir = fdopendir (fd);
+        if (dir == NULL) {
+                close (fd);
+                return FALSE;
+        }
+        r->n_read++;
+
+        /* keep the nodes, and so the cached sizes, of the
+         * subdirectories that are still there */
+        previous = g_hash_table_new (g_str_hash, g_str_equal);
+        for (child = node->children; child != NULL; child = child->next)
+                g_hash_table_insert (previous, child->name, child);
+
+        node->own = 0;
+        while ((ent = readdir (dir)) != NULL) {
+                if (strcmp (ent->d_name, ".") == 0 || strcmp (ent->d_name, "..") == 0)
+                        continue;
+                if (g_cancellable_is_cancelled (r->cancellable))
+                        break;
+
+                if (fstatat (dirfd (dir), ent->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0)
+                        continue;
+                r->n_stat++;
+
+                if (!S_ISDIR (st.st_mode)) {
+                        node->own += (guint64) st.st_blocks * 512;
+                        continue;
+                }
+                if (st.st_dev != r->dev)
+                        continue;
+
+                child = g_hash_table_lookup (previous, ent->d_name);
+                if (child != NULL)
+                        g_hash_table_remove (previous, ent->d_name);
+                else
+                        child = du_node_new (node, ent->d_name);
+                child->next = children;
+                children = child;
+
+                du_node_refresh (r, child, dirfd (dir), ent->d_name);
+        }
+        closedir (dir);
+
+        /* the others are gone, unless we stopped half way */
+        g_hash_table_iter_init (&iter, previous);
+        while (g_hash_table_iter_next (&iter, NULL, &value)) {
+                child = value;
+                if (g_cancellable_is_cancelled (r->cancellable)) {
+                        child->next = children;
+                        children = child;
+                } else {
+                        du_node_free (child);
+                }
+        }
+        g_hash_table_destroy (previous);
+        node->children = children;
+
+        return !g_cancellable_is_cancelled (r->cancellable);
+}
+
+static gboolean
+du_node_refresh_stat (DuRefresh         *r,
+                      DuNode            *node,
+                      int                parent_fd,
+                      const char        *name,
+                      const struct stat *st)
+{
+        DuNode *child, **link;
+        gint64 mtime;
+        int fd;
+
+        mtime = (gint64) st->st_mtim.tv_sec * G_USEC_PER_SEC + st->st_mtim.tv_nsec / 1000;
+
+        if (r->full || mtime != node->mtime) {
+                /* read again next time if this didn't work out */
+                node->mtime = du_node_read (r, node, parent_fd, name) ? mtime : -1;
+        } else if (node->children != NULL) {
+                fd = openat (parent_fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+                if (fd >= 0) {
+                        link = &node->children;
+                        while ((child = *link) != NULL) {
+                                if (du_node_refresh (r, child, fd, child->name)) {
+                                        link = &child->next;
+                                } else {
+                                        *link = child->next;
+                                        du_node_free (child);
+                                }
+                        }
+                        close (fd);
+                }
+        }
+
+        node->total = node->own;
+        for (child = node->children; child != NULL; child = child->next)
+                node->total += child->total;
+
+        return TRUE;
+}
+
+/* Returns FALSE if the directory is gone */
+static gboolean
+du_node_refresh (DuRefresh  *r,
+                 DuNode     *node,
+                 int         parent_fd,
+                 const char *name)
+{
+        struct stat st;
+
+        /* keep what we have */
+        if (g_cancellable_is_cancelled (r->cancellable))
+                return TRUE;
+
+        if (fstatat (parent_fd, name, &st, AT_SYMLINK_NOFOLLOW) < 0)
+                return errno != ENOENT;
+        r->n_stat++;
+
+        if (!S_ISDIR (st.st_mode) || st.st_dev != r->dev)
+                return FALSE;
+
+        return du_node_refresh_stat (r, node, parent_fd, name, &st);
+}
+
+static gchar *
+du_node_get_path (DuRoot *root,
+                  DuNode *node)
+{
+        GPtrArray *names;
+        GString *path;
+        gint i;
+
+        names = g_ptr_array_new ();
+        for (; node != root->node; node = node->parent)
+                g_ptr_array_add (names, node->name);
+
+        path = g_string_new (root->path);
+        for (i = names->len - 1; i >= 0; i--) {
+                if (path->len == 0 || path->str[path->len - 1] != G_DIR_SEPARATOR)
+                        g_string_append_c (path, G_DIR_SEPARATOR);
+                g_string_append (path, g_ptr_array_index (names, i));
+        }
+        g_ptr_array_free (names, TRUE);
+
+        return g_string_free (path, FALSE);
+}
+
+static GVariant *
+du_root_get_top (DuRoot *root,
+                 guint   max_results)
+{
+        GVariantBuilder builder;
+        GPtrArray *frontier;
+        guint n_results = 0;
+
+        g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(st)"));
+
+        frontier = g_ptr_array_new ();
+        g_ptr_array_add (frontier, root->node);
+
+        while (frontier->len > 0 && n_results < max_results) {
+                DuNode *node, *child, *largest = NULL;
+                guint i, best = 0;
+                gchar *path;
+
+                for (i = 1; i < frontier->len; i++) {
+                        DuNode *a = g_ptr_array_index (frontier, i);
+                        DuNode *b = g_ptr_array_index (frontier, best);
+
+                        if (a->total > b->total)
+                                best = i;
+                }
+                node = g_ptr_array_remove_index_fast (frontier, best);
+                if (node->total == 0)
+                        break;
+
+                for (child = node->children; child != NULL; child = child->next) {
+                        if (largest == NULL || child->total > largest->total)
+                                largest = child;
+                }
+
+                /* mostly in one subdirectory, look at those instead */
+                if (largest != NULL && largest->total >= node->total / 2) {
+                        for (child = node->children; child != NULL; child = child->next) {
+                                if (child->total > 0)
+                                        g_ptr_array_add (frontier, child);
+                        }
+                        continue;
+                }
+
+                path = du_node_get_path (root, node);
+                g_variant_builder_add (&builder, "(st)", path, node->total);
+                g_free (path);
+                n_results++;
+        }
+        g_ptr_array_free (frontier, TRUE);
+
+        return g_variant_ref_sink (g_variant_builder_end (&builder));
+}
+
+/* Called with the lock held; trees in use by a query are left alone */
+static void
+du_expire_roots (GsdDiskUsage *usage,
+                 gint64        now,
+                 GPtrArray    *expired)
+{
+        GHashTableIter iter;
+        gpointer value;
+        DuRoot *root;
+        DuRoot *oldest;
+
+        g_hash_table_iter_init (&iter, usage->roots);
+        while (g_hash_table_iter_next (&iter, NULL, &value)) {
+                root = value;
+                if (g_atomic_int_get (&root->ref_count) == 1 &&
+                    now - root->last_used > DU_ROOT_EXPIRY * G_USEC_PER_SEC) {
+                        g_hash_table_iter_steal (&iter);
+                        g_ptr_array_add (expired, root);
+                }
+        }
+
+        /* make room for one more, dropping the least recently used */
+        while (g_hash_table_size (usage->roots) >= DU_MAX_ROOTS) {
+                oldest = NULL;
+                g_hash_table_iter_init (&iter, usage->roots);
+                while (g_hash_table_iter_next (&iter, NULL, &value)) {
+                        root = value;
+                        if (g_atomic_int_get (&root->ref_count) == 1 &&
+                            (oldest == NULL || root->last_used < oldest->last_used))
+                                oldest = root;
+                }
+                if (oldest == NULL)
+                        break;
+                g_hash_table_steal (usage->roots, oldest->path);
+                g_ptr_array_add (expired, oldest);
+        }
+}
+
+static gboolean
+du_expire_cb (gpointer user_data)
+{
+        GsdDiskUsage *usage = GSD_DISK_USAGE (user_data);
+        GPtrArray *expired;
+        gboolean keep;
+
+        /* freed outside the lock, big trees take a moment */
+        expired = g_ptr_array_new_with_free_func ((GDestroyNotify) du_root_unref);
+
+        g_mutex_lock (&usage->lock);
+        du_expire_roots (usage, g_get_monotonic_time (), expired);
+        keep = g_hash_table_size (usage->roots) > 0;
+        if (!keep)
+                usage->expire_id = 0;
+        g_mutex_unlock (&usage->lock);
+
+        if (expired->len > 0)
+                g_debug ("housekeeping: dropped %u unused disk usage trees", expired->len);
+        g_ptr_array_unref (expired);
+
+        return keep ? G_SOURCE_CONTINUE : G_SOURCE_REMOVE;
+}
+
+/* Returns the tree for the path, with a reference for the caller */
+static DuRoot *
+du_get_root (GsdDiskUsage *usage,
+             const gchar  *path,
+             dev_t         dev)
+{
+        GPtrArray *expired;
+        DuRoot *root;
+        gint64 now;
+
+        expired = g_ptr_array_new_with_free_func ((GDestroyNotify) du_root_unref);
+        now = g_get_monotonic_time ();
+
+        g_mutex_lock (&usage->lock);
+
+        root = g_hash_table_lookup (usage->roots, path);
+        if (root == NULL || root->dev != dev) {
+                du_expire_roots (usage, now, expired);
+                root = du_root_new (path, dev);
+                g_hash_table_replace (usage->roots, root->path, root);
+        }
+        root->last_used = now;
+        du_root_ref (root);
+
+        if (usage->expire_id == 0) {
+                usage->expire_id = g_timeout_add_seconds (DU_ROOT_EXPIRY, du_expire_cb, usage);
+                g_source_set_name_by_id (usage->expire_id, "[gnome-settings-daemon] du_expire_cb");
+        }
+
+        g_mutex_unlock (&usage->lock);
+
+        g_ptr_array_unref (expired);
+
+        return root;
+}
+
+static void
+du_release_root (GsdDiskUsage *usage,
+                 DuRoot       *root)
+{
+        /* unused from now on, not from when the query started */
+        g_mutex_lock (&usage->lock);
+        root->last_used = g_get_monotonic_time ();
+        g_mutex_unlock (&usage->lock);
+
+        du_root_unref (root);
+}
+
+static GVariant *
+du_query (GsdDiskUsage  *usage,
+          const gchar   *path,
+          guint          max_results,
+          GCancellable  *cancellable,
+          GError       **error)
+{
+        DuRoot *root;
+        GVariant *result;
+        struct stat st;
+        gint64 now;
+        int fd;
+
+        /* the root itself may be a symbolic link, as /home often is; the
+         * walk below it is relative to fd, and never follows links */
+        fd = open (path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0 || fstat (fd, &st) < 0) {
+                int errsv = errno;
+
+                g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+                             "Failed to read %s: %s", path, g_strerror (errsv));
+                if (fd >= 0)
+                        close (fd);
+                return NULL;
+        }
+
+        root = du_get_root (usage, path, st.st_dev);
+
+        /* only queries for the same path wait for the walk */
+        g_mutex_lock (&root->lock);
+
+        now = g_get_monotonic_time ();
+        if (root->refreshed == 0 || now - root->refreshed > DU_MAX_AGE) {
+                DuRefresh r = { 0, };
+
+                r.full = root->full_refreshed == 0 || now - root->full_refreshed > DU_FULL_REFRESH;
+                r.dev = root->dev;
+                r.cancellable = cancellable;
+
+                du_node_refresh_stat (&r, root->node, fd, ".", &st);
+                if (!g_cancellable_is_cancelled (cancellable)) {
+                        root->refreshed = now;
+                        if (r.full)
+                                root->full_refreshed = now;
+                }
+
+                g_debug ("housekeeping: %s refresh of the disk usage of %s: %u directories read, %u stat calls in %.1f ms",
+                         r.full ? "full" : "incremental", path, r.n_read, r.n_stat,
+                         (g_get_monotonic_time () - now) / 1000.0);
+        }
+
+        result = du_root_get_top (root, MIN (max_results, DU_MAX_RESULTS));
+
+        g_mutex_unlock (&root->lock);
+        du_release_root (usage, root);
+        close (fd);
+
+        if (g_cancellable_set_error_if_cancelled (cancellable, error)) {
+                g_variant_unref (result);
+                return NULL;
+        }
+
+        return result;
+}
+
+static void
+du_query_free (DuQuery *query)
+{
+        g_free (query->path);
+        g_free (query);
+}
+
+static void
+query_thread (GTask        *task,
+              gpointer      source_object,
+              gpointer      task_data,
+              GCancellable *cancellable)
+{
+        DuQuery *query = task_data;
+        GVariant *result;
+        GError *error = NULL;
+
+        result = du_query (GSD_DISK_USAGE (source_object), query->path,
+                           query->max_results, cancellable, &error);
+        if (result == NULL)
+                g_task_return_error (task, error);
+        else
+                g_task_return_pointer (task, result, (GDestroyNotify) g_variant_unref);
+}
+
+void
+gsd_disk_usage_query_async (GsdDiskUsage        *usage,
+                            const gchar         *path,
+                            guint                max_results,
+                            GCancellable        *cancellable,
+                            GAsyncReadyCallback  callback,
+                            gpointer             user_data)
+{
+        GTask *task;
+        DuQuery *query;
+
+        g_return_if_fail (GSD_IS_DISK_USAGE (usage));
+        g_return_if_fail (path != NULL);
+
+        query = g_new0 (DuQuery, 1);
+        query->path = g_strdup (path);
+        query->max_results = max_results;
+
+        task = g_task_new (usage, cancellable, callback, user_data);
+        g_task_set_source_tag (task, gsd_disk_usage_query_async);
+        g_task_set_task_data (task, query, (GDestroyNotify) du_query_free);
+        g_task_run_in_thread (task, query_thread);
+        g_object_unref (task);
+}
+
+GVariant *
+gsd_disk_usage_query_finish (GsdDiskUsage  *usage,
+                             GAsyncResult  *result,
+                             GError       **error)
+{
+        g_return_val_if_fail (g_task_is_valid (result, usage), NULL);
+
+        return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+GVariant *
+gsd_disk_usage_query (GsdDiskUsage  *usage,
+                      const gchar   *path,
+                      guint          max_results,
+                      GCancellable  *cancellable,
+                      GError       **error)
+{
+        g_return_val_if_fail (GSD_IS_DISK_USAGE (usage), NULL);
+        g_return_val_if_fail (path != NULL, NULL);
+
+        return du_query (usage, path, max_results, cancellable, error);
+}
+
+static void
+gsd_disk_usage_finalize (GObject *object)
+{
+        GsdDiskUsage *usage = GSD_DISK_USAGE (object);
+
+        if (usage->expire_id != 0)
+                g_source_remove (usage->expire_id);
+        g_hash_table_destroy (usage->roots);
+        g_mutex_clear (&usage->lock);
+
+        G_OBJECT_CLASS (gsd_disk_usage_parent_class)->finalize (object);
+}
+
+static void
+gsd_disk_usage_class_init (GsdDiskUsageClass *klass)
+{
+        GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+        object_class->finalize = gsd_disk_usage_finalize;
+}
+
+static void
+gsd_disk_usage_init (GsdDiskUsage *usage)
+{
+        g_mutex_init (&usage->lock);
+        usage->roots = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                              NULL, (GDestroyNotify) du_root_unref);
+}
+
+GsdDiskUsage *
+gsd_disk_usage_new (void)
+{
+        return g_object_new (GSD_TYPE_DISK_USAGE, NULL);
+}
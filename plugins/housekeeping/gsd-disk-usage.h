@@ -0,0 +1,51 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ * vim: set et sw=8 ts=8:
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __GSD_DISK_USAGE_H
+#define __GSD_DISK_USAGE_H
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+#define GSD_TYPE_DISK_USAGE (gsd_disk_usage_get_type ())
+G_DECLARE_FINAL_TYPE (GsdDiskUsage, gsd_disk_usage, GSD, DISK_USAGE, GObject)
+
+GsdDiskUsage *gsd_disk_usage_new          (void);
+
+/* Returns the directories using the most space under path, as an
+ * "a(st)" of paths and sizes in bytes, largest first. With max_results
+ * of 0, only brings the cached sizes up to date. */
+void          gsd_disk_usage_query_async  (GsdDiskUsage         *usage,
+                                           const gchar          *path,
+                                           guint                 max_results,
+                                           GCancellable         *cancellable,
+                                           GAsyncReadyCallback   callback,
+                                           gpointer              user_data);
+GVariant     *gsd_disk_usage_query_finish (GsdDiskUsage         *usage,
+                                           GAsyncResult         *result,
+                                           GError              **error);
+GVariant     *gsd_disk_usage_query        (GsdDiskUsage         *usage,
+                                           const gchar          *path,
+                                           guint                 max_results,
+                                           GCancellable         *cancellable,
+                                           GError              **error);
+
+G_END_DECLS
+
+#endif /* __GSD_DISK_USAGE_H */
@@ -0,0 +1,530 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ * vim: set et sw=8 ts=8:
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Times the purges against synthetic trees, in a temporary directory:
+ *
+ *   gsd-housekeeping-benchmark [N_FILES]
+ *
+ * Each purge runs in its own process, so that its peak RSS can be
+ * reported, and a second time under strace -c, if installed, to count
+ * its system calls. The syscalls of a process that does nothing are
+ * subtracted. The thumbnail cache has no dry run mode.
+ *
+ * Files owned by another user, which the temporary files purge has to
+ * leave alone, can only be created when running as root.
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+
+#include "gsd-purge.h"
+#include "gsd-thumbnail-cache.h"
+
+#define DEFAULT_N_FILES         20000
+#define N_SMALL_DIRS            100
+#define DEEP_DEPTH              100
+#define FOREIGN_UID             65534
+#define THUMB_MAX_AGE           (7 * 24 * 60 * 60)
+
+typedef enum {
+        PHASE_NONE,
+        PHASE_TEMP,
+        PHASE_TRASH,
+        PHASE_THUMBNAILS
+} Phase;
+
+static const char *phase_names[] = { "none", "temp", "trash", "thumbnails" };
+
+static gboolean can_chown;
+
+static int
+make_dir_at (int         parent_fd,
+             const char *name)
+{
+        int fd;
+
+        if (mkdirat (parent_fd, name, 0700) < 0 && errno != EEXIST)
+                g_error ("Failed to create %s: %s", name, g_strerror (errno));
+        fd = openat (parent_fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0)
+                g_error ("Failed to open %s: %s", name, g_strerror (errno));
+
+        return fd;
+}
+
+static void
+make_file_at (int         dir_fd,
+              const char *name,
+              gsize       size,
+              gboolean    foreign)
+{
+        static const gchar data[4096];
+        int fd;
+
+        fd = openat (dir_fd, name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (fd < 0)
+                g_error ("Failed to create %s: %s", name, g_strerror (errno));
+        if (size > 0 && write (fd, data, MIN (size, sizeof (data))) < 0)
+                g_error ("Failed to write %s: %s", name, g_strerror (errno));
+        if (foreign && can_chown && fchown (fd, FOREIGN_UID, FOREIGN_UID) < 0)
+                g_warning ("Failed to chown %s: %s", name, g_strerror (errno));
+        close (fd);
+}
+
+/* Fills dir_fd with roughly n_files entries, in a wide directory, a
+ * deep one, many small ones, symbolic links and files owned by someone
+ * else. Returns the number of entries created. */
+static guint
+make_tree (int   dir_fd,
+           guint n_files)
+{
+        char name[64];
+        guint n_wide, n_small, n_deep, n_links, n_foreign;
+        guint entries = 0;
+        guint i, j;
+        int fd, sub_fd;
+
+        n_wide = n_files * 4 / 10;
+        n_small = n_files * 3 / 10;
+        n_deep = n_files / 10;
+        n_links = n_files / 10;
+        n_foreign = n_files / 10;
+
+        fd = make_dir_at (dir_fd, "wide");
+        for (i = 0; i < n_wide; i++) {
+                g_snprintf (name, sizeof (name), "file-%u", i);
+                make_file_at (fd, name, 1, FALSE);
+        }
+        close (fd);
+        entries += 1 + n_wide;
+
+        for (i = 0; i < N_SMALL_DIRS; i++) {
+                g_snprintf (name, sizeof (name), "small-%03u", i);
+                fd = make_dir_at (dir_fd, name);
+                for (j = 0; j < n_small / N_SMALL_DIRS; j++) {
+                        g_snprintf (name, sizeof (name), "file-%u", j);
+                        make_file_at (fd, name, 3000, FALSE);
+                }
+                close (fd);
+                entries += 1 + n_small / N_SMALL_DIRS;
+        }
+
+        fd = dup (dir_fd);
+        for (i = 0; i < DEEP_DEPTH; i++) {
+                sub_fd = make_dir_at (fd, "deep");
+                close (fd);
+                fd = sub_fd;
+                for (j = 0; j < n_deep / DEEP_DEPTH; j++) {
+                        g_snprintf (name, sizeof (name), "file-%u", j);
+                        make_file_at (fd, name, 100, FALSE);
+                }
+                entries += 1 + n_deep / DEEP_DEPTH;
+        }
+        close (fd);
+
+        fd = make_dir_at (dir_fd, "links");
+        for (i = 0; i < n_links; i++) {
+                g_snprintf (name, sizeof (name), "link-%u", i);
+                if (symlinkat (i % 2 ? "../wide/file-0" : "/nonexistent", fd, name) < 0)
+                        g_error ("Failed to create %s: %s", name, g_strerror (errno));
+        }
+        close (fd);
+        entries += 1 + n_links;
+
+        fd = make_dir_at (dir_fd, "foreign");
+        for (i = 0; i < n_foreign; i++) {
+                g_snprintf (name, sizeof (name), "file-%u", i);
+                make_file_at (fd, name, 1, TRUE);
+        }
+        close (fd);
+        entries += 1 + n_foreign;
+
+        return entries;
+}
+
+static void
+make_trash_info (int dir_fd)
+{
+        struct dirent *ent;
+        DIR *dir;
+        int info_fd, fd;
+
+        info_fd = make_dir_at (dir_fd, "info");
+        fd = openat (dir_fd, "files", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        dir = fdopendir (fd);
+        while ((ent = readdir (dir)) != NULL) {
+                gchar *name, *contents;
+                int info;
+
+                if (ent->d_name[0] == '.')
+                        continue;
+
+                name = g_strconcat (ent->d_name, ".trashinfo", NULL);
+                contents = g_strdup_printf ("[Trash Info]\nPath=/tmp/%s\nDeletionDate=2000-01-01T00:00:00\n",
+                                            ent->d_name);
+                info = openat (info_fd, name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+                if (info < 0 || write (info, contents, strlen (contents)) < 0)
+                        g_error ("Failed to write %s: %s", name, g_strerror (errno));
+                close (info);
+                g_free (contents);
+                g_free (name);
+        }
+        closedir (dir);
+        close (info_fd);
+}
+
+static guint
+make_thumbnails (int   dir_fd,
+                 guint n_files)
+{
+        struct timespec times[2];
+        char name[64];
+        guint i;
+        int fd, sub_fd;
+
+        /* old enough to be purged */
+        times[0].tv_sec = times[1].tv_sec = time (NULL) - 2 * THUMB_MAX_AGE;
+        times[0].tv_nsec = times[1].tv_nsec = 0;
+
+        fd = make_dir_at (dir_fd, "cache");
+        sub_fd = make_dir_at (fd, "thumbnails");
+        close (fd);
+        fd = make_dir_at (sub_fd, "normal");
+        close (sub_fd);
+
+        for (i = 0; i < n_files; i++) {
+                g_snprintf (name, sizeof (name), "%032x.png", i);
+                make_file_at (fd, name, 2000, FALSE);
+                utimensat (fd, name, times, 0);
+        }
+        close (fd);
+
+        return n_files;
+}
+
+static guint
+prepare (Phase        phase,
+         const gchar *workdir,
+         guint        n_files)
+{
+        guint entries = 0;
+        int dir_fd, fd, files_fd;
+
+        dir_fd = open (workdir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dir_fd < 0)
+                g_error ("Failed to open %s: %s", workdir, g_strerror (errno));
+
+        switch (phase) {
+        case PHASE_TEMP:
+                fd = make_dir_at (dir_fd, "tmp");
+                entries = make_tree (fd, n_files);
+                close (fd);
+                break;
+        case PHASE_TRASH:
+                fd = make_dir_at (dir_fd, "Trash");
+                files_fd = make_dir_at (fd, "files");
+                entries = make_tree (files_fd, n_files);
+                close (files_fd);
+                make_trash_info (fd);
+                close (fd);
+                break;
+        case PHASE_THUMBNAILS:
+                entries = make_thumbnails (dir_fd, n_files);
+                break;
+        case PHASE_NONE:
+                break;
+        }
+        close (dir_fd);
+
+        return entries;
+}
+
+static void
+cleanup (const gchar *workdir)
+{
+        gchar *argv[] = { "rm", "-rf", NULL, NULL };
+        gchar *path;
+        const gchar *name;
+        GDir *dir;
+
+        dir = g_dir_open (workdir, 0, NULL);
+        while (dir != NULL && (name = g_dir_read_name (dir)) != NULL) {
+                path = g_build_filename (workdir, name, NULL);
+                argv[2] = path;
+                g_spawn_sync (NULL, argv, NULL, G_SPAWN_SEARCH_PATH, NULL, NULL, NULL, NULL, NULL, NULL);
+                g_free (path);
+        }
+        if (dir != NULL)
+                g_dir_close (dir);
+}
+
+/* In the child */
+static int
+run_phase (Phase        phase,
+           const gchar *workdir,
+           gboolean     dry_run)
+{
+        GsdThumbnailCache *cache;
+        GDateTime *now, *old;
+        struct rusage usage;
+        gchar *dirs[2] = { NULL, NULL };
+        GError *error = NULL;
+        gboolean ret = TRUE;
+        gint64 start;
+
+        /* before anything looks at it */
+        if (phase == PHASE_THUMBNAILS) {
+                gchar *cache_dir = g_build_filename (workdir, "cache", NULL);
+                g_setenv ("XDG_CACHE_HOME", cache_dir, TRUE);
+                g_free (cache_dir);
+        }
+
+        now = g_date_time_new_now_local ();
+        start = g_get_monotonic_time ();
+
+        switch (phase) {
+        case PHASE_TEMP:
+                /* everything is old */
+                old = g_date_time_add_hours (now, 1);
+                dirs[0] = g_build_filename (workdir, "tmp", NULL);
+                ret = gsd_purge (GSD_PURGE_TEMP_FILES, (const gchar * const *) dirs, old,
+                                 dry_run, NULL, NULL, &error);
+                g_date_time_unref (old);
+                break;
+        case PHASE_TRASH:
+                dirs[0] = g_build_filename (workdir, "Trash", NULL);
+                ret = gsd_purge (GSD_PURGE_TRASH, (const gchar * const *) dirs, now,
+                                 dry_run, NULL, NULL, &error);
+                break;
+        case PHASE_THUMBNAILS:
+                cache = gsd_thumbnail_cache_new ();
+                ret = gsd_thumbnail_cache_purge (cache, THUMB_MAX_AGE, -1, NULL, &error);
+                g_object_unref (cache);
+                break;
+        case PHASE_NONE:
+                break;
+        }
+
+        if (!ret) {
+                g_printerr ("Purge failed: %s\n", error->message);
+                g_error_free (error);
+        }
+
+        getrusage (RUSAGE_SELF, &usage);
+        g_print ("%" G_GINT64_FORMAT " %ld\n", g_get_monotonic_time () - start, usage.ru_maxrss);
+
+        g_free (dirs[0]);
+        g_date_time_unref (now);
+
+        return ret ? 0 : 1;
+}
+
+/* The calls column of the last line of strace -c:
+ * "100.00    0.001234           1      1234        12 total" */
+static gboolean
+parse_strace_total (const gchar *summary,
+                    guint64     *syscalls)
+{
+        gchar **lines, **fields;
+        gboolean ret = FALSE;
+        guint i, j, n;
+
+        lines = g_strsplit (summary, "\n", -1);
+        for (i = 0; lines[i] != NULL; i++) {
+                if (!g_str_has_suffix (g_strstrip (lines[i]), "total"))
+                        continue;
+
+                fields = g_strsplit_set (lines[i], " \t", -1);
+                for (j = 0, n = 0; fields[j] != NULL; j++) {
+                        if (*fields[j] == '\0')
+                                continue;
+                        if (n++ == 3) {
+                                *syscalls = g_ascii_strtoull (fields[j], NULL, 10);
+                                ret = TRUE;
+                        }
+                }
+                g_strfreev (fields);
+        }
+        g_strfreev (lines);
+
+        return ret;
+}
+
+static gboolean
+spawn_phase (const gchar *self,
+             const gchar *strace,
+             Phase        phase,
+             const gchar *workdir,
+             gboolean     dry_run,
+             gint64      *elapsed,
+             glong       *max_rss,
+             guint64     *syscalls)
+{
+        GPtrArray *argv;
+        gchar *output = NULL;
+        gchar *strace_output = NULL;
+        gchar *summary = NULL;
+        gint status;
+        gboolean ret = FALSE;
+
+        argv = g_ptr_array_new ();
+        if (strace != NULL) {
+                strace_output = g_build_filename (workdir, "strace.out", NULL);
+                g_ptr_array_add (argv, (gpointer) strace);
+                g_ptr_array_add (argv, "-f");
+                g_ptr_array_add (argv, "-c");
+                g_ptr_array_add (argv, "-o");
+                g_ptr_array_add (argv, strace_output);
+        }
+        g_ptr_array_add (argv, (gpointer) self);
+        g_ptr_array_add (argv, "--run");
+        g_ptr_array_add (argv, (gpointer) phase_names[phase]);
+        g_ptr_array_add (argv, dry_run ? "--dry-run" : "--delete");
+        g_ptr_array_add (argv, (gpointer) workdir);
+        g_ptr_array_add (argv, NULL);
+
+        if (!g_spawn_sync (NULL, (gchar **) argv->pdata, NULL, 0, NULL, NULL,
+                           &output, NULL, &status, NULL) ||
+            !g_spawn_check_exit_status (status, NULL))
+                goto out;
+
+        if (strace == NULL) {
+                ret = sscanf (output, "%" G_GINT64_FORMAT " %ld", elapsed, max_rss) == 2;
+        } else if (g_file_get_contents (strace_output, &summary, NULL, NULL)) {
+                ret = parse_strace_total (summary, syscalls);
+                g_unlink (strace_output);
+        }
+
+out:
+        g_free (summary);
+        g_free (strace_output);
+        g_free (output);
+        g_ptr_array_free (argv, TRUE);
+
+        return ret;
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+        gchar *workdir, *self, *strace;
+        guint64 baseline = 0;
+        guint n_files = DEFAULT_N_FILES;
+        gint64 elapsed;
+        glong max_rss;
+        gint mode;
+
+        if (argc == 5 && g_strcmp0 (argv[1], "--run") == 0) {
+                Phase phase;
+
+                for (phase = PHASE_NONE; phase <= PHASE_THUMBNAILS; phase++) {
+                        if (g_strcmp0 (argv[2], phase_names[phase]) == 0)
+                                return run_phase (phase, argv[4], g_strcmp0 (argv[3], "--dry-run") == 0);
+                }
+                return 1;
+        }
+
+        if (argc > 1)
+                n_files = MAX (atoi (argv[1]), N_SMALL_DIRS * DEEP_DEPTH / 10);
+
+        can_chown = geteuid () == 0;
+        self = g_file_read_link ("/proc/self/exe", NULL);
+        if (self == NULL)
+                self = g_strdup (argv[0]);
+        strace = g_find_program_in_path ("strace");
+
+        workdir = g_dir_make_tmp ("gsd-housekeeping-benchmark-XXXXXX", NULL);
+        if (workdir == NULL)
+                g_error ("Failed to create a temporary directory");
+
+        g_print ("%u files in %s\n", n_files, workdir);
+        if (!can_chown)
+                g_print ("not running as root, the foreign files are owned by the user\n");
+        if (strace == NULL)
+                g_print ("strace not found, not counting syscalls\n");
+        else
+                spawn_phase (self, strace, PHASE_NONE, workdir, TRUE, NULL, NULL, &baseline);
+
+        if (spawn_phase (self, NULL, PHASE_NONE, workdir, TRUE, &elapsed, &max_rss, NULL))
+                g_print ("%-10s %-7s %44s %8ld KiB peak RSS\n", "baseline", "", "", max_rss);
+
+        for (mode = 0; mode < 2; mode++) {
+                gboolean dry_run = mode == 0;
+                Phase phase;
+
+                for (phase = PHASE_TEMP; phase <= PHASE_THUMBNAILS; phase++) {
+                        guint64 syscalls = 0;
+                        gchar *syscalls_str;
+                        guint entries;
+
+                        if (phase == PHASE_THUMBNAILS && dry_run)
+                                continue;
+
+                        entries = prepare (phase, workdir, n_files);
+                        if (!spawn_phase (self, NULL, phase, workdir, dry_run, &elapsed, &max_rss, NULL)) {
+                                g_printerr ("%s failed\n", phase_names[phase]);
+                                cleanup (workdir);
+                                continue;
+                        }
+
+                        if (strace != NULL) {
+                                if (!dry_run) {
+                                        cleanup (workdir);
+                                        prepare (phase, workdir, n_files);
+                                }
+                                spawn_phase (self, strace, phase, workdir, dry_run, NULL, NULL, &syscalls);
+                                syscalls_str = g_strdup_printf ("%" G_GUINT64_FORMAT,
+                                                                syscalls > baseline ? syscalls - baseline : 0);
+                        } else {
+                                syscalls_str = g_strdup ("-");
+                        }
+
+                        g_print ("%-10s %-7s %7u entries %10.0f files/s %10s syscalls %8ld KiB peak RSS\n",
+                                 phase_names[phase], dry_run ? "dry-run" : "delete", entries,
+                                 entries / MAX (elapsed / (gdouble) G_USEC_PER_SEC, 1e-6),
+                                 syscalls_str, max_rss);
+
+                        g_free (syscalls_str);
+                        cleanup (workdir);
+                }
+        }
+
+        g_rmdir (workdir);
+        g_free (workdir);
+        g_free (strace);
+        g_free (self);
+
+        return 0;
+}
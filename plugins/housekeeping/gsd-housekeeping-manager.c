@@ -26,6 +26,7 @@
 #include "gnome-settings-profile.h"
 #include "gsd-housekeeping-manager.h"
 #include "gsd-disk-space.h"
+#include "gsd-thumbnail-cache.h"
 
 
 /* General */
@@ -45,6 +46,11 @@ static const gchar introspection_xml[] =
 "  <interface name='org.gnome.SettingsDaemon.Housekeeping'>"
 "    <method name='EmptyTrash'/>"
 "    <method name='RemoveTempFiles'/>"
+"    <method name='GetDiskUsage'>"
+"      <arg name='path' direction='in' type='s'/>"
+"      <arg name='max_results' direction='in' type='u'/>"
+"      <arg name='usage' direction='out' type='a(st)'/>"
+"    </method>"
 "  </interface>"
 "</node>";
 
@@ -56,6 +62,9 @@ struct GsdHousekeepingManagerPrivate {
         GDBusNodeInfo   *introspection_data;
         GDBusConnection *connection;
         GCancellable    *bus_cancellable;
+
+        GsdThumbnailCache *thumb_cache;
+        GCancellable    *thumb_cancellable;
 };
 
 #define GSD_HOUSEKEEPING_MANAGER_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), GSD_TYPE_HOUSEKEEPING_MANAGER, GsdHousekeepingManagerPrivate))
@@ -68,196 +77,61 @@ G_DEFINE_TYPE (GsdHousekeepingManager, gsd_housekeeping_manager, G_TYPE_OBJECT)
 static gpointer manager_object = NULL;
 
 
-typedef struct {
-        glong now;
-        glong max_age;
-        goffset total_size;
-        goffset max_size;
-} PurgeData;
-
-
-typedef struct {
-        time_t  mtime;
-        char   *path;
-        glong   size;
-} ThumbData;
-
-
 static void
-thumb_data_free (gpointer data)
+purge_thumbnail_cache_cb (GObject      *source_object,
+                          GAsyncResult *res,
+                          gpointer      user_data)
 {
-        ThumbData *info = data;
-
-        if (info) {
-                g_free (info->path);
-                g_free (info);
-        }
-}
+        GsdHousekeepingManager *manager;
+        GError *error = NULL;
 
-static GList *
-read_dir_for_purge (const char *path, GList *files)
-{
-        GFile           *read_path;
-        GFileEnumerator *enum_dir;
-
-        read_path = g_file_new_for_path (path);
-        enum_dir = g_file_enumerate_children (read_path,
-                                              G_FILE_ATTRIBUTE_STANDARD_NAME ","
-                                              G_FILE_ATTRIBUTE_TIME_MODIFIED ","
-                                              G_FILE_ATTRIBUTE_STANDARD_SIZE,
-                                              G_FILE_QUERY_INFO_NONE,
-                                              NULL,
-                                              NULL);
-
-        if (enum_dir != NULL) {
-                GFileInfo *info;
-                while ((info = g_file_enumerator_next_file (enum_dir, NULL, NULL)) != NULL) {
-                        const char *name;
-                        name = g_file_info_get_name (info);
-
-                        if (strlen (name) == 36 && strcmp (name + 32, ".png") == 0) {
-                                ThumbData *td;
-                                GFile     *entry;
-                                char      *entry_path;
-                                GTimeVal   mod_time;
-
-                                entry = g_file_get_child (read_path, name);
-                                entry_path = g_file_get_path (entry);
-                                g_object_unref (entry);
-
-                                g_file_info_get_modification_time (info, &mod_time);
-
-                                td = g_new0 (ThumbData, 1);
-                                td->path = entry_path;
-                                td->mtime = mod_time.tv_sec;
-                                td->size = g_file_info_get_size (info);
-
-                                files = g_list_prepend (files, td);
-                        }
-                        g_object_unref (info);
+        if (!gsd_thumbnail_cache_purge_finish (GSD_THUMBNAIL_CACHE (source_object), res, &error)) {
+                /* the manager may be gone */
+                if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+                        g_error_free (error);
+                        return;
                 }
-                g_object_unref (enum_dir);
+                g_warning ("Failed to purge the thumbnail cache: %s", error->message);
+                g_error_free (error);
         }
-        g_object_unref (read_path);
 
-        return files;
+        manager = GSD_HOUSEKEEPING_MANAGER (user_data);
+        g_clear_object (&manager->priv->thumb_cancellable);
 }
 
 static void
-purge_old_thumbnails (ThumbData *info, PurgeData *purge_data)
+get_thumbnail_limits (GsdHousekeepingManager *manager,
+                      glong                  *max_age,
+                      goffset                *max_size)
 {
-        if ((purge_data->now - info->mtime) > purge_data->max_age) {
-                g_unlink (info->path);
-                info->size = 0;
-        } else {
-                purge_data->total_size += info->size;
-        }
-}
-
-static int
-sort_file_mtime (ThumbData *file1, ThumbData *file2)
-{
-        return file1->mtime - file2->mtime;
-}
-
-static char **
-get_thumbnail_dirs (void)
-{
-        GPtrArray *array;
-        char *path;
-
-        array = g_ptr_array_new ();
-
-        /* check new XDG cache */
-        path = g_build_filename (g_get_user_cache_dir (),
-                                 "thumbnails",
-                                 "normal",
-                                 NULL);
-        g_ptr_array_add (array, path);
-
-        path = g_build_filename (g_get_user_cache_dir (),
-                                 "thumbnails",
-                                 "large",
-                                 NULL);
-        g_ptr_array_add (array, path);
-
-        path = g_build_filename (g_get_user_cache_dir (),
-                                 "thumbnails",
-                                 "fail",
-                                 "gnome-thumbnail-factory",
-                                 NULL);
-        g_ptr_array_add (array, path);
-
-        /* cleanup obsolete locations too */
-        path = g_build_filename (g_get_home_dir (),
-                                 ".thumbnails",
-                                 "normal",
-                                 NULL);
-        g_ptr_array_add (array, path);
-
-        path = g_build_filename (g_get_home_dir (),
-                                 ".thumbnails",
-                                 "large",
-                                 NULL);
-        g_ptr_array_add (array, path);
-
-        path = g_build_filename (g_get_home_dir (),
-                                 ".thumbnails",
-                                 "fail",
-                                 "gnome-thumbnail-factory",
-                                 NULL);
-        g_ptr_array_add (array, path);
-
-        g_ptr_array_add (array, NULL);
-
-        return (char **) g_ptr_array_free (array, FALSE);
+        *max_age = g_settings_get_int (manager->priv->settings, THUMB_AGE_KEY) * 24 * 60 * 60;
+        *max_size = g_settings_get_int (manager->priv->settings, THUMB_SIZE_KEY) * 1024 * 1024;
 }
 
 static void
 purge_thumbnail_cache (GsdHousekeepingManager *manager)
 {
+        glong   max_age;
+        goffset max_size;
 
-        char     **paths;
-        GList     *files;
-        PurgeData  purge_data;
-        GTimeVal   current_time;
-        guint      i;
+        /* still busy with the previous run */
+        if (manager->priv->thumb_cancellable != NULL)
+                return;
 
         g_debug ("housekeeping: checking thumbnail cache size and freshness");
 
-        purge_data.max_age = g_settings_get_int (manager->priv->settings, THUMB_AGE_KEY) * 24 * 60 * 60;
-        purge_data.max_size = g_settings_get_int (manager->priv->settings, THUMB_SIZE_KEY) * 1024 * 1024;
+        get_thumbnail_limits (manager, &max_age, &max_size);
 
         /* if both are set to -1, we don't need to read anything */
-        if ((purge_data.max_age < 0) && (purge_data.max_size < 0))
+        if ((max_age < 0) && (max_size < 0))
                 return;
 
-        paths = get_thumbnail_dirs ();
-        files = NULL;
-        for (i = 0; paths[i] != NULL; i++)
-                files = read_dir_for_purge (paths[i], files);
-        g_strfreev (paths);
-
-        g_get_current_time (&current_time);
-
-        purge_data.now = current_time.tv_sec;
-        purge_data.total_size = 0;
-
-        if (purge_data.max_age >= 0)
-                g_list_foreach (files, (GFunc) purge_old_thumbnails, &purge_data);
-
-        if ((purge_data.total_size > purge_data.max_size) && (purge_data.max_size >= 0)) {
-                GList *scan;
-                files = g_list_sort (files, (GCompareFunc) sort_file_mtime);
-                for (scan = files; scan && (purge_data.total_size > purge_data.max_size); scan = scan->next) {
-                        ThumbData *info = scan->data;
-                        g_unlink (info->path);
-                        purge_data.total_size -= info->size;
-                }
-        }
-
-        g_list_foreach (files, (GFunc) thumb_data_free, NULL);
-        g_list_free (files);
+        manager->priv->thumb_cancellable = g_cancellable_new ();
+        gsd_thumbnail_cache_purge_async (manager->priv->thumb_cache,
+                                         max_age, max_size,
+                                         manager->priv->thumb_cancellable,
+                                         purge_thumbnail_cache_cb,
+                                         manager);
 }
 
 static gboolean
@@ -295,6 +169,25 @@ settings_changed_callback (GSettings              *settings,
         do_cleanup_soon (manager);
 }
 
+static void
+get_disk_usage_cb (GObject      *source_object,
+                   GAsyncResult *res,
+                   gpointer      user_data)
+{
+        GDBusMethodInvocation *invocation = user_data;
+        GVariant *usage;
+        GError *error = NULL;
+
+        usage = gsd_disk_usage_query_finish (GSD_DISK_USAGE (source_object), res, &error);
+        if (usage == NULL) {
+                g_dbus_method_invocation_take_error (invocation, error);
+                return;
+        }
+
+        g_dbus_method_invocation_return_value (invocation, g_variant_new ("(@a(st))", usage));
+        g_variant_unref (usage);
+}
+
 static void
 handle_method_call (GDBusConnection       *connection,
                     const gchar           *sender,
@@ -315,6 +208,19 @@ handle_method_call (GDBusConnection       *connection,
                 gsd_ldsm_purge_temp_files (now);
                 g_dbus_method_invocation_return_value (invocation, NULL);
         }
+        else if (g_strcmp0 (method_name, "GetDiskUsage") == 0) {
+                const gchar *path;
+                guint max_results;
+
+                g_variant_get (parameters, "(&su)", &path, &max_results);
+                if (!g_path_is_absolute (path)) {
+                        g_dbus_method_invocation_return_error (invocation, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                                                               "%s is not an absolute path", path);
+                } else {
+                        gsd_disk_usage_query_async (gsd_ldsm_get_disk_usage (), path, max_results,
+                                                    NULL, get_disk_usage_cb, invocation);
+                }
+        }
         g_date_time_unref (now);
 }
 
@@ -390,6 +296,7 @@ gsd_housekeeping_manager_start (GsdHousekeepingManager *manager,
         gsd_ldsm_setup (FALSE);
 
         manager->priv->settings = g_settings_new (THUMB_PREFIX);
+        manager->priv->thumb_cache = gsd_thumbnail_cache_new ();
         g_signal_connect (G_OBJECT (manager->priv->settings), "changed",
                           G_CALLBACK (settings_changed_callback), manager);
 
@@ -423,6 +330,11 @@ gsd_housekeeping_manager_stop (GsdHousekeepingManager *manager)
                 p->short_term_cb = 0;
         }
 
+        if (p->thumb_cancellable) {
+                g_cancellable_cancel (p->thumb_cancellable);
+                g_clear_object (&p->thumb_cancellable);
+        }
+
         if (p->long_term_cb) {
                 g_source_remove (p->long_term_cb);
                 p->long_term_cb = 0;
@@ -431,11 +343,20 @@ gsd_housekeeping_manager_stop (GsdHousekeepingManager *manager)
                    limits have been set to paranoid levels (zero) */
                 if ((g_settings_get_int (p->settings, THUMB_AGE_KEY) == 0) ||
                     (g_settings_get_int (p->settings, THUMB_SIZE_KEY) == 0)) {
-                        do_cleanup (manager);
+                        glong max_age;
+                        goffset max_size;
+
+                        get_thumbnail_limits (manager, &max_age, &max_size);
+                        gsd_thumbnail_cache_purge (p->thumb_cache, max_age, max_size, NULL, NULL);
                 }
 
         }
 
+        if (p->thumb_cache) {
+                gsd_thumbnail_cache_save (p->thumb_cache);
+                g_clear_object (&p->thumb_cache);
+        }
+
         g_clear_object (&p->settings);
         gsd_ldsm_clean ();
 }
@@ -21,40 +21,37 @@
  */
 
 #include "config.h"
-#include <gtk/gtk.h>
-#include <libnotify/notify.h>
-#include "gsd-disk-space.h"
+#include <gio/gio.h>
+#include "gsd-purge.h"
 
 int
 main (int    argc,
       char **argv)
 {
-        GFile *file;
-        DeleteData *data;
+        const gchar *dirs[] = { "/tmp/gsd-purge-temp-test", NULL };
+        GsdPurgeStats stats;
         GDateTime *old;
-        GMainLoop *loop;
+        GError *error = NULL;
+        gchar *size;
 
         g_setenv ("G_MESSAGES_DEBUG", "all", TRUE);
 
-        gtk_init (&argc, &argv);
-        notify_init ("gsd-purge-temp-test");
-        loop = g_main_loop_new (NULL, FALSE);
-
-        file = g_file_new_for_path ("/tmp/gsd-purge-temp-test");
-        if (!g_file_query_exists (file, NULL)) {
+        if (!g_file_test (dirs[0], G_FILE_TEST_IS_DIR)) {
                 g_warning ("Create /tmp/gsd-purge-temp-test and add some files to it to test deletion by date");
-                g_object_unref (file);
                 return 1;
         }
 
         old = g_date_time_new_now_local ();
-        data = delete_data_new (file, NULL, old, FALSE, FALSE, 0);
-        delete_recursively_by_age (data);
-        delete_data_unref (data);
-        g_object_unref (file);
+        if (!gsd_purge (GSD_PURGE_TEMP_FILES, dirs, old, FALSE, NULL, &stats, &error)) {
+                g_warning ("Failed to purge: %s", error->message);
+                g_error_free (error);
+        }
+        g_date_time_unref (old);
 
-        g_main_loop_run (loop);
+        size = g_format_size (stats.bytes_freed);
+        g_print ("%" G_GUINT64_FORMAT " scanned, %" G_GUINT64_FORMAT " removed, %s freed\n",
+                 stats.n_scanned, stats.n_deleted, size);
+        g_free (size);
 
         return 0;
 }
-
@@ -0,0 +1,797 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ * vim: set et sw=8 ts=8:
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <gio/gunixmounts.h>
+
+#include "gsd-purge.h"
+
+/*
+ * Purges old files from the temporary directories and the trash.
+ *
+ * Everything happens in threads, relative to directory file descriptors:
+ * one fstatat() per entry tells its type, owner and age, and unlinkat()
+ * removes it without resolving the path again. The top-level entries of
+ * each directory are shared by a few workers, which take the next entry
+ * from a common cursor when they are done with their current one, so a
+ * single large tree does not hold up the rest.
+ *
+ * The rules are the ones the GFile based purge had:
+ *  - a temporary file is old if it belongs to the user and its ctime is
+ *    before the cut-off; a directory is removed once it is empty and old,
+ *    having removed its children touches its ctime, so that happens on a
+ *    later run
+ *  - a trashed item is old if its deletion date is before the cut-off,
+ *    falling back to the temporary file rule without a trash info file,
+ *    and everything below an old trashed item goes with it
+ *  - symbolic links are never followed
+ *  - .X11-unix directories are left alone
+ *
+ * Directories are walked with an explicit stack rather than recursion.
+ * Only the innermost one is kept open, the way back up is through ".."
+ * after checking it is still the directory we came from, so however deep
+ * a tree is, each worker holds a single descriptor.
+ */
+
+#define PURGE_MAX_WORKERS       4
+#define PURGE_FLUSH_EVERY       256     /* entries */
+#define PURGE_PROGRESS_INTERVAL 500     /* ms */
+
+typedef struct {
+        GsdPurgeKind             kind;
+        gchar                  **dirs;
+        gint64                   old;           /* Unix time */
+        gboolean                 dry_run;
+        uid_t                    uid;
+        GCancellable            *cancellable;
+
+        GMutex                   lock;
+        GsdPurgeStats            stats;         /* protected by lock */
+
+        GsdPurgeProgressFunc     progress;
+        gpointer                 progress_data;
+        GSource                 *progress_source;
+} PurgeJob;
+
+typedef struct {
+        PurgeJob                *job;
+        int                      dir_fd;
+        int                      info_fd;       /* trash info/ or -1 */
+        GPtrArray               *names;         /* top-level entries */
+        volatile gint            next;          /* next one to take */
+} PurgeRoot;
+
+typedef struct {
+        PurgeRoot               *root;
+        GsdPurgeStats            stats;         /* not yet added to the job */
+        guint                    unflushed;
+} PurgeWorker;
+
+/* A directory being emptied */
+typedef struct {
+        gchar                   *name;          /* in its parent */
+        struct stat              st;
+        dev_t                    parent_dev;    /* to check ".." against */
+        ino_t                    parent_ino;
+        GPtrArray               *children;      /* names, read on entering */
+        guint                    next;
+        gboolean                 all_gone;
+        gboolean                 removed_any;
+} PurgeDir;
+
+typedef enum {
+        PURGE_ENTRY_KEPT,
+        PURGE_ENTRY_GONE,
+        PURGE_ENTRY_ENTERED,    /* a directory, pushed on the stack */
+} PurgeEntryResult;
+
+static PurgeJob *
+purge_job_new (GsdPurgeKind         kind,
+               const gchar * const *dirs,
+               GDateTime           *old,
+               gboolean             dry_run,
+               GCancellable        *cancellable)
+{
+        PurgeJob *job;
+
+        job = g_new0 (PurgeJob, 1);
+        job->kind = kind;
+        job->dirs = dirs ? g_strdupv ((gchar **) dirs) : NULL;
+        job->old = g_date_time_to_unix (old);
+        job->dry_run = dry_run;
+        job->uid = getuid ();
+        if (cancellable)
+                job->cancellable = g_object_ref (cancellable);
+        g_mutex_init (&job->lock);
+
+        return job;
+}
+
+static void
+purge_job_free (PurgeJob *job)
+{
+        g_assert (job->progress_source == NULL);
+
+        g_strfreev (job->dirs);
+        g_clear_object (&job->cancellable);
+        g_mutex_clear (&job->lock);
+        g_free (job);
+}
+
+static void
+purge_job_get_stats (PurgeJob      *job,
+                     GsdPurgeStats *stats)
+{
+        g_mutex_lock (&job->lock);
+        *stats = job->stats;
+        g_mutex_unlock (&job->lock);
+}
+
+static void
+purge_worker_flush (PurgeWorker *worker)
+{
+        PurgeJob *job = worker->root->job;
+
+        g_mutex_lock (&job->lock);
+        job->stats.n_scanned += worker->stats.n_scanned;
+        job->stats.n_deleted += worker->stats.n_deleted;
+        job->stats.bytes_freed += worker->stats.bytes_freed;
+        g_mutex_unlock (&job->lock);
+
+        memset (&worker->stats, 0, sizeof (worker->stats));
+        worker->unflushed = 0;
+}
+
+static gboolean
+purge_is_old (PurgeJob          *job,
+              const struct stat *st)
+{
+        return st->st_uid == job->uid && st->st_ctime <= job->old;
+}
+
+static gboolean
+purge_unlink (PurgeWorker       *worker,
+              int                parent_fd,
+              const char        *name,
+              const struct stat *st)
+{
+        if (!worker->root->job->dry_run &&
+            unlinkat (parent_fd, name, S_ISDIR (st->st_mode) ? AT_REMOVEDIR : 0) < 0) {
+                if (errno != ENOENT && errno != ENOTEMPTY)
+                        g_debug ("housekeeping: failed to remove %s: %s", name, g_strerror (errno));
+                return FALSE;
+        }
+
+        worker->stats.n_deleted++;
+        /* other links keep the data alive */
+        if (!S_ISDIR (st->st_mode) && st->st_nlink <= 1)
+                worker->stats.bytes_freed += (guint64) st->st_blocks * 512;
+
+        return TRUE;
+}
+
+/* Reads the names in the directory, leaving fd open */
+static GPtrArray *
+purge_read_names (int fd)
+{
+        struct dirent *ent;
+        GPtrArray *names;
+        DIR *dir;
+        int dup_fd;
+
+        /* closedir() closes its descriptor */
+        dup_fd = dup (fd);
+        dir = dup_fd >= 0 ? fdopendir (dup_fd) : NULL;
+        if (dir == NULL) {
+                if (dup_fd >= 0)
+                        close (dup_fd);
+                return NULL;
+        }
+
+        names = g_ptr_array_new_with_free_func (g_free);
+        while ((ent = readdir (dir)) != NULL) {
+                if (strcmp (ent->d_name, ".") != 0 && strcmp (ent->d_name, "..") != 0)
+                        g_ptr_array_add (names, g_strdup (ent->d_name));
+        }
+        closedir (dir);
+
+        return names;
+}
+
+static void
+purge_dir_clear (PurgeDir *dir)
+{
+        g_free (dir->name);
+        g_ptr_array_unref (dir->children);
+}
+
+/* Looks at an entry of the directory open as *fd. A directory is not
+ * purged here but entered: it is pushed on the stack, and *fd moves to it,
+ * closing the previous one unless it is top_fd. */
+static PurgeEntryResult
+purge_visit (PurgeWorker *worker,
+             GArray      *stack,
+             int          top_fd,
+             int         *fd,
+             const char  *name,
+             gboolean     force)
+{
+        PurgeJob *job = worker->root->job;
+        PurgeDir dir = { 0, };
+        struct stat parent_st;
+        struct stat child_st;
+        struct stat st;
+        int child_fd;
+
+        if (g_cancellable_is_cancelled (job->cancellable))
+                return PURGE_ENTRY_KEPT;
+
+        if (fstatat (*fd, name, &st, AT_SYMLINK_NOFOLLOW) < 0)
+                return PURGE_ENTRY_KEPT;
+
+        worker->stats.n_scanned++;
+        if (++worker->unflushed >= PURGE_FLUSH_EVERY)
+                purge_worker_flush (worker);
+
+        if (!S_ISLNK (st.st_mode) && strcmp (name, ".X11-unix") == 0) {
+                g_debug ("Skipping X11 socket directory");
+                return PURGE_ENTRY_KEPT;
+        }
+
+        if (!S_ISDIR (st.st_mode)) {
+                if (!force && !purge_is_old (job, &st))
+                        return PURGE_ENTRY_KEPT;
+                return purge_unlink (worker, *fd, name, &st) ? PURGE_ENTRY_GONE : PURGE_ENTRY_KEPT;
+        }
+
+        if (fstat (*fd, &parent_st) < 0)
+                return PURGE_ENTRY_KEPT;
+
+        child_fd = openat (*fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (child_fd < 0) {
+                if (errno != ENOENT)
+                        g_debug ("housekeeping: failed to open %s: %s", name, g_strerror (errno));
+                return PURGE_ENTRY_KEPT;
+        }
+
+        /* replaced since we looked at it */
+        if (fstat (child_fd, &child_st) < 0 ||
+            child_st.st_dev != st.st_dev || child_st.st_ino != st.st_ino) {
+                close (child_fd);
+                return PURGE_ENTRY_KEPT;
+        }
+
+        dir.children = purge_read_names (child_fd);
+        if (dir.children == NULL) {
+                close (child_fd);
+                return PURGE_ENTRY_KEPT;
+        }
+        dir.name = g_strdup (name);
+        dir.st = st;
+        dir.parent_dev = parent_st.st_dev;
+        dir.parent_ino = parent_st.st_ino;
+        dir.all_gone = TRUE;
+        g_array_append_val (stack, dir);
+
+        if (*fd != top_fd)
+                close (*fd);
+        *fd = child_fd;
+
+        return PURGE_ENTRY_ENTERED;
+}
+
+/* Goes back up from the innermost directory, returning its parent's
+ * descriptor, or -1 if the tree was moved while we were in it */
+static int
+purge_leave (GArray *stack,
+             int     top_fd,
+             int     fd)
+{
+        PurgeDir *dir = &g_array_index (stack, PurgeDir, stack->len - 1);
+        struct stat st;
+        int parent_fd;
+
+        if (stack->len == 1) {
+                close (fd);
+                return top_fd;
+        }
+
+        parent_fd = openat (fd, "..", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        close (fd);
+        if (parent_fd < 0)
+                return -1;
+
+        if (fstat (parent_fd, &st) < 0 ||
+            st.st_dev != dir->parent_dev || st.st_ino != dir->parent_ino) {
+                g_debug ("housekeeping: %s moved while purging it", dir->name);
+                close (parent_fd);
+                return -1;
+        }
+
+        return parent_fd;
+}
+
+/* Removes a directory whose children were all looked at, if it is empty
+ * and old enough */
+static PurgeEntryResult
+purge_dir_done (PurgeWorker *worker,
+                int          parent_fd,
+                PurgeDir    *dir,
+                gboolean     force)
+{
+        PurgeJob *job = worker->root->job;
+        struct stat st = dir->st;
+
+        if (!dir->all_gone)
+                return PURGE_ENTRY_KEPT;
+
+        /* removing children touched its ctime */
+        if (!force && dir->removed_any && !job->dry_run &&
+            fstatat (parent_fd, dir->name, &st, AT_SYMLINK_NOFOLLOW) < 0)
+                return PURGE_ENTRY_KEPT;
+
+        if (!force && !purge_is_old (job, &st))
+                return PURGE_ENTRY_KEPT;
+
+        return purge_unlink (worker, parent_fd, dir->name, &st) ? PURGE_ENTRY_GONE : PURGE_ENTRY_KEPT;
+}
+
+/* Returns whether the entry is gone, or would be. With force, the age
+ * and owner are not looked at. */
+static gboolean
+purge_entry (PurgeWorker *worker,
+             int          top_fd,
+             const char  *name,
+             gboolean     force)
+{
+        PurgeEntryResult result;
+        PurgeDir *dir;
+        GArray *stack;
+        guint depth;
+        int fd = top_fd;
+
+        stack = g_array_new (FALSE, FALSE, sizeof (PurgeDir));
+        g_array_set_clear_func (stack, (GDestroyNotify) purge_dir_clear);
+
+        result = purge_visit (worker, stack, top_fd, &fd, name, force);
+        while (stack->len > 0) {
+                depth = stack->len - 1;
+                dir = &g_array_index (stack, PurgeDir, depth);
+
+                /* the next child, which may take us further down */
+                if (dir->next < dir->children->len) {
+                        name = g_ptr_array_index (dir->children, dir->next++);
+                        result = purge_visit (worker, stack, top_fd, &fd, name, force);
+                } else {
+                        fd = purge_leave (stack, top_fd, fd);
+                        if (fd < 0) {
+                                result = PURGE_ENTRY_KEPT;
+                                break;
+                        }
+                        result = purge_dir_done (worker, fd, dir, force);
+                        g_array_set_size (stack, depth);
+                        if (depth == 0)
+                                break;
+                        depth--;
+                }
+
+                /* the stack may have moved */
+                dir = &g_array_index (stack, PurgeDir, depth);
+                if (result == PURGE_ENTRY_GONE)
+                        dir->removed_any = TRUE;
+                else if (result == PURGE_ENTRY_KEPT)
+                        dir->all_gone = FALSE;
+        }
+        g_array_unref (stack);
+
+        return result == PURGE_ENTRY_GONE;
+}
+
+/* Returns the deletion date from the trash info file, or -1 */
+static gint64
+purge_read_deletion_date (int         info_fd,
+                          const char *info_name)
+{
+        GDateTime *date;
+        gchar buf[4096];
+        const gchar *line;
+        gint y, mo, d, h, mi, s;
+        gint64 ret = -1;
+        ssize_t len;
+        int fd;
+
+        fd = openat (info_fd, info_name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+        if (fd < 0)
+                return -1;
+        len = read (fd, buf, sizeof (buf) - 1);
+        close (fd);
+        if (len <= 0)
+                return -1;
+        buf[len] = '\0';
+
+        line = strstr (buf, "\nDeletionDate=");
+        if (line == NULL)
+                return -1;
+
+        /* local time, as written by the trash implementations */
+        if (sscanf (line + strlen ("\nDeletionDate="), "%4d-%2d-%2dT%2d:%2d:%2d",
+                    &y, &mo, &d, &h, &mi, &s) != 6)
+                return -1;
+
+        date = g_date_time_new_local (y, mo, d, h, mi, s);
+        if (date == NULL)
+                return -1;
+        ret = g_date_time_to_unix (date);
+        g_date_time_unref (date);
+
+        return ret;
+}
+
+static void
+purge_top_level (PurgeWorker *worker,
+                 const char  *name)
+{
+        PurgeRoot *root = worker->root;
+        PurgeJob *job = root->job;
+        gchar *info_name;
+        struct stat st;
+        gint64 deleted;
+
+        if (root->info_fd < 0) {
+                purge_entry (worker, root->dir_fd, name, FALSE);
+                return;
+        }
+
+        info_name = g_strconcat (name, ".trashinfo", NULL);
+        deleted = purge_read_deletion_date (root->info_fd, info_name);
+        if (deleted >= 0) {
+                if (deleted > job->old)
+                        goto out;
+        } else if (fstatat (root->dir_fd, name, &st, AT_SYMLINK_NOFOLLOW) < 0 ||
+                   !purge_is_old (job, &st)) {
+                goto out;
+        }
+
+        /* no need to look at the age of what is inside */
+        if (purge_entry (worker, root->dir_fd, name, TRUE) && !job->dry_run)
+                unlinkat (root->info_fd, info_name, 0);
+
+out:
+        g_free (info_name);
+}
+
+static gpointer
+purge_worker_run (gpointer user_data)
+{
+        PurgeWorker *worker = user_data;
+        PurgeRoot *root = worker->root;
+        gint i;
+
+        while (!g_cancellable_is_cancelled (root->job->cancellable)) {
+                i = g_atomic_int_add (&root->next, 1);
+                if (i >= (gint) root->names->len)
+                        break;
+                purge_top_level (worker, g_ptr_array_index (root->names, i));
+        }
+        purge_worker_flush (worker);
+
+        return NULL;
+}
+
+static void
+purge_root (PurgeJob    *job,
+            const gchar *path)
+{
+        PurgeWorker workers[PURGE_MAX_WORKERS];
+        GThread *threads[PURGE_MAX_WORKERS];
+        PurgeRoot root = { 0, };
+        GError *error = NULL;
+        guint n_workers, i;
+        gchar *files_path;
+
+        root.job = job;
+        root.info_fd = -1;
+
+        if (job->kind == GSD_PURGE_TRASH) {
+                gchar *info_path;
+
+                info_path = g_build_filename (path, "info", NULL);
+                root.info_fd = open (info_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+                g_free (info_path);
+                files_path = g_build_filename (path, "files", NULL);
+        } else {
+                files_path = g_strdup (path);
+        }
+
+        root.dir_fd = open (files_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (root.dir_fd < 0) {
+                if (errno != ENOENT)
+                        g_warning ("Failed to open %s: %s", files_path, g_strerror (errno));
+                goto out;
+        }
+
+        /* the workers still need dir_fd */
+        root.names = purge_read_names (root.dir_fd);
+        if (root.names == NULL)
+                goto out;
+
+        n_workers = CLAMP (g_get_num_processors (), 1, PURGE_MAX_WORKERS);
+        n_workers = MAX (MIN (n_workers, root.names->len), 1);
+
+        g_debug ("housekeeping: purging %s in %s, %u entries, %u workers",
+                 job->kind == GSD_PURGE_TRASH ? "trash" : "temporary files",
+                 files_path, root.names->len, n_workers);
+
+        memset (workers, 0, sizeof (workers));
+        for (i = 0; i < n_workers; i++)
+                workers[i].root = &root;
+
+        /* this thread is the first worker */
+        for (i = 1; i < n_workers; i++) {
+                threads[i] = g_thread_try_new ("gsd-purge", purge_worker_run, &workers[i], &error);
+                if (threads[i] == NULL) {
+                        g_debug ("housekeeping: failed to start purge worker: %s", error->message);
+                        g_clear_error (&error);
+                        break;
+                }
+        }
+        n_workers = i;
+
+        purge_worker_run (&workers[0]);
+        for (i = 1; i < n_workers; i++)
+                g_thread_join (threads[i]);
+
+out:
+        if (root.names != NULL)
+                g_ptr_array_free (root.names, TRUE);
+        if (root.dir_fd >= 0)
+                close (root.dir_fd);
+        if (root.info_fd >= 0)
+                close (root.info_fd);
+        g_free (files_path);
+}
+
+static gchar *
+purge_get_fs_id_for_path (const gchar *path)
+{
+        GFile *file;
+        GFileInfo *fileinfo;
+        gchar *attr_id_fs = NULL;
+
+        file = g_file_new_for_path (path);
+        fileinfo = g_file_query_info (file, G_FILE_ATTRIBUTE_ID_FILESYSTEM, G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS, NULL, NULL);
+        if (fileinfo) {
+                attr_id_fs = g_strdup (g_file_info_get_attribute_string (fileinfo, G_FILE_ATTRIBUTE_ID_FILESYSTEM));
+                g_object_unref (fileinfo);
+        }
+        g_object_unref (file);
+
+        return attr_id_fs;
+}
+
+static void
+purge_add_trash_dir (GPtrArray *dirs,
+                     gchar     *trash_dir)
+{
+        gchar *trash_files_dir;
+
+        trash_files_dir = g_build_filename (trash_dir, "files", NULL);
+        if (g_file_test (trash_files_dir, G_FILE_TEST_IS_DIR))
+                g_ptr_array_add (dirs, trash_dir);
+        else
+                g_free (trash_dir);
+        g_free (trash_files_dir);
+}
+
+/* The home trash, and the trash directories of the other mounts, as
+ * the trash:/// backend would list them. This stats every mount, which
+ * can block on network file systems, so it only runs in the purge thread */
+static gchar **
+purge_get_trash_dirs (void)
+{
+        GPtrArray *dirs;
+        GList *mounts, *l;
+        gchar *user_data_attr_id_fs;
+        gchar *uid;
+
+        dirs = g_ptr_array_new ();
+        g_ptr_array_add (dirs, g_build_filename (g_get_user_data_dir (), "Trash", NULL));
+
+        user_data_attr_id_fs = purge_get_fs_id_for_path (g_get_user_data_dir ());
+        uid = g_strdup_printf ("%d", getuid ());
+
+        mounts = g_unix_mounts_get (NULL);
+        for (l = mounts; l != NULL; l = l->next) {
+                GUnixMountEntry *mount = l->data;
+                const gchar *path;
+                gchar *path_attr_id_fs;
+
+                if (g_unix_mount_is_system_internal (mount))
+                        continue;
+
+                path = g_unix_mount_get_mount_path (mount);
+                path_attr_id_fs = purge_get_fs_id_for_path (path);
+                if (g_strcmp0 (user_data_attr_id_fs, path_attr_id_fs) == 0) {
+                        g_free (path_attr_id_fs);
+                        continue;
+                }
+                g_free (path_attr_id_fs);
+
+                purge_add_trash_dir (dirs, g_build_filename (path, ".Trash", uid, NULL));
+                purge_add_trash_dir (dirs, g_strdup_printf ("%s/.Trash-%s", path, uid));
+        }
+        g_list_free_full (mounts, (GDestroyNotify) g_unix_mount_free);
+
+        g_free (user_data_attr_id_fs);
+        g_free (uid);
+        g_ptr_array_add (dirs, NULL);
+
+        return (gchar **) g_ptr_array_free (dirs, FALSE);
+}
+
+static gboolean
+purge_run (PurgeJob  *job,
+           GError   **error)
+{
+        guint i;
+
+        if (job->dirs == NULL)
+                job->dirs = purge_get_trash_dirs ();
+
+        for (i = 0; job->dirs[i] != NULL; i++) {
+                if (g_cancellable_is_cancelled (job->cancellable))
+                        break;
+                purge_root (job, job->dirs[i]);
+        }
+
+        return !g_cancellable_set_error_if_cancelled (job->cancellable, error);
+}
+
+static void
+purge_thread (GTask        *task,
+              gpointer      source_object,
+              gpointer      task_data,
+              GCancellable *cancellable)
+{
+        GError *error = NULL;
+
+        if (!purge_run (task_data, &error))
+                g_task_return_error (task, error);
+        else
+                g_task_return_boolean (task, TRUE);
+}
+
+static gboolean
+purge_progress_cb (gpointer user_data)
+{
+        PurgeJob *job = user_data;
+        GsdPurgeStats stats;
+
+        purge_job_get_stats (job, &stats);
+        job->progress (&stats, job->progress_data);
+
+        return G_SOURCE_CONTINUE;
+}
+
+static void
+purge_done_cb (GObject      *source_object,
+               GAsyncResult *res,
+               gpointer      user_data)
+{
+        GTask *task = user_data;
+        PurgeJob *job = g_task_get_task_data (task);
+        GError *error = NULL;
+
+        if (job->progress_source != NULL) {
+                g_source_destroy (job->progress_source);
+                g_clear_pointer (&job->progress_source, g_source_unref);
+        }
+
+        if (!g_task_propagate_boolean (G_TASK (res), &error))
+                g_task_return_error (task, error);
+        else
+                g_task_return_boolean (task, TRUE);
+        g_object_unref (task);
+}
+
+void
+gsd_purge_async (GsdPurgeKind          kind,
+                 const gchar * const  *dirs,
+                 GDateTime            *old,
+                 gboolean              dry_run,
+                 GCancellable         *cancellable,
+                 GsdPurgeProgressFunc  progress,
+                 gpointer              progress_data,
+                 GAsyncReadyCallback   callback,
+                 gpointer              user_data)
+{
+        GTask *task, *thread_task;
+        PurgeJob *job;
+
+        g_return_if_fail (dirs != NULL || kind == GSD_PURGE_TRASH);
+        g_return_if_fail (old != NULL);
+
+        job = purge_job_new (kind, dirs, old, dry_run, cancellable);
+        task = g_task_new (NULL, cancellable, callback, user_data);
+        g_task_set_source_tag (task, gsd_purge_async);
+        g_task_set_task_data (task, job, (GDestroyNotify) purge_job_free);
+
+        if (progress != NULL) {
+                job->progress = progress;
+                job->progress_data = progress_data;
+                job->progress_source = g_timeout_source_new (PURGE_PROGRESS_INTERVAL);
+                g_source_set_callback (job->progress_source, purge_progress_cb, job, NULL);
+                g_source_set_name (job->progress_source, "[gnome-settings-daemon] purge_progress_cb");
+                g_source_attach (job->progress_source, g_main_context_get_thread_default ());
+        }
+
+        /* the job belongs to the outer task, which outlives this one */
+        thread_task = g_task_new (NULL, cancellable, purge_done_cb, task);
+        g_task_set_task_data (thread_task, job, NULL);
+        g_task_run_in_thread (thread_task, purge_thread);
+        g_object_unref (thread_task);
+}
+
+gboolean
+gsd_purge_finish (GAsyncResult  *result,
+                  GsdPurgeStats *stats,
+                  GError       **error)
+{
+        g_return_val_if_fail (g_task_is_valid (result, NULL), FALSE);
+
+        if (stats != NULL)
+                purge_job_get_stats (g_task_get_task_data (G_TASK (result)), stats);
+
+        return g_task_propagate_boolean (G_TASK (result), error);
+}
+
+gboolean
+gsd_purge (GsdPurgeKind          kind,
+           const gchar * const  *dirs,
+           GDateTime            *old,
+           gboolean              dry_run,
+           GCancellable         *cancellable,
+           GsdPurgeStats        *stats,
+           GError              **error)
+{
+        PurgeJob *job;
+        gboolean ret;
+
+        g_return_val_if_fail (dirs != NULL || kind == GSD_PURGE_TRASH, FALSE);
+        g_return_val_if_fail (old != NULL, FALSE);
+
+        job = purge_job_new (kind, dirs, old, dry_run, cancellable);
+        ret = purge_run (job, error);
+        if (stats != NULL)
+                purge_job_get_stats (job, stats);
+        purge_job_free (job);
+
+        return ret;
+}
@@ -0,0 +1,68 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ * vim: set et sw=8 ts=8:
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __GSD_PURGE_H
+#define __GSD_PURGE_H
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+typedef enum {
+        GSD_PURGE_TEMP_FILES,   /* dirs are temporary directories */
+        GSD_PURGE_TRASH         /* dirs are trash directories, with files/ and info/ */
+} GsdPurgeKind;
+
+typedef struct {
+        guint64 n_scanned;
+        guint64 n_deleted;      /* or that would be, in a dry run */
+        guint64 bytes_freed;
+} GsdPurgeStats;
+
+typedef void (*GsdPurgeProgressFunc) (const GsdPurgeStats *stats,
+                                      gpointer             user_data);
+
+/* Removes the files in dirs last changed, or trashed, before old. For
+ * GSD_PURGE_TRASH, dirs may be NULL for the home trash and the trash
+ * directories of all the other mounts, looked up in the purge thread. The
+ * progress callback is called periodically in the calling thread's main
+ * context until the purge finishes, progress_data must stay valid until then */
+void     gsd_purge_async  (GsdPurgeKind          kind,
+                           const gchar * const  *dirs,
+                           GDateTime            *old,
+                           gboolean              dry_run,
+                           GCancellable         *cancellable,
+                           GsdPurgeProgressFunc  progress,
+                           gpointer              progress_data,
+                           GAsyncReadyCallback   callback,
+                           gpointer              user_data);
+/* stats are filled in even if the purge was cancelled */
+gboolean gsd_purge_finish (GAsyncResult         *result,
+                           GsdPurgeStats        *stats,
+                           GError              **error);
+gboolean gsd_purge        (GsdPurgeKind          kind,
+                           const gchar * const  *dirs,
+                           GDateTime            *old,
+                           gboolean              dry_run,
+                           GCancellable         *cancellable,
+                           GsdPurgeStats        *stats,
+                           GError              **error);
+
+G_END_DECLS
+
+#endif /* __GSD_PURGE_H */
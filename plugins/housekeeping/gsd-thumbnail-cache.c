@@ -0,0 +1,999 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ * vim: set et sw=8 ts=8:
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+
+#include "gsd-thumbnail-cache.h"
+
+/*
+ * The thumbnail cache can hold hundreds of thousands of files, so the
+ * purge runs in a thread and keeps as little as possible per file: a
+ * fixed-size record, with the names packed into a single buffer. Files
+ * over the age limit are removed first. If the rest is still over the
+ * size limit, the oldest files are picked with a size-weighted
+ * quickselect rather than by sorting everything.
+ *
+ * The size and age of the files in the XDG thumbnail directories are
+ * also kept in an index, which file monitors keep up to date and which
+ * is saved in the user cache directory. With a valid index, deciding
+ * whether anything needs purging doesn't touch the disk, and a purge
+ * doesn't need to read the directories. The index is rebuilt from a
+ * full scan when it is missing, or when a directory was modified since
+ * it was saved. The obsolete ~/.thumbnails directories are only looked
+ * at during full scans.
+ *
+ * The index belongs to the main thread, except while a purge runs: the
+ * purge thread is then handed its tables, reads them from disk the
+ * first time, and saves them after purging. Monitor events that come
+ * in meanwhile are replayed once it hands them back.
+ */
+
+#define THUMB_NAME_LEN          36      /* md5 in hex, and ".png" */
+#define THUMB_INDEX_VERSION     1
+#define THUMB_INDEX_TYPE        "(ua(sxa(sxx)))"
+
+/* the first N_INDEXED_DIRS of get_thumbnail_dirs() */
+#define N_INDEXED_DIRS          3
+
+/* directories modified this recently might have monitor
+ * events we haven't seen yet */
+#define THUMB_INDEX_SETTLE_TIME (2 * G_USEC_PER_SEC)
+
+typedef struct {
+        gint64  mtime;
+        goffset size;
+        gchar   name[THUMB_NAME_LEN + 1];
+} ThumbEntry;
+
+typedef struct {
+        GsdThumbnailCache *cache;
+        gchar             *path;
+        GHashTable        *entries;     /* name → ThumbEntry */
+        GHashTable        *pending;     /* names changed during a rescan */
+        GFileMonitor      *monitor;
+} ThumbDir;
+
+struct _GsdThumbnailCache
+{
+        GObject          parent_instance;
+
+        ThumbDir         dirs[N_INDEXED_DIRS];
+        gchar           *index_path;
+        goffset          total_size;
+        gint64           oldest;
+        gboolean         oldest_valid;
+        gboolean         monitored;
+        gboolean         loaded;        /* the saved index was looked at */
+        gboolean         valid;
+        gboolean         purging;       /* a purge thread has the entries */
+        gboolean         dirty;
+};
+
+G_DEFINE_TYPE (GsdThumbnailCache, gsd_thumbnail_cache, G_TYPE_OBJECT)
+
+typedef struct {
+        gint64  mtime;
+        goffset size;
+        guint32 name;           /* offset into ThumbScan.names */
+        guint16 dir;            /* index into ThumbScan.dirs */
+        guint16 removed;
+} ThumbRecord;
+
+typedef struct {
+        GPtrArray *dirs;        /* DIR *, kept open for unlinkat() */
+        GArray    *records;
+        GString   *names;
+        guint      n_removed;
+} ThumbScan;
+
+typedef struct {
+        glong       max_age;
+        goffset     max_size;
+        gboolean    owns_index;         /* FALSE if another purge has it */
+        gboolean    load;               /* read the saved index first */
+        gboolean    rescan;
+        gboolean    monitored;
+        gboolean    dirty;              /* the saved index is behind */
+        gchar      *index_path;
+        GHashTable *entries[N_INDEXED_DIRS];
+        gboolean    valid;              /* entries are complete */
+        goffset     total_size;
+        gint64      oldest;
+        ThumbScan   scan;
+} PurgeData;
+
+static char **
+get_thumbnail_dirs (void)
+{
+        GPtrArray *array;
+        char *path;
+
+        array = g_ptr_array_new ();
+
+        /* check new XDG cache */
+        path = g_build_filename (g_get_user_cache_dir (),
+                                 "thumbnails",
+                                 "normal",
+                                 NULL);
+        g_ptr_array_add (array, path);
+
+        path = g_build_filename (g_get_user_cache_dir (),
+                                 "thumbnails",
+                                 "large",
+                                 NULL);
+        g_ptr_array_add (array, path);
+
+        path = g_build_filename (g_get_user_cache_dir (),
+                                 "thumbnails",
+                                 "fail",
+                                 "gnome-thumbnail-factory",
+                                 NULL);
+        g_ptr_array_add (array, path);
+
+        /* cleanup obsolete locations too */
+        path = g_build_filename (g_get_home_dir (),
+                                 ".thumbnails",
+                                 "normal",
+                                 NULL);
+        g_ptr_array_add (array, path);
+
+        path = g_build_filename (g_get_home_dir (),
+                                 ".thumbnails",
+                                 "large",
+                                 NULL);
+        g_ptr_array_add (array, path);
+
+        path = g_build_filename (g_get_home_dir (),
+                                 ".thumbnails",
+                                 "fail",
+                                 "gnome-thumbnail-factory",
+                                 NULL);
+        g_ptr_array_add (array, path);
+
+        g_ptr_array_add (array, NULL);
+
+        return (char **) g_ptr_array_free (array, FALSE);
+}
+
+static gboolean
+is_thumbnail_name (const char *name)
+{
+        return strlen (name) == THUMB_NAME_LEN && strcmp (name + 32, ".png") == 0;
+}
+
+static gint64
+get_dir_mtime (const char *path)
+{
+        struct stat st;
+
+        if (g_stat (path, &st) < 0)
+                return -1;
+        return (gint64) st.st_mtim.tv_sec * G_USEC_PER_SEC + st.st_mtim.tv_nsec / 1000;
+}
+
+/* Index */
+
+static GHashTable *
+thumb_entries_new (void)
+{
+        return g_hash_table_new_full (g_str_hash, g_str_equal, NULL, g_free);
+}
+
+static void
+thumb_entries_insert (GHashTable *entries,
+                      const char *name,
+                      gint64      mtime,
+                      goffset     size)
+{
+        ThumbEntry *entry;
+
+        entry = g_new (ThumbEntry, 1);
+        entry->mtime = mtime;
+        entry->size = size;
+        g_strlcpy (entry->name, name, sizeof (entry->name));
+        g_hash_table_replace (entries, entry->name, entry);
+}
+
+static void
+thumb_dir_remove (ThumbDir   *dir,
+                  const char *name)
+{
+        GsdThumbnailCache *cache = dir->cache;
+        ThumbEntry *entry;
+
+        entry = g_hash_table_lookup (dir->entries, name);
+        if (entry == NULL)
+                return;
+
+        cache->total_size -= entry->size;
+        if (entry->mtime <= cache->oldest)
+                cache->oldest_valid = FALSE;
+        cache->dirty = TRUE;
+
+        g_hash_table_remove (dir->entries, name);
+}
+
+static void
+thumb_dir_insert (ThumbDir   *dir,
+                  const char *name,
+                  gint64      mtime,
+                  goffset     size)
+{
+        GsdThumbnailCache *cache = dir->cache;
+
+        thumb_dir_remove (dir, name);
+        thumb_entries_insert (dir->entries, name, mtime, size);
+
+        cache->total_size += size;
+        if (cache->oldest_valid)
+                cache->oldest = MIN (cache->oldest, mtime);
+        cache->dirty = TRUE;
+}
+
+static void
+thumb_dir_refresh (ThumbDir   *dir,
+                   const char *name)
+{
+        GsdThumbnailCache *cache = dir->cache;
+        struct stat st;
+        char *path;
+
+        if (!is_thumbnail_name (name))
+                return;
+
+        /* the index is being loaded or rebuilt, and might miss this */
+        if (!cache->valid) {
+                if (cache->purging || !cache->loaded)
+                        g_hash_table_add (dir->pending, g_strdup (name));
+                return;
+        }
+
+        path = g_build_filename (dir->path, name, NULL);
+        if (g_stat (path, &st) == 0 && S_ISREG (st.st_mode))
+                thumb_dir_insert (dir, name, st.st_mtime, st.st_size);
+        else
+                thumb_dir_remove (dir, name);
+        g_free (path);
+}
+
+static void
+thumb_dir_changed_cb (GFileMonitor      *monitor,
+                      GFile             *file,
+                      GFile             *other_file,
+                      GFileMonitorEvent  event_type,
+                      ThumbDir          *dir)
+{
+        char *name;
+
+        switch (event_type) {
+        case G_FILE_MONITOR_EVENT_RENAMED:
+                name = g_file_get_basename (other_file);
+                thumb_dir_refresh (dir, name);
+                g_free (name);
+                /* fall through */
+        case G_FILE_MONITOR_EVENT_CREATED:
+        case G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT:
+        case G_FILE_MONITOR_EVENT_ATTRIBUTE_CHANGED:
+        case G_FILE_MONITOR_EVENT_DELETED:
+        case G_FILE_MONITOR_EVENT_MOVED_IN:
+        case G_FILE_MONITOR_EVENT_MOVED_OUT:
+                name = g_file_get_basename (file);
+                thumb_dir_refresh (dir, name);
+                g_free (name);
+                break;
+        default:
+                break;
+        }
+}
+
+/* Reads the saved index into entries, which are left empty if it is
+ * missing or out of date. Only called from the purge thread. */
+static gboolean
+thumb_index_load (const char         *index_path,
+                  const char * const *paths,
+                  GHashTable * const *entries)
+{
+        GVariant *index = NULL;
+        GVariant *dirs = NULL;
+        GBytes *bytes;
+        gchar *contents;
+        gsize length;
+        guint32 version;
+        gboolean ret = FALSE;
+        guint i;
+
+        if (!g_file_get_contents (index_path, &contents, &length, NULL))
+                return FALSE;
+
+        bytes = g_bytes_new_take (contents, length);
+        index = g_variant_ref_sink (g_variant_new_from_bytes (G_VARIANT_TYPE (THUMB_INDEX_TYPE), bytes, FALSE));
+        g_bytes_unref (bytes);
+        if (!g_variant_is_normal_form (index))
+                goto out;
+
+        g_variant_get (index, "(u@a(sxa(sxx)))", &version, &dirs);
+        if (version != THUMB_INDEX_VERSION ||
+            g_variant_n_children (dirs) != N_INDEXED_DIRS)
+                goto out;
+
+        for (i = 0; i < N_INDEXED_DIRS; i++) {
+                GVariant *dir_entries;
+                GVariantIter iter;
+                const gchar *path;
+                const gchar *name;
+                gint64 dir_mtime;
+                gint64 mtime;
+                gint64 size;
+
+                /* anything changed while we weren't watching? */
+                g_variant_get_child (dirs, i, "(&sx@a(sxx))", &path, &dir_mtime, &dir_entries);
+                if (g_strcmp0 (path, paths[i]) != 0 ||
+                    dir_mtime != get_dir_mtime (paths[i])) {
+                        g_variant_unref (dir_entries);
+                        goto out;
+                }
+
+                g_variant_iter_init (&iter, dir_entries);
+                while (g_variant_iter_next (&iter, "(&sxx)", &name, &mtime, &size)) {
+                        if (is_thumbnail_name (name))
+                                thumb_entries_insert (entries[i], name, mtime, size);
+                }
+                g_variant_unref (dir_entries);
+        }
+        ret = TRUE;
+
+out:
+        if (!ret) {
+                for (i = 0; i < N_INDEXED_DIRS; i++)
+                        g_hash_table_remove_all (entries[i]);
+        }
+        g_clear_pointer (&dirs, g_variant_unref);
+        g_variant_unref (index);
+        return ret;
+}
+
+static gboolean
+thumb_index_save (const char         *index_path,
+                  const char * const *paths,
+                  GHashTable * const *entries)
+{
+        GVariantBuilder dirs;
+        GVariant *index;
+        GError *error = NULL;
+        gchar *dirname;
+        gboolean ret;
+        gint64 now;
+        guint i;
+
+        now = g_get_real_time ();
+        g_variant_builder_init (&dirs, G_VARIANT_TYPE ("a(sxa(sxx))"));
+        for (i = 0; i < N_INDEXED_DIRS; i++) {
+                GVariantBuilder dir_entries;
+                GHashTableIter iter;
+                ThumbEntry *entry;
+                gint64 dir_mtime;
+
+                g_variant_builder_init (&dir_entries, G_VARIANT_TYPE ("a(sxx)"));
+                g_hash_table_iter_init (&iter, entries[i]);
+                while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &entry))
+                        g_variant_builder_add (&dir_entries, "(sxx)", entry->name, entry->mtime, (gint64) entry->size);
+
+                /* force a rescan next time rather than trust it */
+                dir_mtime = get_dir_mtime (paths[i]);
+                if (now - dir_mtime < THUMB_INDEX_SETTLE_TIME)
+                        dir_mtime = G_MININT64;
+
+                g_variant_builder_add (&dirs, "(sx@a(sxx))",
+                                       paths[i], dir_mtime,
+                                       g_variant_builder_end (&dir_entries));
+        }
+        index = g_variant_ref_sink (g_variant_new ("(u@a(sxa(sxx)))",
+                                                   THUMB_INDEX_VERSION,
+                                                   g_variant_builder_end (&dirs)));
+
+        dirname = g_path_get_dirname (index_path);
+        g_mkdir_with_parents (dirname, 0700);
+        g_free (dirname);
+
+        ret = g_file_set_contents (index_path,
+                                   g_variant_get_data (index),
+                                   g_variant_get_size (index),
+                                   &error);
+        if (!ret) {
+                g_warning ("Failed to save the thumbnail index: %s", error->message);
+                g_error_free (error);
+        }
+        g_variant_unref (index);
+
+        return ret;
+}
+
+void
+gsd_thumbnail_cache_save (GsdThumbnailCache *cache)
+{
+        const char *paths[N_INDEXED_DIRS];
+        GHashTable *entries[N_INDEXED_DIRS];
+        guint i;
+
+        g_return_if_fail (GSD_IS_THUMBNAIL_CACHE (cache));
+
+        /* a running purge saves it when done */
+        if (!cache->valid || !cache->dirty)
+                return;
+
+        for (i = 0; i < N_INDEXED_DIRS; i++) {
+                paths[i] = cache->dirs[i].path;
+                entries[i] = cache->dirs[i].entries;
+        }
+
+        if (thumb_index_save (cache->index_path, paths, entries))
+                cache->dirty = FALSE;
+}
+
+/* Purging, in a thread */
+
+static void
+thumb_scan_close_dir (gpointer data)
+{
+        if (data != NULL)
+                closedir (data);
+}
+
+static void
+thumb_scan_init (ThumbScan *scan)
+{
+        scan->dirs = g_ptr_array_new_with_free_func (thumb_scan_close_dir);
+        scan->records = g_array_new (FALSE, FALSE, sizeof (ThumbRecord));
+        scan->names = g_string_new (NULL);
+        scan->n_removed = 0;
+}
+
+static void
+purge_data_free (PurgeData *data)
+{
+        guint i;
+
+        for (i = 0; i < N_INDEXED_DIRS; i++)
+                g_clear_pointer (&data->entries[i], g_hash_table_unref);
+        g_free (data->index_path);
+        g_ptr_array_unref (data->scan.dirs);
+        g_array_unref (data->scan.records);
+        g_string_free (data->scan.names, TRUE);
+        g_free (data);
+}
+
+static void
+thumb_scan_add (ThumbScan  *scan,
+                guint       dir,
+                const char *name,
+                gint64      mtime,
+                goffset     size)
+{
+        ThumbRecord record;
+
+        record.mtime = mtime;
+        record.size = size;
+        record.name = scan->names->len;
+        record.dir = dir;
+        record.removed = FALSE;
+        g_string_append_len (scan->names, name, strlen (name) + 1);
+        g_array_append_val (scan->records, record);
+}
+
+static void
+thumb_scan_remove (ThumbScan   *scan,
+                   ThumbRecord *record)
+{
+        DIR *dir;
+
+        record->removed = TRUE;
+        dir = g_ptr_array_index (scan->dirs, record->dir);
+        if (dir != NULL && unlinkat (dirfd (dir), scan->names->str + record->name, 0) == 0)
+                scan->n_removed++;
+}
+
+static void
+thumb_scan_dir (ThumbScan    *scan,
+                const char   *path,
+                GCancellable *cancellable)
+{
+        DIR *dir;
+        struct dirent *entry;
+        struct stat st;
+        guint index;
+
+        /* keep the indexes in line with the paths */
+        dir = opendir (path);
+        index = scan->dirs->len;
+        g_ptr_array_add (scan->dirs, dir);
+        if (dir == NULL)
+                return;
+
+        while ((entry = readdir (dir)) != NULL) {
+                if (g_cancellable_is_cancelled (cancellable))
+                        return;
+
+                if (!is_thumbnail_name (entry->d_name))
+                        continue;
+                if (fstatat (dirfd (dir), entry->d_name, &st, 0) < 0)
+                        continue;
+
+                thumb_scan_add (scan, index, entry->d_name, st.st_mtime, st.st_size);
+        }
+}
+
+#define SWAP_RECORDS(a, b) G_STMT_START { ThumbRecord t = (a); (a) = (b); (b) = t; } G_STMT_END
+
+/* Removes the oldest records until at least excess bytes are freed */
+static void
+thumb_scan_remove_oldest (ThumbScan    *scan,
+                          ThumbRecord  *records,
+                          gsize         n,
+                          goffset       excess,
+                          GCancellable *cancellable)
+{
+        while (n > 0 && excess > 0) {
+                gint64 pivot;
+                goffset older;
+                gsize lt, gt, i;
+
+                if (g_cancellable_is_cancelled (cancellable))
+                        return;
+
+                /* partition into [0, lt) older than the pivot,
+                 * [lt, gt) as old and [gt, n) newer */
+                pivot = records[n / 2].mtime;
+                older = 0;
+                lt = i = 0;
+                gt = n;
+                while (i < gt) {
+                        if (records[i].mtime < pivot) {
+                                older += records[i].size;
+                                SWAP_RECORDS (records[lt], records[i]);
+                                lt++;
+                                i++;
+                        } else if (records[i].mtime > pivot) {
+                                gt--;
+                                SWAP_RECORDS (records[i], records[gt]);
+                        } else {
+                                i++;
+                        }
+                }
+
+                /* the older files are enough, only look there */
+                if (older >= excess) {
+                        n = lt;
+                        continue;
+                }
+
+                for (i = 0; i < lt; i++)
+                        thumb_scan_remove (scan, &records[i]);
+                excess -= older;
+
+                for (i = lt; i < gt && excess > 0; i++) {
+                        thumb_scan_remove (scan, &records[i]);
+                        excess -= records[i].size;
+                }
+
+                records += gt;
+                n -= gt;
+        }
+}
+
+static void
+thumb_scan_purge (ThumbScan    *scan,
+                  glong         max_age,
+                  goffset       max_size,
+                  GCancellable *cancellable)
+{
+        ThumbRecord *records;
+        goffset total_size = 0;
+        gint64 now;
+        guint kept = 0;
+        guint i;
+
+        now = g_get_real_time () / G_USEC_PER_SEC;
+        records = (ThumbRecord *) scan->records->data;
+
+        /* the age limit first, moving the files that are
+         * left to the front for the size limit */
+        for (i = 0; i < scan->records->len; i++) {
+                if (max_age >= 0 && (now - records[i].mtime) > max_age) {
+                        thumb_scan_remove (scan, &records[i]);
+                        continue;
+                }
+                total_size += records[i].size;
+                SWAP_RECORDS (records[kept], records[i]);
+                kept++;
+        }
+
+        if (max_size >= 0 && total_size > max_size)
+                thumb_scan_remove_oldest (scan, records, kept, total_size - max_size, cancellable);
+}
+
+/* Brings the entries in line with what the purge found and removed */
+static void
+purge_update_index (PurgeData    *data,
+                    GCancellable *cancellable)
+{
+        ThumbRecord *records;
+        GHashTableIter iter;
+        ThumbEntry *entry;
+        guint i;
+
+        if (!data->owns_index)
+                return;
+
+        records = (ThumbRecord *) data->scan.records->data;
+
+        if (data->rescan) {
+                for (i = 0; i < N_INDEXED_DIRS; i++)
+                        g_hash_table_remove_all (data->entries[i]);
+                data->valid = data->monitored && !g_cancellable_is_cancelled (cancellable);
+                if (!data->valid)
+                        return;
+
+                for (i = 0; i < data->scan.records->len; i++) {
+                        if (records[i].dir >= N_INDEXED_DIRS || records[i].removed)
+                                continue;
+                        thumb_entries_insert (data->entries[records[i].dir],
+                                              data->scan.names->str + records[i].name,
+                                              records[i].mtime,
+                                              records[i].size);
+                }
+        } else {
+                for (i = 0; i < data->scan.records->len; i++) {
+                        if (records[i].removed)
+                                g_hash_table_remove (data->entries[records[i].dir],
+                                                     data->scan.names->str + records[i].name);
+                }
+                data->valid = TRUE;
+        }
+
+        data->total_size = 0;
+        data->oldest = G_MAXINT64;
+        for (i = 0; i < N_INDEXED_DIRS; i++) {
+                g_hash_table_iter_init (&iter, data->entries[i]);
+                while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &entry)) {
+                        data->total_size += entry->size;
+                        data->oldest = MIN (data->oldest, entry->mtime);
+                }
+        }
+}
+
+static void
+purge_thread (GTask        *task,
+              gpointer      source_object,
+              gpointer      task_data,
+              GCancellable *cancellable)
+{
+        PurgeData *data = task_data;
+        GHashTableIter iter;
+        ThumbEntry *entry;
+        char **paths;
+        guint n_checked;
+        guint i;
+
+        paths = get_thumbnail_dirs ();
+
+        if (data->load) {
+                data->rescan = !data->monitored ||
+                               !thumb_index_load (data->index_path,
+                                                  (const char * const *) paths,
+                                                  data->entries);
+                if (!data->rescan)
+                        g_debug ("housekeeping: loaded thumbnail index");
+        }
+
+        if (data->rescan) {
+                for (i = 0; paths[i] != NULL; i++)
+                        thumb_scan_dir (&data->scan, paths[i], cancellable);
+        } else {
+                for (i = 0; i < N_INDEXED_DIRS; i++) {
+                        g_ptr_array_add (data->scan.dirs, opendir (paths[i]));
+                        g_hash_table_iter_init (&iter, data->entries[i]);
+                        while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &entry))
+                                thumb_scan_add (&data->scan, i, entry->name, entry->mtime, entry->size);
+                }
+        }
+
+        n_checked = data->scan.records->len;
+        thumb_scan_purge (&data->scan, data->max_age, data->max_size, cancellable);
+
+        g_debug ("housekeeping: removed %u of %u thumbnails%s",
+                 data->scan.n_removed, n_checked,
+                 data->rescan ? " after a full scan" : "");
+
+        purge_update_index (data, cancellable);
+        if (data->valid && (data->dirty || data->rescan || data->scan.n_removed > 0))
+                data->dirty = !thumb_index_save (data->index_path,
+                                                 (const char * const *) paths,
+                                                 data->entries);
+        g_strfreev (paths);
+
+        if (g_task_return_error_if_cancelled (task))
+                return;
+        g_task_return_boolean (task, TRUE);
+}
+
+/* Back in the main thread, takes the index back, cancelled or not */
+static void
+purge_apply (GsdThumbnailCache *cache,
+             PurgeData         *data)
+{
+        GHashTableIter iter;
+        const char *name;
+        guint i;
+
+        if (!data->owns_index)
+                return;
+
+        for (i = 0; i < N_INDEXED_DIRS; i++) {
+                g_hash_table_unref (cache->dirs[i].entries);
+                cache->dirs[i].entries = g_steal_pointer (&data->entries[i]);
+        }
+        cache->total_size = data->total_size;
+        cache->oldest = data->oldest;
+        cache->oldest_valid = TRUE;
+        cache->valid = data->valid;
+        cache->dirty = data->dirty;
+        cache->loaded = TRUE;
+        cache->purging = FALSE;
+
+        /* what changed while the purge thread had the index */
+        for (i = 0; i < N_INDEXED_DIRS; i++) {
+                if (cache->valid) {
+                        g_hash_table_iter_init (&iter, cache->dirs[i].pending);
+                        while (g_hash_table_iter_next (&iter, (gpointer *) &name, NULL))
+                                thumb_dir_refresh (&cache->dirs[i], name);
+                }
+                g_hash_table_remove_all (cache->dirs[i].pending);
+        }
+}
+
+/* Returns NULL if the index shows nothing to purge */
+static PurgeData *
+purge_data_new (GsdThumbnailCache *cache,
+                glong              max_age,
+                goffset            max_size)
+{
+        PurgeData *data;
+        gint64 now;
+        guint i;
+
+        /* an unknown oldest file is left for the purge thread to find */
+        if (cache->valid) {
+                now = g_get_real_time () / G_USEC_PER_SEC;
+                if ((max_size < 0 || cache->total_size <= max_size) &&
+                    (max_age < 0 || (cache->oldest_valid && (now - cache->oldest) <= max_age))) {
+                        g_debug ("housekeeping: thumbnail index has %u files using %" G_GOFFSET_FORMAT " bytes, nothing to purge",
+                                 g_hash_table_size (cache->dirs[0].entries) +
+                                 g_hash_table_size (cache->dirs[1].entries) +
+                                 g_hash_table_size (cache->dirs[2].entries),
+                                 cache->total_size);
+                        return NULL;
+                }
+        }
+
+        data = g_new0 (PurgeData, 1);
+        data->max_age = max_age;
+        data->max_size = max_size;
+        thumb_scan_init (&data->scan);
+
+        /* another purge has the index, go without it */
+        if (cache->purging) {
+                data->rescan = TRUE;
+                return data;
+        }
+
+        data->owns_index = TRUE;
+        data->load = !cache->loaded;
+        data->rescan = cache->loaded && !cache->valid;
+        data->monitored = cache->monitored;
+        data->dirty = cache->dirty;
+        data->index_path = g_strdup (cache->index_path);
+
+        /* hand the entries over rather than copy them */
+        for (i = 0; i < N_INDEXED_DIRS; i++) {
+                data->entries[i] = cache->dirs[i].entries;
+                cache->dirs[i].entries = thumb_entries_new ();
+                /* the scan will see those, but not the
+                 * events that came in before loading */
+                if (data->rescan)
+                        g_hash_table_remove_all (cache->dirs[i].pending);
+        }
+        cache->total_size = 0;
+        cache->valid = FALSE;
+        cache->purging = TRUE;
+
+        return data;
+}
+
+static void
+purge_done_cb (GObject      *source_object,
+               GAsyncResult *res,
+               gpointer      user_data)
+{
+        GsdThumbnailCache *cache = GSD_THUMBNAIL_CACHE (source_object);
+        GTask *task = user_data;
+        GError *error = NULL;
+
+        purge_apply (cache, g_task_get_task_data (G_TASK (res)));
+
+        if (!g_task_propagate_boolean (G_TASK (res), &error))
+                g_task_return_error (task, error);
+        else
+                g_task_return_boolean (task, TRUE);
+        g_object_unref (task);
+}
+
+void
+gsd_thumbnail_cache_purge_async (GsdThumbnailCache   *cache,
+                                 glong                max_age,
+                                 goffset              max_size,
+                                 GCancellable        *cancellable,
+                                 GAsyncReadyCallback  callback,
+                                 gpointer             user_data)
+{
+        GTask *task;
+        GTask *thread_task;
+        PurgeData *data;
+
+        g_return_if_fail (GSD_IS_THUMBNAIL_CACHE (cache));
+
+        task = g_task_new (cache, cancellable, callback, user_data);
+        g_task_set_source_tag (task, gsd_thumbnail_cache_purge_async);
+
+        data = purge_data_new (cache, max_age, max_size);
+        if (data == NULL) {
+                g_task_return_boolean (task, TRUE);
+                g_object_unref (task);
+                return;
+        }
+
+        thread_task = g_task_new (cache, cancellable, purge_done_cb, task);
+        g_task_set_task_data (thread_task, data, (GDestroyNotify) purge_data_free);
+        g_task_run_in_thread (thread_task, purge_thread);
+        g_object_unref (thread_task);
+}
+
+gboolean
+gsd_thumbnail_cache_purge_finish (GsdThumbnailCache  *cache,
+                                  GAsyncResult       *result,
+                                  GError            **error)
+{
+        g_return_val_if_fail (g_task_is_valid (result, cache), FALSE);
+
+        return g_task_propagate_boolean (G_TASK (result), error);
+}
+
+gboolean
+gsd_thumbnail_cache_purge (GsdThumbnailCache  *cache,
+                           glong               max_age,
+                           goffset             max_size,
+                           GCancellable       *cancellable,
+                           GError            **error)
+{
+        GTask *task;
+        PurgeData *data;
+        gboolean ret;
+
+        g_return_val_if_fail (GSD_IS_THUMBNAIL_CACHE (cache), FALSE);
+
+        data = purge_data_new (cache, max_age, max_size);
+        if (data == NULL)
+                return TRUE;
+
+        task = g_task_new (cache, cancellable, NULL, NULL);
+        g_task_set_task_data (task, data, (GDestroyNotify) purge_data_free);
+        g_task_run_in_thread_sync (task, purge_thread);
+        purge_apply (cache, data);
+        ret = g_task_propagate_boolean (task, error);
+        g_object_unref (task);
+
+        return ret;
+}
+
+static void
+gsd_thumbnail_cache_finalize (GObject *object)
+{
+        GsdThumbnailCache *cache = GSD_THUMBNAIL_CACHE (object);
+        guint i;
+
+        for (i = 0; i < N_INDEXED_DIRS; i++) {
+                ThumbDir *dir = &cache->dirs[i];
+
+                if (dir->monitor != NULL) {
+                        g_signal_handlers_disconnect_by_data (dir->monitor, dir);
+                        g_object_unref (dir->monitor);
+                }
+                g_hash_table_unref (dir->entries);
+                g_hash_table_unref (dir->pending);
+                g_free (dir->path);
+        }
+        g_free (cache->index_path);
+
+        G_OBJECT_CLASS (gsd_thumbnail_cache_parent_class)->finalize (object);
+}
+
+static void
+gsd_thumbnail_cache_class_init (GsdThumbnailCacheClass *klass)
+{
+        GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+        object_class->finalize = gsd_thumbnail_cache_finalize;
+}
+
+static void
+gsd_thumbnail_cache_init (GsdThumbnailCache *cache)
+{
+        char **paths;
+        guint i;
+
+        cache->index_path = g_build_filename (g_get_user_cache_dir (),
+                                              "gnome-settings-daemon",
+                                              "thumbnail-index",
+                                              NULL);
+        cache->oldest = G_MAXINT64;
+        cache->oldest_valid = TRUE;
+        cache->monitored = TRUE;
+
+        paths = get_thumbnail_dirs ();
+        for (i = 0; i < N_INDEXED_DIRS; i++) {
+                ThumbDir *dir = &cache->dirs[i];
+                GError *error = NULL;
+                GFile *file;
+
+                dir->cache = cache;
+                dir->path = g_strdup (paths[i]);
+                dir->entries = thumb_entries_new ();
+                dir->pending = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+                file = g_file_new_for_path (dir->path);
+                dir->monitor = g_file_monitor_directory (file, G_FILE_MONITOR_WATCH_MOVES, NULL, &error);
+                g_object_unref (file);
+                if (dir->monitor == NULL) {
+                        g_debug ("housekeeping: not indexing thumbnails, can't monitor %s: %s",
+                                 dir->path, error->message);
+                        g_error_free (error);
+                        cache->monitored = FALSE;
+                        continue;
+                }
+                g_signal_connect (dir->monitor, "changed",
+                                  G_CALLBACK (thumb_dir_changed_cb), dir);
+        }
+        g_strfreev (paths);
+}
+
+GsdThumbnailCache *
+gsd_thumbnail_cache_new (void)
+{
+        /* the index is read by the first purge, in its thread */
+        return g_object_new (GSD_TYPE_THUMBNAIL_CACHE, NULL);
+}
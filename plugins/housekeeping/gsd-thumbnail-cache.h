@@ -0,0 +1,50 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ * vim: set et sw=8 ts=8:
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __GSD_THUMBNAIL_CACHE_H
+#define __GSD_THUMBNAIL_CACHE_H
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+#define GSD_TYPE_THUMBNAIL_CACHE (gsd_thumbnail_cache_get_type ())
+G_DECLARE_FINAL_TYPE (GsdThumbnailCache, gsd_thumbnail_cache, GSD, THUMBNAIL_CACHE, GObject)
+
+GsdThumbnailCache *gsd_thumbnail_cache_new          (void);
+void               gsd_thumbnail_cache_save         (GsdThumbnailCache    *cache);
+
+/* A negative max_age (seconds) or max_size (bytes) disables that limit */
+void               gsd_thumbnail_cache_purge_async  (GsdThumbnailCache    *cache,
+                                                     glong                 max_age,
+                                                     goffset               max_size,
+                                                     GCancellable         *cancellable,
+                                                     GAsyncReadyCallback   callback,
+                                                     gpointer              user_data);
+gboolean           gsd_thumbnail_cache_purge_finish (GsdThumbnailCache    *cache,
+                                                     GAsyncResult         *result,
+                                                     GError              **error);
+gboolean           gsd_thumbnail_cache_purge        (GsdThumbnailCache    *cache,
+                                                     glong                 max_age,
+                                                     goffset               max_size,
+                                                     GCancellable         *cancellable,
+                                                     GError              **error);
+
+G_END_DECLS
+
+#endif /* __GSD_THUMBNAIL_CACHE_H */
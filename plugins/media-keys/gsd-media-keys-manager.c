@@ -44,6 +44,7 @@
 
 #ifdef HAVE_GUDEV
 #include <gudev/gudev.h>
+#include <gdk/gdkx.h>
 #endif
 
 #include "mpris-controller.h"
@@ -63,6 +64,7 @@
 #include <pulse/pulseaudio.h>
 #include "gvc-mixer-control.h"
 #include "gvc-mixer-sink.h"
+#include "gvc-mixer-source.h"
 
 #define GSD_DBUS_PATH "/org/gnome/SettingsDaemon"
 #define GSD_DBUS_NAME "org.gnome.SettingsDaemon"
@@ -81,6 +83,8 @@
 #define CUSTOM_BINDING_SCHEMA SETTINGS_BINDING_DIR ".custom-keybinding"
 
 #define SHELL_GRABBER_RETRY_INTERVAL 1
+#define FRAME_INTERVAL_MS 16 /* at most one OSD update per frame */
+#define KEY_LATENCY_N_BUCKETS 24 /* log2 buckets in usecs, last one is open-ended */
 #define OSD_ALL_OUTPUTS -1
 
 static const gchar introspection_xml[] =
@@ -94,6 +98,9 @@ static const gchar introspection_xml[] =
 "    <method name='ReleaseMediaPlayerKeys'>"
 "      <arg name='application' direction='in' type='s'/>"
 "    </method>"
+"    <method name='GetKeyLatencies'>"
+"      <arg name='latencies' direction='out' type='a{s(tttat)}'/>"
+"    </method>"
 "    <signal name='MediaPlayerKeyPressed'>"
 "      <arg name='application' type='s'/>"
 "      <arg name='key' type='s'/>"
@@ -129,6 +136,13 @@ typedef struct {
         guint   watch_id;
 } MediaPlayer;
 
+typedef struct {
+        guint64 count;
+        guint64 total_us;
+        guint64 max_us;
+        guint64 buckets[KEY_LATENCY_N_BUCKETS];
+} KeyLatency;
+
 typedef struct {
         gint ref_count;
 
@@ -139,14 +153,22 @@ typedef struct {
         char *custom_path;
         char *custom_command;
         guint accel_id;
-        gboolean ungrab_requested;
+        char *grabbed_binding;
+        gboolean grab_pending;
+        KeyLatency *latency;
 } MediaKey;
 
 typedef struct {
         GsdMediaKeysManager *manager;
-        MediaKey *key;
+        GPtrArray *keys;
+        GPtrArray *bindings;
 } GrabData;
 
+typedef struct {
+        guint    in_flight;
+        gint     steps;   /* repeats folded in while calls were in flight */
+} BrightnessRequest;
+
 struct GsdMediaKeysManagerPrivate
 {
         /* Volume bits */
@@ -156,8 +178,14 @@ struct GsdMediaKeysManagerPrivate
         ca_context      *ca;
         GtkSettings     *gtksettings;
 #ifdef HAVE_GUDEV
-        GHashTable      *streams; /* key = X device ID, value = stream id */
+        GHashTable      *streams; /* key = X device ID, value = sink id */
+        GHashTable      *source_streams; /* key = X device ID, value = source id */
+        GHashTable      *device_parents; /* key = X device ID, value = USB device sysfs path */
+        GHashTable      *stream_parents; /* key = stream id, value = USB device sysfs path */
         GUdevClient     *udev_client;
+        GdkDeviceManager *device_manager;
+        guint            device_added_id;
+        guint            device_removed_id;
 #endif /* HAVE_GUDEV */
         guint            audio_selection_watch_id;
         guint            audio_selection_signal_id;
@@ -169,6 +197,24 @@ struct GsdMediaKeysManagerPrivate
         GHashTable      *custom_settings;
 
         GPtrArray       *keys;
+        GHashTable      *keys_by_accel; /* key = accel id, value = MediaKey */
+
+        /* Dispatch latencies */
+        GHashTable      *key_latencies; /* key = key string, value = KeyLatency */
+        KeyLatency      *latency_pending;
+        gint64           latency_start;
+
+        /* Auto-repeat coalescing */
+        guint            frame_id;
+        gint64           last_osd_time;
+        gboolean         osd_pending;
+        char            *osd_icon;
+        char            *osd_label;
+        int              osd_level;
+        int              osd_output_id;
+        GvcMixerStream  *volume_push_stream;
+        BrightnessRequest screen_brightness;
+        BrightnessRequest keyboard_brightness;
 
         /* HighContrast theme settings */
         GSettings       *interface_settings;
@@ -187,8 +233,8 @@ struct GsdMediaKeysManagerPrivate
         GsdShell        *shell_proxy;
         ShellKeyGrabber *key_grabber;
         GCancellable    *grab_cancellable;
-        GHashTable      *keys_pending_grab;
-        GHashTable      *keys_to_grab;
+        GHashTable      *grab_changes; /* key = MediaKey, value = whether to grab */
+        guint            grab_flush_id;
 
         /* ScreenSaver stuff */
         GsdScreenSaver  *screen_saver_proxy;
@@ -234,6 +280,7 @@ static void     custom_binding_changed             (GSettings           *setting
                                                     const char          *settings_key,
                                                     GsdMediaKeysManager *manager);
 static void     grab_media_keys                    (GsdMediaKeysManager *manager);
+static void     flush_grabs                        (GsdMediaKeysManager *manager);
 static void     grab_media_key                     (MediaKey            *key,
                                                     GsdMediaKeysManager *manager);
 static void     ungrab_media_key                   (MediaKey            *key,
@@ -252,6 +299,7 @@ media_key_unref (MediaKey *key)
                 return;
         g_free (key->custom_path);
         g_free (key->custom_command);
+        g_free (key->grabbed_binding);
         g_free (key);
 }
 
@@ -359,6 +407,165 @@ ensure_cancellable (GCancellable **cancellable)
         }
 }
 
+static void
+media_key_set_accel_id (GsdMediaKeysManager *manager,
+                        MediaKey            *key,
+                        guint                accel_id)
+{
+        GHashTable *keys_by_accel = manager->priv->keys_by_accel;
+
+        if (key->accel_id != 0 && keys_by_accel != NULL &&
+            g_hash_table_lookup (keys_by_accel, GUINT_TO_POINTER (key->accel_id)) == key)
+                g_hash_table_remove (keys_by_accel, GUINT_TO_POINTER (key->accel_id));
+
+        key->accel_id = accel_id;
+
+        if (accel_id != 0 && keys_by_accel != NULL)
+                g_hash_table_insert (keys_by_accel,
+                                     GUINT_TO_POINTER (accel_id),
+                                     media_key_ref (key));
+}
+
+static void
+key_latency_begin (GsdMediaKeysManager *manager,
+                   MediaKey            *key,
+                   gint64               start)
+{
+        GsdMediaKeysManagerPrivate *priv = manager->priv;
+
+        if (key->latency == NULL) {
+                char *keyname;
+
+                keyname = get_key_string (key);
+                key->latency = g_hash_table_lookup (priv->key_latencies, keyname);
+                if (key->latency == NULL) {
+                        key->latency = g_new0 (KeyLatency, 1);
+                        g_hash_table_insert (priv->key_latencies, keyname, key->latency);
+                } else {
+                        g_free (keyname);
+                }
+        }
+
+        /* an asynchronous action that never showed its OSD is dropped */
+        priv->latency_pending = key->latency;
+        priv->latency_start = start;
+}
+
+static void
+key_latency_end (GsdMediaKeysManager *manager)
+{
+        GsdMediaKeysManagerPrivate *priv = manager->priv;
+        KeyLatency *latency = priv->latency_pending;
+        guint64 elapsed;
+        guint bucket;
+
+        if (latency == NULL)
+                return;
+
+        /* bucket n holds [2^(n-1), 2^n) usecs */
+        elapsed = MAX (g_get_monotonic_time () - priv->latency_start, 0);
+        bucket = elapsed == 0 ? 0 : MIN (g_bit_storage (elapsed), KEY_LATENCY_N_BUCKETS - 1);
+
+        latency->count++;
+        latency->total_us += elapsed;
+        latency->max_us = MAX (latency->max_us, elapsed);
+        latency->buckets[bucket]++;
+
+        priv->latency_pending = NULL;
+}
+
+static GVariant *
+key_latencies_to_variant (GsdMediaKeysManager *manager)
+{
+        GVariantBuilder builder;
+        GHashTableIter iter;
+        gpointer keyname, value;
+
+        g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{s(tttat)}"));
+
+        if (manager->priv->key_latencies == NULL)
+                goto out;
+
+        g_hash_table_iter_init (&iter, manager->priv->key_latencies);
+        while (g_hash_table_iter_next (&iter, &keyname, &value)) {
+                KeyLatency *latency = value;
+                GVariant *buckets;
+
+                buckets = g_variant_new_fixed_array (G_VARIANT_TYPE_UINT64,
+                                                     latency->buckets,
+                                                     KEY_LATENCY_N_BUCKETS,
+                                                     sizeof (guint64));
+                g_variant_builder_add (&builder, "{s(ttt@at)}",
+                                       keyname,
+                                       latency->count,
+                                       latency->total_us,
+                                       latency->max_us,
+                                       buckets);
+        }
+out:
+        return g_variant_new ("(a{s(tttat)})", &builder);
+}
+
+static void
+send_pending_osd (GsdMediaKeysManager *manager)
+{
+        GsdMediaKeysManagerPrivate *priv = manager->priv;
+
+        if (!priv->osd_pending)
+                return;
+
+        priv->osd_pending = FALSE;
+        priv->last_osd_time = g_get_monotonic_time ();
+
+        if (priv->shell_proxy != NULL)
+                shell_show_osd (priv->shell_proxy,
+                                priv->osd_icon, priv->osd_label,
+                                priv->osd_level, priv->osd_output_id);
+}
+
+static void
+push_pending_volume (GsdMediaKeysManager *manager)
+{
+        GsdMediaKeysManagerPrivate *priv = manager->priv;
+
+        if (priv->volume_push_stream == NULL)
+                return;
+
+        gvc_mixer_stream_push_volume (priv->volume_push_stream);
+        g_clear_object (&priv->volume_push_stream);
+}
+
+static gboolean
+frame_cb (gpointer user_data)
+{
+        GsdMediaKeysManager *manager = user_data;
+        GsdMediaKeysManagerPrivate *priv = manager->priv;
+
+        send_pending_osd (manager);
+
+        /* keep folding volume steps until PulseAudio caught up */
+        if (priv->volume_push_stream != NULL &&
+            !gvc_mixer_stream_is_running (priv->volume_push_stream))
+                push_pending_volume (manager);
+
+        if (priv->volume_push_stream != NULL)
+                return TRUE;
+
+        priv->frame_id = 0;
+        return FALSE;
+}
+
+static void
+ensure_frame (GsdMediaKeysManager *manager)
+{
+        if (manager->priv->frame_id != 0)
+                return;
+
+        manager->priv->frame_id = g_timeout_add (FRAME_INTERVAL_MS, frame_cb, manager);
+        g_source_set_name_by_id (manager->priv->frame_id,
+                                 "[gnome-settings-daemon] frame_cb");
+}
+
 static void
 show_osd (GsdMediaKeysManager *manager,
           const char          *icon,
@@ -366,11 +573,28 @@ show_osd (GsdMediaKeysManager *manager,
           int                  level,
           int                  output_id)
 {
-        if (manager->priv->shell_proxy == NULL)
+        GsdMediaKeysManagerPrivate *priv = manager->priv;
+
+        key_latency_end (manager);
+
+        if (priv->shell_proxy == NULL)
                 return;
 
-        shell_show_osd (manager->priv->shell_proxy,
-                        icon, label, level, output_id);
+        /* Only the latest state matters to the user, so updates that
+         * come in faster than the frame rate replace each other */
+        g_free (priv->osd_icon);
+        g_free (priv->osd_label);
+        priv->osd_icon = g_strdup (icon);
+        priv->osd_label = g_strdup (label);
+        priv->osd_level = level;
+        priv->osd_output_id = output_id;
+        priv->osd_pending = TRUE;
+
+        if (priv->frame_id == 0 &&
+            g_get_monotonic_time () - priv->last_osd_time >= FRAME_INTERVAL_MS * 1000)
+                send_pending_osd (manager);
+        else
+                ensure_frame (manager);
 }
 
 static const char *
@@ -418,10 +642,50 @@ retry_grabs (gpointer data)
         GsdMediaKeysManager *manager = data;
 
         g_debug ("Retrying to grab accelerators");
-        grab_media_keys (manager);
+        flush_grabs (manager);
         return FALSE;
 }
 
+static gboolean
+flush_grabs_cb (gpointer data)
+{
+        GsdMediaKeysManager *manager = data;
+
+        manager->priv->grab_flush_id = 0;
+        flush_grabs (manager);
+        return FALSE;
+}
+
+static void
+schedule_grab_flush (GsdMediaKeysManager *manager)
+{
+        if (manager->priv->grab_flush_id != 0)
+                return;
+
+        manager->priv->grab_flush_id = g_idle_add (flush_grabs_cb, manager);
+        g_source_set_name_by_id (manager->priv->grab_flush_id,
+                                 "[gnome-settings-daemon] flush_grabs_cb");
+}
+
+static void
+queue_grab_change (GsdMediaKeysManager *manager,
+                   MediaKey            *key,
+                   gboolean             grab)
+{
+        /* the last request for a key wins */
+        g_hash_table_insert (manager->priv->grab_changes,
+                             media_key_ref (key),
+                             GINT_TO_POINTER (grab));
+}
+
+static void
+grab_data_free (GrabData *data)
+{
+        g_ptr_array_unref (data->keys);
+        g_ptr_array_unref (data->bindings);
+        g_slice_free (GrabData, data);
+}
+
 static void
 grab_accelerators_complete (GObject      *object,
                             GAsyncResult *result,
@@ -430,26 +694,51 @@ grab_accelerators_complete (GObject      *object,
         GVariant *actions;
         gboolean retry = FALSE;
         GError *error = NULL;
-        GsdMediaKeysManager *manager = user_data;
+        GrabData *data = user_data;
+        GsdMediaKeysManager *manager = data->manager;
+        guint i;
 
         shell_key_grabber_call_grab_accelerators_finish (SHELL_KEY_GRABBER (object),
                                                          &actions, result, &error);
 
-        if (error) {
+        if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+                /* the manager may be gone already */
+                g_error_free (error);
+                grab_data_free (data);
+                return;
+        }
+
+        if (error)
                 retry = (error->code == G_DBUS_ERROR_UNKNOWN_METHOD);
-                if (!retry && !g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+
+        for (i = 0; i < data->keys->len; i++) {
+                MediaKey *key = g_ptr_array_index (data->keys, i);
+                guint accel_id;
+
+                key->grab_pending = FALSE;
+
+                if (error != NULL) {
+                        /* try again later, unless something else was
+                         * requested for the key in the meantime */
+                        if (retry && !g_hash_table_contains (manager->priv->grab_changes, key))
+                                queue_grab_change (manager, key, TRUE);
+                        continue;
+                }
+
+                g_variant_get_child (actions, i, "u", &accel_id);
+                media_key_set_accel_id (manager, key, accel_id);
+                g_free (key->grabbed_binding);
+                key->grabbed_binding = g_strdup (g_ptr_array_index (data->bindings, i));
+        }
+
+        if (error) {
+                if (!retry)
                         g_warning ("Failed to grab accelerators: %s (%d)", error->message, error->code);
-                else if (retry)
+                else
                         g_debug ("Failed to grab accelerators, will retry: %s (%d)", error->message, error->code);
                 g_error_free (error);
         } else {
-                int i;
-                for (i = 0; i < manager->priv->keys->len; i++) {
-                        MediaKey *key;
-
-                        key = g_ptr_array_index (manager->priv->keys, i);
-                        g_variant_get_child (actions, i, "u", &key->accel_id);
-                }
+                g_variant_unref (actions);
         }
 
         if (retry) {
@@ -457,144 +746,195 @@ grab_accelerators_complete (GObject      *object,
                 id = g_timeout_add_seconds (SHELL_GRABBER_RETRY_INTERVAL,
                                             retry_grabs, manager);
                 g_source_set_name_by_id (id, "[gnome-settings-daemon] retry_grabs");
+        } else if (g_hash_table_size (manager->priv->grab_changes) > 0) {
+                /* changes that arrived while this batch was in flight */
+                schedule_grab_flush (manager);
         }
+
+        grab_data_free (data);
 }
 
 static void
-grab_media_keys (GsdMediaKeysManager *manager)
+ungrab_accelerator_complete (GObject      *object,
+                             GAsyncResult *result,
+                             gpointer      user_data)
 {
-        GVariantBuilder builder;
-        int i;
+        GError *error = NULL;
 
-        g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(su)"));
+        if (!shell_key_grabber_call_ungrab_accelerator_finish (SHELL_KEY_GRABBER (object),
+                                                               NULL, result, &error)) {
+                if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+                        g_warning ("Failed to ungrab accelerator: %s", error->message);
+                g_error_free (error);
+        }
+}
 
-        for (i = 0; i < manager->priv->keys->len; i++) {
-                MediaKey *key;
-                char *tmp;
+static void
+ungrab_accelerators_complete (GObject      *object,
+                              GAsyncResult *result,
+                              gpointer      user_data)
+{
+        GArray *accel_ids = user_data;
+        GError *error = NULL;
+        guint i;
 
-                key = g_ptr_array_index (manager->priv->keys, i);
-                tmp = get_binding (manager, key);
-                g_variant_builder_add (&builder, "(su)", tmp, key->modes);
-                g_free (tmp);
-        }
+        if (shell_key_grabber_call_ungrab_accelerators_finish (SHELL_KEY_GRABBER (object),
+                                                               NULL, result, &error))
+                goto out;
 
-	shell_key_grabber_call_grab_accelerators (manager->priv->key_grabber,
-	                                          g_variant_builder_end (&builder),
-	                                          manager->priv->grab_cancellable,
-	                                          grab_accelerators_complete,
-	                                          manager);
+        if (g_error_matches (error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD)) {
+                /* older shells can only ungrab one accelerator at a time */
+                for (i = 0; i < accel_ids->len; i++)
+                        shell_key_grabber_call_ungrab_accelerator (SHELL_KEY_GRABBER (object),
+                                                                   g_array_index (accel_ids, guint, i),
+                                                                   NULL,
+                                                                   ungrab_accelerator_complete,
+                                                                   NULL);
+        } else if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+                g_warning ("Failed to ungrab accelerators: %s", error->message);
+        }
+        g_error_free (error);
+ out:
+        g_array_unref (accel_ids);
 }
 
+/* Turns the grab and ungrab requests queued since the last flush into at
+ * most one GrabAccelerators and one UngrabAccelerators call. Keys whose
+ * binding did not change are left alone, and keys with a grab in flight
+ * are kept queued until it completes. */
 static void
-grab_accelerator_complete (GObject      *object,
-                           GAsyncResult *result,
-                           gpointer      user_data)
+flush_grabs (GsdMediaKeysManager *manager)
 {
-        char *keyname;
-        GrabData *data = user_data;
-        MediaKey *key = data->key;
-        GsdMediaKeysManager *manager = data->manager;
-        GError *error = NULL;
+        GsdMediaKeysManagerPrivate *priv = manager->priv;
+        GHashTableIter iter;
+        gpointer k, v;
+        GArray *accel_ids;
+        GVariantBuilder builder;
+        GrabData *data;
+        guint i;
 
-        if (!shell_key_grabber_call_grab_accelerator_finish (SHELL_KEY_GRABBER (object),
-                                                             &key->accel_id, result, &error)) {
-                if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
-                        g_warning ("Failed to grab accelerator: %s", error->message);
-                g_error_free (error);
+        if (priv->grab_flush_id != 0) {
+                g_source_remove (priv->grab_flush_id);
+                priv->grab_flush_id = 0;
         }
 
-        keyname = get_key_string (key);
-        g_hash_table_remove (manager->priv->keys_pending_grab, keyname);
+        if (priv->key_grabber == NULL || priv->grab_changes == NULL)
+                return;
 
-        if (key->ungrab_requested)
-                ungrab_media_key (key, manager);
+        accel_ids = g_array_new (FALSE, FALSE, sizeof (guint));
 
-        media_key_unref (key);
-        g_slice_free (GrabData, data);
+        /* Drop the grabs that are going away or changing */
+        g_hash_table_iter_init (&iter, priv->grab_changes);
+        while (g_hash_table_iter_next (&iter, &k, &v)) {
+                MediaKey *key = k;
+                gboolean grab = GPOINTER_TO_INT (v);
 
-        if ((key = g_hash_table_lookup (manager->priv->keys_to_grab, keyname)) != NULL) {
-                grab_media_key (key, manager);
-                g_hash_table_remove (manager->priv->keys_to_grab, keyname);
+                if (key->grab_pending)
+                        continue;
+
+                if (grab && key->accel_id != 0) {
+                        char *binding;
+                        gboolean unchanged;
+
+                        binding = get_binding (manager, key);
+                        unchanged = g_strcmp0 (binding, key->grabbed_binding) == 0;
+                        g_free (binding);
+
+                        if (unchanged) {
+                                g_hash_table_iter_remove (&iter);
+                                continue;
+                        }
+                }
+
+                if (key->accel_id != 0) {
+                        g_array_append_val (accel_ids, key->accel_id);
+                        media_key_set_accel_id (manager, key, 0);
+                        g_clear_pointer (&key->grabbed_binding, g_free);
+                }
+
+                if (!grab)
+                        g_hash_table_iter_remove (&iter);
         }
-        g_free (keyname);
 
-}
+        if (accel_ids->len > 0) {
+                g_debug ("Ungrabbing %u accelerators", accel_ids->len);
+                shell_key_grabber_call_ungrab_accelerators (priv->key_grabber,
+                                                            g_variant_new_fixed_array (G_VARIANT_TYPE_UINT32,
+                                                                                       accel_ids->data,
+                                                                                       accel_ids->len,
+                                                                                       sizeof (guint)),
+                                                            priv->grab_cancellable,
+                                                            ungrab_accelerators_complete,
+                                                            g_array_ref (accel_ids));
+        }
+        g_array_unref (accel_ids);
 
-static void
-grab_media_key (MediaKey            *key,
-		GsdMediaKeysManager *manager)
-{
-	GrabData *data;
-	char *binding, *keyname;
+        /* Grab in the order of the keys array, so that hard-coded
+         * shortcuts cannot be preempted */
+        data = g_slice_new0 (GrabData);
+        data->manager = manager;
+        data->keys = g_ptr_array_new_with_free_func ((GDestroyNotify) media_key_unref);
+        data->bindings = g_ptr_array_new_with_free_func (g_free);
 
-	keyname = get_key_string (key);
-	binding = get_binding (manager, key);
-        if (g_hash_table_lookup (manager->priv->keys_pending_grab, keyname)) {
-                g_hash_table_insert (manager->priv->keys_to_grab,
-                                     g_strdup (keyname), media_key_ref (key));
-                goto out;
+        g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(su)"));
+
+        for (i = 0; priv->keys != NULL && i < priv->keys->len; i++) {
+                MediaKey *key;
+                char *binding;
+
+                key = g_ptr_array_index (priv->keys, i);
+                if (key->grab_pending ||
+                    !GPOINTER_TO_INT (g_hash_table_lookup (priv->grab_changes, key)))
+                        continue;
+
+                binding = get_binding (manager, key);
+                g_variant_builder_add (&builder, "(su)", binding, key->modes);
+                g_ptr_array_add (data->bindings, binding);
+                g_ptr_array_add (data->keys, media_key_ref (key));
+                key->grab_pending = TRUE;
+
+                g_hash_table_remove (priv->grab_changes, key);
         }
 
-	data = g_slice_new0 (GrabData);
-	data->manager = manager;
-	data->key = media_key_ref (key);
+        if (data->keys->len == 0) {
+                g_variant_builder_clear (&builder);
+                grab_data_free (data);
+                return;
+        }
 
-	shell_key_grabber_call_grab_accelerator (manager->priv->key_grabber,
-	                                         binding, key->modes,
-	                                         manager->priv->grab_cancellable,
-	                                         grab_accelerator_complete,
-	                                         data);
-        g_hash_table_add (manager->priv->keys_pending_grab, g_strdup (keyname));
- out:
-	g_free (keyname);
-	g_free (binding);
+        g_debug ("Grabbing %u accelerators", data->keys->len);
+        shell_key_grabber_call_grab_accelerators (priv->key_grabber,
+                                                  g_variant_builder_end (&builder),
+                                                  priv->grab_cancellable,
+                                                  grab_accelerators_complete,
+                                                  data);
 }
 
 static void
-ungrab_accelerator_complete (GObject      *object,
-                             GAsyncResult *result,
-                             gpointer      user_data)
+grab_media_keys (GsdMediaKeysManager *manager)
 {
-        GError *error = NULL;
+        int i;
 
-        if (!shell_key_grabber_call_ungrab_accelerator_finish (SHELL_KEY_GRABBER (object),
-                                                               NULL, result, &error)) {
-                if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
-                        g_warning ("Failed to ungrab accelerator: %s", error->message);
-                g_error_free (error);
-        }
+        for (i = 0; i < manager->priv->keys->len; i++)
+                queue_grab_change (manager, g_ptr_array_index (manager->priv->keys, i), TRUE);
+
+        flush_grabs (manager);
 }
 
-static gboolean
-is_pending_grab (MediaKey            *key,
-                 GsdMediaKeysManager *manager)
+static void
+grab_media_key (MediaKey            *key,
+		GsdMediaKeysManager *manager)
 {
-	char *keyname = get_key_string (key);
-	const char *val;
-	gboolean pending_grab;
-
-	val = g_hash_table_lookup (manager->priv->keys_pending_grab, keyname);
-	pending_grab = val != NULL;
-	g_free (keyname);
-
-	return pending_grab;
+        queue_grab_change (manager, key, TRUE);
+        schedule_grab_flush (manager);
 }
 
 static void
 ungrab_media_key (MediaKey            *key,
                   GsdMediaKeysManager *manager)
 {
-        if (key->accel_id == 0) {
-                key->ungrab_requested = is_pending_grab (key, manager);
-                return;
-        }
-
-	shell_key_grabber_call_ungrab_accelerator (manager->priv->key_grabber,
-	                                           key->accel_id,
-	                                           manager->priv->grab_cancellable,
-	                                           ungrab_accelerator_complete,
-	                                           manager);
-	key->accel_id = 0;
+        queue_grab_change (manager, key, FALSE);
+        schedule_grab_flush (manager);
 }
 
 static void
@@ -1199,24 +1539,28 @@ get_udev_device_for_sysfs_path (GsdMediaKeysManager *manager,
 	return dev;
 }
 
-static GvcMixerStream *
-get_stream_for_device_id (GsdMediaKeysManager *manager,
-			  gboolean             is_output,
-			  guint                deviceid)
+static char *
+get_usb_parent_path (GUdevDevice *dev)
 {
-	char *devnode;
-	gpointer id_ptr;
-	GvcMixerStream *res;
-	GUdevDevice *dev, *parent;
-	GSList *streams, *l;
-
-	id_ptr = g_hash_table_lookup (manager->priv->streams, GUINT_TO_POINTER (deviceid));
-	if (id_ptr != NULL) {
-		if (GPOINTER_TO_UINT (id_ptr) == (guint) -1)
-			return NULL;
-		else
-			return gvc_mixer_control_lookup_stream_id (manager->priv->volume, GPOINTER_TO_UINT (id_ptr));
-	}
+	GUdevDevice *parent;
+	char *path;
+
+	parent = g_udev_device_get_parent_with_subsystem (dev, "usb", "usb_device");
+	if (parent == NULL)
+		return NULL;
+
+	path = g_strdup (g_udev_device_get_sysfs_path (parent));
+	g_object_unref (parent);
+
+	return path;
+}
+
+static char *
+get_usb_parent_path_for_device_id (GsdMediaKeysManager *manager,
+				   guint                deviceid)
+{
+	char *devnode, *path;
+	GUdevDevice *dev;
 
 	devnode = xdevice_get_device_node (deviceid);
 	if (devnode == NULL) {
@@ -1234,60 +1578,157 @@ get_stream_for_device_id (GsdMediaKeysManager *manager,
 
 	if (g_strcmp0 (g_udev_device_get_property (dev, "ID_BUS"), "usb") != 0) {
 		g_debug ("Not handling XInput device %d, not USB", deviceid);
-		g_hash_table_insert (manager->priv->streams,
-				     GUINT_TO_POINTER (deviceid),
-				     GUINT_TO_POINTER ((guint) -1));
 		g_object_unref (dev);
 		return NULL;
 	}
 
-	parent = g_udev_device_get_parent_with_subsystem (dev, "usb", "usb_device");
-	if (parent == NULL) {
+	path = get_usb_parent_path (dev);
+	if (path == NULL)
 		g_warning ("No USB device parent for XInput device %d even though it's USB", deviceid);
-		g_object_unref (dev);
+	g_object_unref (dev);
+
+	return path;
+}
+
+static char *
+get_usb_parent_path_for_stream (GsdMediaKeysManager *manager,
+				GvcMixerStream      *stream)
+{
+	const char *sysfs_path;
+	GUdevDevice *dev;
+	char *path;
+
+	sysfs_path = gvc_mixer_stream_get_sysfs_path (stream);
+	if (sysfs_path == NULL)
 		return NULL;
-	}
 
-	res = NULL;
-	if (is_output)
-		streams = gvc_mixer_control_get_sinks (manager->priv->volume);
-	else
-		streams = gvc_mixer_control_get_sources (manager->priv->volume);
-	for (l = streams; l; l = l->next) {
-		GvcMixerStream *stream = l->data;
-		const char *sysfs_path;
-		GUdevDevice *stream_dev, *stream_parent;
-
-		sysfs_path = gvc_mixer_stream_get_sysfs_path (stream);
-		stream_dev = get_udev_device_for_sysfs_path (manager, sysfs_path);
-		if (stream_dev == NULL)
-			continue;
-		stream_parent = g_udev_device_get_parent_with_subsystem (stream_dev, "usb", "usb_device");
-		g_object_unref (stream_dev);
-		if (stream_parent == NULL)
-			continue;
-
-		if (g_strcmp0 (g_udev_device_get_sysfs_path (stream_parent),
-			       g_udev_device_get_sysfs_path (parent)) == 0) {
-			res = stream;
+	dev = get_udev_device_for_sysfs_path (manager, sysfs_path);
+	if (dev == NULL)
+		return NULL;
+
+	path = get_usb_parent_path (dev);
+	g_object_unref (dev);
+
+	return path;
+}
+
+/* Matches the USB parents of the input devices and of the streams,
+ * both already known, so that no lookups are needed on key press */
+static void
+update_device_streams (GsdMediaKeysManager *manager)
+{
+	GsdMediaKeysManagerPrivate *priv = manager->priv;
+	GHashTableIter device_iter, stream_iter;
+	gpointer deviceid, device_path, id, stream_path;
+
+	g_hash_table_remove_all (priv->streams);
+	g_hash_table_remove_all (priv->source_streams);
+
+	g_hash_table_iter_init (&device_iter, priv->device_parents);
+	while (g_hash_table_iter_next (&device_iter, &deviceid, &device_path)) {
+		g_hash_table_iter_init (&stream_iter, priv->stream_parents);
+		while (g_hash_table_iter_next (&stream_iter, &id, &stream_path)) {
+			GvcMixerStream *stream;
+			GHashTable *table;
+
+			if (g_strcmp0 (device_path, stream_path) != 0)
+				continue;
+
+			stream = gvc_mixer_control_lookup_stream_id (priv->volume,
+								     GPOINTER_TO_UINT (id));
+			if (stream == NULL)
+				continue;
+
+			table = GVC_IS_MIXER_SINK (stream) ? priv->streams : priv->source_streams;
+			if (g_hash_table_contains (table, deviceid))
+				continue;
+
+			g_debug ("XInput device %u controls stream %u",
+				 GPOINTER_TO_UINT (deviceid), GPOINTER_TO_UINT (id));
+			g_hash_table_insert (table, deviceid, id);
 		}
-		g_object_unref (stream_parent);
-		if (res != NULL)
-			break;
 	}
+}
 
-	g_slist_free (streams);
+static void
+add_device_stream_device (GsdMediaKeysManager *manager,
+			  GdkDevice           *device)
+{
+	guint deviceid;
+	char *path;
 
-	if (res)
-		g_hash_table_insert (manager->priv->streams,
-				     GUINT_TO_POINTER (deviceid),
-				     GUINT_TO_POINTER (gvc_mixer_stream_get_id (res)));
-	else
-		g_hash_table_insert (manager->priv->streams,
-				     GUINT_TO_POINTER (deviceid),
-				     GUINT_TO_POINTER ((guint) -1));
+	if (gdk_device_get_device_type (device) == GDK_DEVICE_TYPE_MASTER ||
+	    gdk_device_get_source (device) != GDK_SOURCE_KEYBOARD)
+		return;
+
+	deviceid = gdk_x11_device_get_id (device);
+	path = get_usb_parent_path_for_device_id (manager, deviceid);
+	if (path == NULL)
+		return;
+
+	g_hash_table_insert (manager->priv->device_parents,
+			     GUINT_TO_POINTER (deviceid), path);
+}
+
+static void
+device_added_cb (GdkDeviceManager    *device_manager,
+		 GdkDevice           *device,
+		 GsdMediaKeysManager *manager)
+{
+	add_device_stream_device (manager, device);
+	update_device_streams (manager);
+}
+
+static void
+device_removed_cb (GdkDeviceManager    *device_manager,
+		   GdkDevice           *device,
+		   GsdMediaKeysManager *manager)
+{
+	if (g_hash_table_remove (manager->priv->device_parents,
+				 GUINT_TO_POINTER (gdk_x11_device_get_id (device))))
+		update_device_streams (manager);
+}
 
-	return res;
+static void
+init_device_streams (GsdMediaKeysManager *manager)
+{
+	GsdMediaKeysManagerPrivate *priv = manager->priv;
+	GList *devices, *l;
+
+	if (gnome_settings_is_wayland ())
+		return;
+
+	priv->device_manager = gdk_display_get_device_manager (gdk_display_get_default ());
+	priv->device_added_id = g_signal_connect (G_OBJECT (priv->device_manager), "device-added",
+						  G_CALLBACK (device_added_cb), manager);
+	priv->device_removed_id = g_signal_connect (G_OBJECT (priv->device_manager), "device-removed",
+						    G_CALLBACK (device_removed_cb), manager);
+
+	devices = gdk_device_manager_list_devices (priv->device_manager, GDK_DEVICE_TYPE_SLAVE);
+	devices = g_list_concat (devices,
+				 gdk_device_manager_list_devices (priv->device_manager,
+								  GDK_DEVICE_TYPE_FLOATING));
+	for (l = devices; l != NULL; l = l->next)
+		add_device_stream_device (manager, l->data);
+	g_list_free (devices);
+
+	update_device_streams (manager);
+}
+
+static GvcMixerStream *
+get_stream_for_device_id (GsdMediaKeysManager *manager,
+			  gboolean             is_output,
+			  guint                deviceid)
+{
+	GHashTable *table;
+	gpointer id_ptr;
+
+	table = is_output ? manager->priv->streams : manager->priv->source_streams;
+	if (!g_hash_table_lookup_extended (table, GUINT_TO_POINTER (deviceid), NULL, &id_ptr))
+		return NULL;
+
+	return gvc_mixer_control_lookup_stream_id (manager->priv->volume,
+						   GPOINTER_TO_UINT (id_ptr));
 }
 #endif /* HAVE_GUDEV */
 
@@ -1297,6 +1738,29 @@ typedef enum {
 	SOUND_ACTION_FLAG_IS_PRECISE = 1 << 2,
 } SoundActionFlags;
 
+/* The new volume is already set on the stream, so while an earlier
+ * change is still on its way to PulseAudio, repeats only need to push
+ * their cumulative result once it is done. */
+static void
+queue_volume_push (GsdMediaKeysManager *manager,
+                   GvcMixerStream      *stream)
+{
+        GsdMediaKeysManagerPrivate *priv = manager->priv;
+
+        if (priv->volume_push_stream == stream)
+                return;
+
+        push_pending_volume (manager);
+
+        if (!gvc_mixer_stream_is_running (stream)) {
+                gvc_mixer_stream_push_volume (stream);
+                return;
+        }
+
+        priv->volume_push_stream = g_object_ref (stream);
+        ensure_frame (manager);
+}
+
 static void
 do_sound_action (GsdMediaKeysManager *manager,
 		 guint                deviceid,
@@ -1363,7 +1827,7 @@ do_sound_action (GsdMediaKeysManager *manager,
 
         if (old_vol != new_vol) {
                 if (gvc_mixer_stream_set_volume (stream, new_vol) != FALSE) {
-                        gvc_mixer_stream_push_volume (stream);
+                        queue_volume_push (manager, stream);
                         sound_changed = TRUE;
                 }
         }
@@ -1433,17 +1897,28 @@ on_control_default_source_changed (GvcMixerControl     *control,
         update_default_source (manager);
 }
 
-#ifdef HAVE_GUDEV
-static gboolean
-remove_stream (gpointer key,
-	       gpointer value,
-	       gpointer id)
+static void
+on_control_stream_added (GvcMixerControl     *control,
+                         guint                id,
+                         GsdMediaKeysManager *manager)
 {
-	if (GPOINTER_TO_UINT (value) == GPOINTER_TO_UINT (id))
-		return TRUE;
-	return FALSE;
-}
+#ifdef HAVE_GUDEV
+        GvcMixerStream *stream;
+        char *path;
+
+        stream = gvc_mixer_control_lookup_stream_id (control, id);
+        if (stream == NULL ||
+            !(GVC_IS_MIXER_SINK (stream) || GVC_IS_MIXER_SOURCE (stream)))
+                return;
+
+        path = get_usb_parent_path_for_stream (manager, stream);
+        if (path == NULL)
+                return;
+
+        g_hash_table_insert (manager->priv->stream_parents, GUINT_TO_POINTER (id), path);
+        update_device_streams (manager);
 #endif /* HAVE_GUDEV */
+}
 
 static void
 on_control_stream_removed (GvcMixerControl     *control,
@@ -1460,7 +1935,8 @@ on_control_stream_removed (GvcMixerControl     *control,
         }
 
 #ifdef HAVE_GUDEV
-	g_hash_table_foreach_remove (manager->priv->streams, (GHRFunc) remove_stream, GUINT_TO_POINTER (id));
+	if (g_hash_table_remove (manager->priv->stream_parents, GUINT_TO_POINTER (id)))
+		update_device_streams (manager);
 #endif
 }
 
@@ -1674,6 +2150,9 @@ handle_method_call (GDBusConnection       *connection,
                 g_variant_get (parameters, "(&su)", &app_name, &time);
                 gsd_media_keys_manager_grab_media_player_keys (manager, app_name, sender, time);
                 g_dbus_method_invocation_return_value (invocation, NULL);
+        } else if (g_strcmp0 (method_name, "GetKeyLatencies") == 0) {
+                g_dbus_method_invocation_return_value (invocation,
+                                                       key_latencies_to_variant (manager));
         }
 }
 
@@ -1968,6 +2447,56 @@ do_config_power_button_action (GsdMediaKeysManager *manager,
         }
 }
 
+static void call_brightness (GsdMediaKeysManager *manager,
+                             GDBusProxy          *proxy,
+                             const char          *cmd,
+                             GVariant            *parameters);
+
+static BrightnessRequest *
+get_brightness_request (GsdMediaKeysManager *manager,
+                        GDBusProxy          *proxy)
+{
+        if (proxy == manager->priv->power_keyboard_proxy)
+                return &manager->priv->keyboard_brightness;
+        return &manager->priv->screen_brightness;
+}
+
+/* Called whenever a brightness call returned, with the resulting
+ * percentage, or -1 if it failed */
+static void
+brightness_request_done (GsdMediaKeysManager *manager,
+                         GDBusProxy          *proxy,
+                         int                  percentage,
+                         int                  output_id)
+{
+        BrightnessRequest *request;
+        const char *icon;
+        int steps;
+
+        request = get_brightness_request (manager, proxy);
+        request->in_flight--;
+
+        if (percentage >= 0) {
+                if (proxy == manager->priv->power_keyboard_proxy)
+                        icon = "keyboard-brightness-symbolic";
+                else
+                        icon = "display-brightness-symbolic";
+                show_osd (manager, icon, NULL, percentage, output_id);
+        }
+
+        if (request->in_flight > 0 || request->steps == 0)
+                return;
+
+        steps = request->steps;
+        request->steps = 0;
+        if (percentage < 0)
+                return;
+
+        /* Apply the folded repeats in a single call, the power plugin
+         * knows how large a step is for each backlight */
+        call_brightness (manager, proxy, "Step", g_variant_new ("(i)", steps));
+}
+
 static void
 update_brightness_cb (GObject             *source_object,
                       GAsyncResult        *res,
@@ -1977,7 +2506,7 @@ update_brightness_cb (GObject             *source_object,
         int percentage, output_id;
         GVariant *variant;
         GsdMediaKeysManager *manager = GSD_MEDIA_KEYS_MANAGER (user_data);
-        const char *icon, *debug;
+        const char *debug;
 
         /* update the dialog with the new value */
         if (G_DBUS_PROXY (source_object) == manager->priv->power_keyboard_proxy) {
@@ -1993,27 +2522,47 @@ update_brightness_cb (GObject             *source_object,
                         g_warning ("Failed to set new %s percentage: %s",
                                    debug, error->message);
                 g_error_free (error);
+                brightness_request_done (manager, G_DBUS_PROXY (source_object), -1, -1);
                 return;
         }
 
         /* update the dialog with the new value */
         if (G_DBUS_PROXY (source_object) == manager->priv->power_keyboard_proxy) {
-                icon = "keyboard-brightness-symbolic";
                 output_id = -1;
                 g_variant_get (variant, "(i)", &percentage);
         } else {
-                icon = "display-brightness-symbolic";
                 g_variant_get (variant, "(ii)", &percentage, &output_id);
         }
 
-        show_osd (manager, icon, NULL, percentage, output_id);
+        brightness_request_done (manager, G_DBUS_PROXY (source_object),
+                                 percentage, output_id);
         g_variant_unref (variant);
 }
 
+static void
+call_brightness (GsdMediaKeysManager *manager,
+                 GDBusProxy          *proxy,
+                 const char          *cmd,
+                 GVariant            *parameters)
+{
+        get_brightness_request (manager, proxy)->in_flight++;
+
+        /* call into the power plugin */
+        g_dbus_proxy_call (proxy,
+                           cmd,
+                           parameters,
+                           G_DBUS_CALL_FLAGS_NONE,
+                           -1,
+                           NULL,
+                           update_brightness_cb,
+                           manager);
+}
+
 static void
 do_brightness_action (GsdMediaKeysManager *manager,
                       MediaKeyType type)
 {
+        BrightnessRequest *request;
         const char *cmd;
         GDBusProxy *proxy;
 
@@ -2037,6 +2586,8 @@ do_brightness_action (GsdMediaKeysManager *manager,
                 return;
         }
 
+        request = get_brightness_request (manager, proxy);
+
         switch (type) {
         case KEYBOARD_BRIGHTNESS_UP_KEY:
         case SCREEN_BRIGHTNESS_UP_KEY:
@@ -2053,15 +2604,14 @@ do_brightness_action (GsdMediaKeysManager *manager,
                 g_assert_not_reached ();
         }
 
-        /* call into the power plugin */
-        g_dbus_proxy_call (proxy,
-                           cmd,
-                           NULL,
-                           G_DBUS_CALL_FLAGS_NONE,
-                           -1,
-                           NULL,
-                           update_brightness_cb,
-                           manager);
+        /* Key repeats that arrive while the power plugin is still busy
+         * are applied together once it answers */
+        if (request->in_flight > 0 && type != KEYBOARD_BRIGHTNESS_TOGGLE_KEY) {
+                request->steps += g_str_equal (cmd, "StepUp") ? 1 : -1;
+                return;
+        }
+
+        call_brightness (manager, proxy, cmd, NULL);
 }
 
 static void
@@ -2442,6 +2992,25 @@ do_action (GsdMediaKeysManager *manager,
         return FALSE;
 }
 
+/* Actions whose OSD is only shown once a D-Bus call returns; their
+ * latency is recorded by show_osd() rather than when do_action() returns. */
+static gboolean
+action_has_async_osd (MediaKeyType type)
+{
+        switch (type) {
+        case SCREEN_BRIGHTNESS_UP_KEY:
+        case SCREEN_BRIGHTNESS_DOWN_KEY:
+        case KEYBOARD_BRIGHTNESS_UP_KEY:
+        case KEYBOARD_BRIGHTNESS_DOWN_KEY:
+        case KEYBOARD_BRIGHTNESS_TOGGLE_KEY:
+        case RFKILL_KEY:
+        case BLUETOOTH_RFKILL_KEY:
+                return TRUE;
+        default:
+                return FALSE;
+        }
+}
+
 static void
 on_accelerator_activated (ShellKeyGrabber     *grabber,
                           guint                accel_id,
@@ -2449,11 +3018,14 @@ on_accelerator_activated (ShellKeyGrabber     *grabber,
                           GsdMediaKeysManager *manager)
 {
         GVariantDict dict;
-        guint i;
+        MediaKey *key;
+        gint64 start;
         guint deviceid;
         guint timestamp;
         guint mode;
 
+        start = g_get_monotonic_time ();
+
         g_variant_dict_init (&dict, parameters);
 
         if (!g_variant_dict_lookup (&dict, "device-id", "u", &deviceid))
@@ -2466,22 +3038,22 @@ on_accelerator_activated (ShellKeyGrabber     *grabber,
         g_debug ("Received accel id %u (device-id: %u, timestamp: %u, mode: 0x%X",
                  accel_id, deviceid, timestamp, mode);
 
-        for (i = 0; i < manager->priv->keys->len; i++) {
-                MediaKey *key;
-
-                key = g_ptr_array_index (manager->priv->keys, i);
-
-                if (key->accel_id != accel_id)
-                        continue;
-
-                if (key->key_type == CUSTOM_KEY)
-                        do_custom_action (manager, deviceid, key, timestamp);
-                else
-                        do_action (manager, deviceid, mode, key->key_type, timestamp);
+        key = g_hash_table_lookup (manager->priv->keys_by_accel,
+                                   GUINT_TO_POINTER (accel_id));
+        if (key == NULL) {
+                g_warning ("Could not find accelerator for accel id %u", accel_id);
                 return;
         }
 
-        g_warning ("Could not find accelerator for accel id %u", accel_id);
+        key_latency_begin (manager, key, start);
+
+        if (key->key_type == CUSTOM_KEY)
+                do_custom_action (manager, deviceid, key, timestamp);
+        else
+                do_action (manager, deviceid, mode, key->key_type, timestamp);
+
+        if (!action_has_async_osd (key->key_type))
+                key_latency_end (manager);
 }
 
 static void
@@ -2664,6 +3236,10 @@ initialize_volume_handler (GsdMediaKeysManager *manager)
                           "default-source-changed",
                           G_CALLBACK (on_control_default_source_changed),
                           manager);
+        g_signal_connect (manager->priv->volume,
+                          "stream-added",
+                          G_CALLBACK (on_control_stream_added),
+                          manager);
         g_signal_connect (manager->priv->volume,
                           "stream-removed",
                           G_CALLBACK (on_control_stream_removed),
@@ -2753,6 +3329,8 @@ shell_presence_changed (GsdMediaKeysManager *manager)
                                           on_screencast_proxy_ready, manager);
                 g_free (name_owner);
         } else {
+                g_hash_table_remove_all (manager->priv->keys_by_accel);
+                g_hash_table_remove_all (manager->priv->grab_changes);
                 g_ptr_array_set_size (manager->priv->keys, 0);
                 g_clear_object (&manager->priv->key_grabber);
                 g_clear_object (&manager->priv->screencast_proxy);
@@ -2794,13 +3372,18 @@ start_media_keys_idle_cb (GsdMediaKeysManager *manager)
         gnome_settings_profile_start (NULL);
 
         manager->priv->keys = g_ptr_array_new_with_free_func ((GDestroyNotify) media_key_unref);
+        manager->priv->keys_by_accel = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                                                              NULL, (GDestroyNotify) media_key_unref);
+        manager->priv->key_latencies = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                              g_free, g_free);
 
-        manager->priv->keys_pending_grab = g_hash_table_new_full (g_str_hash, g_str_equal,
-                                                                  g_free, NULL);
-        manager->priv->keys_to_grab = g_hash_table_new_full (g_str_hash, g_str_equal,
-                                                             g_free, (GDestroyNotify) media_key_unref);
+        manager->priv->grab_changes = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                                                             (GDestroyNotify) media_key_unref, NULL);
 
         initialize_volume_handler (manager);
+#ifdef HAVE_GUDEV
+        init_device_streams (manager);
+#endif
 
         manager->priv->settings = g_settings_new (SETTINGS_BINDING_DIR);
         g_signal_connect (G_OBJECT (manager->priv->settings), "changed",
@@ -2873,6 +3456,11 @@ gsd_media_keys_manager_start (GsdMediaKeysManager *manager,
 
 #ifdef HAVE_GUDEV
         manager->priv->streams = g_hash_table_new (g_direct_hash, g_direct_equal);
+        manager->priv->source_streams = g_hash_table_new (g_direct_hash, g_direct_equal);
+        manager->priv->device_parents = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                                                               NULL, g_free);
+        manager->priv->stream_parents = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                                                               NULL, g_free);
         manager->priv->udev_client = g_udev_client_new (subsystems);
 #endif
 
@@ -2928,7 +3516,15 @@ gsd_media_keys_manager_stop (GsdMediaKeysManager *manager)
         g_clear_pointer (&manager->priv->ca, ca_context_destroy);
 
 #ifdef HAVE_GUDEV
+        if (priv->device_manager != NULL) {
+                g_signal_handler_disconnect (priv->device_manager, priv->device_added_id);
+                g_signal_handler_disconnect (priv->device_manager, priv->device_removed_id);
+                priv->device_manager = NULL;
+        }
         g_clear_pointer (&priv->streams, g_hash_table_destroy);
+        g_clear_pointer (&priv->source_streams, g_hash_table_destroy);
+        g_clear_pointer (&priv->device_parents, g_hash_table_destroy);
+        g_clear_pointer (&priv->stream_parents, g_hash_table_destroy);
         g_clear_object (&priv->udev_client);
 #endif /* HAVE_GUDEV */
 
@@ -2954,12 +3550,28 @@ gsd_media_keys_manager_stop (GsdMediaKeysManager *manager)
                         key = g_ptr_array_index (manager->priv->keys, i);
                         ungrab_media_key (key, manager);
                 }
+                flush_grabs (manager);
                 g_ptr_array_free (priv->keys, TRUE);
                 priv->keys = NULL;
         }
 
-        g_clear_pointer (&priv->keys_pending_grab, g_hash_table_destroy);
-        g_clear_pointer (&priv->keys_to_grab, g_hash_table_destroy);
+        g_clear_pointer (&priv->keys_by_accel, g_hash_table_destroy);
+        g_clear_pointer (&priv->grab_changes, g_hash_table_destroy);
+        if (priv->grab_flush_id != 0) {
+                g_source_remove (priv->grab_flush_id);
+                priv->grab_flush_id = 0;
+        }
+        g_clear_pointer (&priv->key_latencies, g_hash_table_destroy);
+        priv->latency_pending = NULL;
+
+        if (priv->frame_id != 0) {
+                g_source_remove (priv->frame_id);
+                priv->frame_id = 0;
+        }
+        push_pending_volume (manager);
+        priv->osd_pending = FALSE;
+        g_clear_pointer (&priv->osd_icon, g_free);
+        g_clear_pointer (&priv->osd_label, g_free);
 
         g_clear_object (&priv->key_grabber);
 
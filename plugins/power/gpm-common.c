@@ -23,6 +23,9 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <poll.h>
 #include <sys/wait.h>
 #include <math.h>
 #include <glib.h>
@@ -431,10 +434,10 @@ get_backlight_helper_environ (void)
 {
         static gchar **environ = NULL;
 
-        if (environ)
-                return environ;
+        /* may be called from the backlight worker thread */
+        if (g_once_init_enter (&environ))
+                g_once_init_leave (&environ, g_environ_unsetenv (g_get_environ (), "SHELL"));
 
-        environ = g_environ_unsetenv (g_get_environ (), "SHELL");
         return environ;
 }
 
@@ -469,10 +472,280 @@ run_backlight_helper (enum BacklightHelperCommand   command,
                              error);
 }
 
+/*
+ * The backlight broker is a long-lived instance of the helper, started
+ * through pkexec once, that serves get and set requests over its stdin and
+ * stdout. This avoids a process spawn and a polkit check for every brightness
+ * read or write. If the broker cannot be started, or was never authorized,
+ * we fall back to spawning the helper for each request.
+ */
+/* how long to wait for a reply; the first one waits for the user to
+ * answer the authentication dialog */
+#define BACKLIGHT_BROKER_TIMEOUT_MS             2000
+#define BACKLIGHT_BROKER_AUTH_TIMEOUT_MS        (5 * 60 * 1000)
+
+typedef struct {
+        GPid             pid;
+        GIOChannel      *request;
+        GIOChannel      *reply;
+        gboolean         authorized;
+} BacklightBroker;
+
+/* the broker is used from the backlight worker thread as well as from
+ * synchronous callers and its child watch in the main thread */
+static GMutex broker_mutex;
+static BacklightBroker *broker = NULL;
+static gboolean broker_disabled = FALSE;
+
+static void
+backlight_broker_stop (void)
+{
+        if (broker == NULL)
+                return;
+
+        /* closing stdin makes the helper exit, the child watch reaps it */
+        g_io_channel_shutdown (broker->request, FALSE, NULL);
+        g_io_channel_unref (broker->request);
+        g_io_channel_shutdown (broker->reply, FALSE, NULL);
+        g_io_channel_unref (broker->reply);
+        g_clear_pointer (&broker, g_free);
+}
+
+static void
+backlight_broker_child_watch_cb (GPid     pid,
+                                 gint     status,
+                                 gpointer user_data)
+{
+        g_debug ("backlight broker %i exited with status %i", pid, status);
+
+        g_mutex_lock (&broker_mutex);
+        if (broker != NULL && broker->pid == pid)
+                backlight_broker_stop ();
+        g_mutex_unlock (&broker_mutex);
+        g_spawn_close_pid (pid);
+}
+
+static gboolean
+backlight_broker_start (GError **error)
+{
+        gchar *argv[] = {
+                "pkexec",
+                LIBEXECDIR "/gsd-backlight-helper",
+                "--serve",
+                NULL
+        };
+        static gboolean sigpipe_ignored = FALSE;
+        GPid pid;
+        gint request_fd;
+        gint reply_fd;
+
+        /* a broker that exits under us must fail the write with EPIPE
+         * rather than kill us; the child watch can't catch it in time
+         * when we write from the worker thread */
+        if (!sigpipe_ignored) {
+                signal (SIGPIPE, SIG_IGN);
+                sigpipe_ignored = TRUE;
+        }
+
+        if (!g_spawn_async_with_pipes (NULL,
+                                       argv,
+                                       get_backlight_helper_environ (),
+                                       G_SPAWN_SEARCH_PATH | G_SPAWN_DO_NOT_REAP_CHILD,
+                                       NULL,
+                                       NULL,
+                                       &pid,
+                                       &request_fd,
+                                       &reply_fd,
+                                       NULL,
+                                       error))
+                return FALSE;
+
+        broker = g_new0 (BacklightBroker, 1);
+        broker->pid = pid;
+        broker->request = g_io_channel_unix_new (request_fd);
+        broker->reply = g_io_channel_unix_new (reply_fd);
+        g_io_channel_set_flags (broker->reply, G_IO_FLAG_NONBLOCK, NULL);
+        g_child_watch_add (pid, backlight_broker_child_watch_cb, NULL);
+
+        g_debug ("started backlight broker %i", pid);
+        return TRUE;
+}
+
+/* reads one reply line, giving up if the broker doesn't answer in time */
+static GIOStatus
+backlight_broker_read_reply (gchar **reply, GError **error)
+{
+        struct pollfd pfd;
+        GIOStatus status;
+        gint64 deadline;
+        gint timeout;
+
+        timeout = broker->authorized ? BACKLIGHT_BROKER_TIMEOUT_MS :
+                                       BACKLIGHT_BROKER_AUTH_TIMEOUT_MS;
+        deadline = g_get_monotonic_time () + timeout * G_TIME_SPAN_MILLISECOND;
+
+        pfd.fd = g_io_channel_unix_get_fd (broker->reply);
+        pfd.events = POLLIN;
+        for (;;) {
+                status = g_io_channel_read_line (broker->reply, reply, NULL, NULL, error);
+                if (status != G_IO_STATUS_AGAIN)
+                        return status;
+
+                timeout = (deadline - g_get_monotonic_time ()) / G_TIME_SPAN_MILLISECOND;
+                if (timeout <= 0 || poll (&pfd, 1, timeout) == 0) {
+                        g_set_error_literal (error,
+                                             GSD_POWER_MANAGER_ERROR,
+                                             GSD_POWER_MANAGER_ERROR_FAILED,
+                                             "backlight broker did not reply");
+                        return G_IO_STATUS_ERROR;
+                }
+        }
+}
+
+/**
+ * backlight_broker_call:
+ *
+ * Sends a request to the backlight broker, starting it if needed.
+ *
+ * Return value: %FALSE if the broker is not usable and the caller should
+ * fall back to spawning the helper. Otherwise %TRUE, with @value_out set to
+ * the reply, or to -1 with @error set if the helper failed the request.
+ **/
+static gboolean
+backlight_broker_call (enum BacklightHelperCommand   command,
+                       gint                          value,
+                       gint64                       *value_out,
+                       GError                      **error)
+{
+        GError *broker_error = NULL;
+        gchar *request = NULL;
+        gchar *reply = NULL;
+        gchar *endptr = NULL;
+        GIOStatus status;
+
+        g_mutex_lock (&broker_mutex);
+
+        if (broker_disabled) {
+                g_mutex_unlock (&broker_mutex);
+                return FALSE;
+        }
+
+        if (broker == NULL && !backlight_broker_start (&broker_error))
+                goto failed;
+
+        if (command == BACKLIGHT_HELPER_SET)
+                request = g_strdup_printf ("set %i\n", value);
+        else if (command == BACKLIGHT_HELPER_GET_MAX)
+                request = g_strdup ("get-max\n");
+        else
+                request = g_strdup ("get\n");
+
+        status = g_io_channel_write_chars (broker->request, request, -1, NULL, &broker_error);
+        if (status == G_IO_STATUS_NORMAL)
+                status = g_io_channel_flush (broker->request, &broker_error);
+        if (status != G_IO_STATUS_NORMAL)
+                goto failed;
+
+        /* EPIPE, EOF or no answer all mean the broker is gone */
+        status = backlight_broker_read_reply (&reply, &broker_error);
+        if (status != G_IO_STATUS_NORMAL) {
+                if (broker_error == NULL)
+                        g_set_error_literal (&broker_error,
+                                             GSD_POWER_MANAGER_ERROR,
+                                             GSD_POWER_MANAGER_ERROR_FAILED,
+                                             "backlight broker exited");
+                goto failed;
+        }
+
+        broker->authorized = TRUE;
+        g_strchomp (reply);
+
+        if (g_str_has_prefix (reply, "ERROR")) {
+                g_set_error (error,
+                             GSD_POWER_MANAGER_ERROR,
+                             GSD_POWER_MANAGER_ERROR_FAILED,
+                             "gsd-backlight-helper failed: %s",
+                             reply + strlen ("ERROR"));
+                *value_out = -1;
+                goto out;
+        }
+
+        *value_out = g_ascii_strtoll (reply, &endptr, 10);
+        if (endptr == reply || *value_out < 0 || *value_out > G_MAXINT) {
+                g_set_error (error,
+                             GSD_POWER_MANAGER_ERROR,
+                             GSD_POWER_MANAGER_ERROR_FAILED,
+                             "failed to parse value: %s",
+                             reply);
+                *value_out = -1;
+        }
+out:
+        g_mutex_unlock (&broker_mutex);
+        g_free (request);
+        g_free (reply);
+        return TRUE;
+
+failed:
+        /* a broker that never answered was most likely not authorized,
+         * or is not installed; don't try again for this session */
+        if (broker == NULL || !broker->authorized) {
+                g_warning ("backlight broker unavailable, spawning helper per request: %s",
+                           broker_error->message);
+                broker_disabled = TRUE;
+        } else {
+                g_debug ("backlight broker failed, restarting on next request: %s",
+                         broker_error->message);
+        }
+        backlight_broker_stop ();
+        g_mutex_unlock (&broker_mutex);
+        g_clear_error (&broker_error);
+        g_free (request);
+        return FALSE;
+}
+
+static gpointer
+backlight_state_init (gpointer data)
+{
+        GsdBacklightState *state = NULL;
+        GError *error = NULL;
+
+        if (is_mocked ())
+                return gsd_backlight_state_new_mock (GSD_MOCK_MAX_BRIGHTNESS,
+                                                     backlight_get_mock_value (BACKLIGHT_HELPER_GET));
+
+#ifdef __linux__
+        state = gsd_backlight_state_new (&error);
+        if (state == NULL) {
+                g_debug ("not caching the backlight state: %s", error->message);
+                g_error_free (error);
+        }
+#endif
+        return state;
+}
+
+/**
+ * backlight_get_state:
+ *
+ * Gets the cached state of the sysfs backlight. This should first be
+ * called from the main thread, so that its udev monitoring is attached
+ * to the main context.
+ *
+ * Return value: (transfer none): the backlight state, or %NULL if
+ * the brightness can't be cached and has to be read through the helper.
+ **/
+GsdBacklightState *
+backlight_get_state (void)
+{
+        static GOnce state_once = G_ONCE_INIT;
+        g_once (&state_once, backlight_state_init, NULL);
+        return state_once.retval;
+}
+
 /**
  * backlight_helper_get_value:
  *
- * Gets a brightness value from the PolicyKit helper.
+ * Gets a brightness value from the cached backlight state, or from
+ * the PolicyKit helper if it isn't available.
  *
  * Return value: the signed integer value from the helper, or -1
  * for failure. If -1 then @error is set.
@@ -485,6 +758,14 @@ backlight_helper_get_value (enum BacklightHelperCommand command, GError **error)
         gint exit_status = 0;
         gint64 value = -1;
         gchar *endptr = NULL;
+        GsdBacklightState *state;
+
+        state = backlight_get_state ();
+        if (state != NULL) {
+                if (command == BACKLIGHT_HELPER_GET_MAX)
+                        return gsd_backlight_state_get_max (state);
+                return gsd_backlight_state_get_brightness (state);
+        }
 
 	if (is_mocked ())
 		return backlight_get_mock_value (command);
@@ -498,6 +779,10 @@ backlight_helper_get_value (enum BacklightHelperCommand command, GError **error)
         goto out;
 #endif
 
+        /* use the running broker if we can */
+        if (backlight_broker_call (command, -1, &value, error))
+                goto out;
+
         /* get the data */
         ret = run_backlight_helper (command, NULL,
                                     &stdout_data, &exit_status, error);
@@ -553,24 +838,21 @@ out:
         return value;
 }
 
-/**
- * backlight_helper_set_value:
- *
- * Sets a brightness value using the PolicyKit helper.
- *
- * Return value: Success. If FALSE then @error is set.
- **/
-static gboolean
-backlight_helper_set_value (gint value,
-                            GError **error)
+/* returns the value written, or -1 on failure */
+static gint
+backlight_helper_write_value (gint value,
+                              GError **error)
 {
         gboolean ret = FALSE;
         gint exit_status = 0;
         gchar *vstr = NULL;
+        gchar *stdout_data = NULL;
+        gchar *endptr = NULL;
+        gint64 written = -1;
 
 	if (is_mocked ()) {
 		backlight_set_mock_value (value);
-		return TRUE;
+		return value;
 	}
 
 #ifndef __linux__
@@ -579,15 +861,70 @@ backlight_helper_set_value (gint value,
                              GSD_POWER_MANAGER_ERROR,
                              GSD_POWER_MANAGER_ERROR_FAILED,
                              "The sysfs backlight helper is only for Linux");
-        return FALSE;
+        return -1;
 #endif
 
+        /* use the running broker if we can */
+        if (backlight_broker_call (BACKLIGHT_HELPER_SET, value, &written, error))
+                return written;
+
         /* get the data */
         vstr = g_strdup_printf ("%i", value);
         ret = run_backlight_helper (BACKLIGHT_HELPER_SET, vstr,
-                                    NULL, &exit_status, error);
+                                    &stdout_data, &exit_status, error);
         g_free (vstr);
-        return ret;
+        if (!ret)
+                goto out;
+
+        if (WEXITSTATUS (exit_status) != 0) {
+                g_set_error (error,
+                             GSD_POWER_MANAGER_ERROR,
+                             GSD_POWER_MANAGER_ERROR_FAILED,
+                             "gsd-backlight-helper failed: %s",
+                             stdout_data ? stdout_data : "No reason");
+                goto out;
+        }
+
+        /* the helper prints what it wrote, which may have been clamped */
+        written = g_ascii_strtoll (stdout_data, &endptr, 10);
+        if (endptr == stdout_data || written < 0 || written > G_MAXINT) {
+                g_set_error (error,
+                             GSD_POWER_MANAGER_ERROR,
+                             GSD_POWER_MANAGER_ERROR_FAILED,
+                             "failed to parse value: %s",
+                             stdout_data);
+                written = -1;
+        }
+out:
+        g_free (stdout_data);
+        return written;
+}
+
+/**
+ * backlight_helper_set_value:
+ *
+ * Sets a brightness value using the PolicyKit helper, and updates
+ * the cached backlight state.
+ *
+ * Return value: Success. If FALSE then @error is set.
+ **/
+static gboolean
+backlight_helper_set_value (gint value,
+                            GError **error)
+{
+        GsdBacklightState *state;
+        gint written;
+
+        state = backlight_get_state ();
+        if (state != NULL)
+                gsd_backlight_state_write_begin (state);
+
+        written = backlight_helper_write_value (value, error);
+
+        if (state != NULL)
+                gsd_backlight_state_write_end (state, written);
+
+        return written >= 0;
 }
 
 int
@@ -702,8 +1039,17 @@ backlight_set_percentage (GnomeRRScreen *rr_screen,
 #endif
 }
 
+/**
+ * backlight_step:
+ *
+ * Moves the brightness by @steps brightness steps, up if positive and
+ * down if negative, in a single write.
+ *
+ * Return value: the new brightness as a percentage, or -1 for failure.
+ * If -1 then @error is set.
+ **/
 int
-backlight_step_up (GnomeRRScreen *rr_screen, GError **error)
+backlight_step (GnomeRRScreen *rr_screen, gint steps, GError **error)
 {
         gboolean ret = FALSE;
         gint percentage_value = -1;
@@ -730,8 +1076,8 @@ backlight_step_up (GnomeRRScreen *rr_screen, GError **error)
                 now = gnome_rr_output_get_backlight (output);
                 if (now < 0)
                        return percentage_value;
-                step = MAX(gnome_rr_output_get_min_backlight_step (output), BRIGHTNESS_STEP_AMOUNT(max + 1));
-                discrete = MIN (now + step, max);
+                step = MAX (gnome_rr_output_get_min_backlight_step (output), BRIGHTNESS_STEP_AMOUNT (max + 1));
+                discrete = CLAMP (now + steps * step, 0, max);
                 ret = gnome_rr_output_set_backlight (output,
                                                      discrete,
                                                      error);
@@ -747,7 +1093,7 @@ backlight_step_up (GnomeRRScreen *rr_screen, GError **error)
         if (max < 0)
                 return percentage_value;
         step = BRIGHTNESS_STEP_AMOUNT (max + 1);
-        discrete = MIN (now + step, max);
+        discrete = CLAMP (now + steps * step, 0, max);
         ret = backlight_helper_set_value (discrete, error);
         if (ret)
                 percentage_value = ABS_TO_PERCENTAGE (0, max, discrete);
@@ -757,57 +1103,15 @@ backlight_step_up (GnomeRRScreen *rr_screen, GError **error)
 }
 
 int
-backlight_step_down (GnomeRRScreen *rr_screen, GError **error)
+backlight_step_up (GnomeRRScreen *rr_screen, GError **error)
 {
-        gboolean ret = FALSE;
-        gint percentage_value = -1;
-        gint max;
-        gint now;
-        gint step;
-        guint discrete;
-#ifndef __linux__
-        GnomeRRCrtc *crtc;
-        GnomeRROutput *output;
-        output = get_primary_output (rr_screen);
-        if (output != NULL) {
-
-                crtc = gnome_rr_output_get_crtc (output);
-                if (crtc == NULL) {
-                        g_set_error (error,
-                                     GSD_POWER_MANAGER_ERROR,
-                                     GSD_POWER_MANAGER_ERROR_FAILED,
-                                     "no crtc for %s",
-                                     gnome_rr_output_get_name (output));
-                        return percentage_value;
-                }
-                max = 100;
-                now = gnome_rr_output_get_backlight (output);
-                if (now < 0)
-                       return percentage_value;
-                step = MAX (gnome_rr_output_get_min_backlight_step (output), BRIGHTNESS_STEP_AMOUNT (max + 1));
-                discrete = MAX (now - step, 0);
-                ret = gnome_rr_output_set_backlight (output,
-                                                     discrete,
-                                                     error);
-                if (ret)
-                        percentage_value = ABS_TO_PERCENTAGE (0, max, discrete);
-        }
-        return percentage_value;
-#else
-        now = backlight_helper_get_value (BACKLIGHT_HELPER_GET, error);
-        if (now < 0)
-                return percentage_value;
-        max = backlight_helper_get_value (BACKLIGHT_HELPER_GET_MAX, error);
-        if (max < 0)
-                return percentage_value;
-        step = BRIGHTNESS_STEP_AMOUNT (max + 1);
-        discrete = MAX (now - step, 0);
-        ret = backlight_helper_set_value (discrete, error);
-        if (ret)
-                percentage_value = ABS_TO_PERCENTAGE (0, max, discrete);
+        return backlight_step (rr_screen, 1, error);
+}
 
-        return percentage_value;
-#endif
+int
+backlight_step_down (GnomeRRScreen *rr_screen, GError **error)
+{
+        return backlight_step (rr_screen, -1, error);
 }
 
 int
@@ -829,6 +1133,346 @@ backlight_set_abs (GnomeRRScreen *rr_screen,
 #endif
 }
 
+/* Dims to @idle_percentage unless the backlight is already dimmer than that.
+ * Returns the level to restore on undim, which is -1 if nothing was changed,
+ * or -2 on failure. */
+static gint
+backlight_dim (GnomeRRScreen *rr_screen,
+               gint idle_percentage,
+               GError **error)
+{
+        gint min;
+        gint max;
+        gint now;
+        gint idle;
+
+        now = backlight_get_abs (rr_screen, error);
+        if (now < 0)
+                return -2;
+
+        /* is the dim brightness actually *dimmer* than the
+         * brightness we have now? */
+        min = backlight_get_min (rr_screen);
+        max = backlight_get_max (rr_screen, error);
+        if (max < 0)
+                return -2;
+        idle = PERCENTAGE_TO_ABS (min, max, idle_percentage);
+        if (idle > now) {
+                g_debug ("brightness already now %i/%i, so "
+                         "ignoring dim to %i/%i",
+                         now, max, idle, max);
+                return -1;
+        }
+        if (!backlight_set_abs (rr_screen, idle, error))
+                return -2;
+
+        return now;
+}
+
+/*
+ * Asynchronous versions of the backlight helpers. The helper I/O is done in
+ * a single worker thread so that the main loop never waits on sysfs writes,
+ * the helper or a polkit prompt, and so that requests reach the hardware in
+ * the order they were made.
+ */
+typedef enum {
+        BACKLIGHT_JOB_GET_PERCENTAGE,
+        BACKLIGHT_JOB_SET_PERCENTAGE,
+        BACKLIGHT_JOB_SET_ABS,
+        BACKLIGHT_JOB_STEP_UP,
+        BACKLIGHT_JOB_STEP_DOWN,
+        BACKLIGHT_JOB_STEP,
+        BACKLIGHT_JOB_DIM
+} BacklightJobType;
+
+typedef struct {
+        BacklightJobType         type;
+        GnomeRRScreen           *rr_screen;
+        gint                     value;
+} BacklightJob;
+
+static void
+backlight_job_free (BacklightJob *job)
+{
+        g_clear_object (&job->rr_screen);
+        g_free (job);
+}
+
+static void
+backlight_job_run (GTask *task)
+{
+        BacklightJob *job = g_task_get_task_data (task);
+        GError *error = NULL;
+        gboolean ret = FALSE;
+
+        if (g_task_return_error_if_cancelled (task))
+                return;
+
+        switch (job->type) {
+        case BACKLIGHT_JOB_GET_PERCENTAGE:
+                job->value = backlight_get_percentage (job->rr_screen, &error);
+                ret = (job->value >= 0);
+                break;
+        case BACKLIGHT_JOB_SET_PERCENTAGE:
+                ret = backlight_set_percentage (job->rr_screen, &job->value, &error);
+                break;
+        case BACKLIGHT_JOB_SET_ABS:
+                ret = backlight_set_abs (job->rr_screen, job->value, &error);
+                break;
+        case BACKLIGHT_JOB_STEP_UP:
+                job->value = backlight_step_up (job->rr_screen, &error);
+                ret = (job->value >= 0);
+                break;
+        case BACKLIGHT_JOB_STEP_DOWN:
+                job->value = backlight_step_down (job->rr_screen, &error);
+                ret = (job->value >= 0);
+                break;
+        case BACKLIGHT_JOB_STEP:
+                job->value = backlight_step (job->rr_screen, job->value, &error);
+                ret = (job->value >= 0);
+                break;
+        case BACKLIGHT_JOB_DIM:
+                job->value = backlight_dim (job->rr_screen, job->value, &error);
+                ret = (job->value >= -1);
+                break;
+        default:
+                g_assert_not_reached ();
+        }
+
+        if (ret) {
+                g_task_return_boolean (task, TRUE);
+                return;
+        }
+
+        if (error == NULL)
+                g_set_error_literal (&error,
+                                     GSD_POWER_MANAGER_ERROR,
+                                     GSD_POWER_MANAGER_ERROR_FAILED,
+                                     "No backlight available");
+        g_task_return_error (task, error);
+}
+
+static void
+backlight_job_thread (gpointer data,
+                      gpointer user_data)
+{
+        GTask *task = data;
+
+        backlight_job_run (task);
+        g_object_unref (task);
+}
+
+static void
+backlight_job_start (GnomeRRScreen       *rr_screen,
+                     BacklightJobType     type,
+                     gint                 value,
+                     gpointer             source_tag,
+                     GCancellable        *cancellable,
+                     GAsyncReadyCallback  callback,
+                     gpointer             user_data)
+{
+        BacklightJob *job;
+        GTask *task;
+#ifdef __linux__
+        static GThreadPool *pool = NULL;
+#endif
+
+        job = g_new0 (BacklightJob, 1);
+        job->type = type;
+        job->rr_screen = rr_screen ? g_object_ref (rr_screen) : NULL;
+        job->value = value;
+
+        task = g_task_new (rr_screen, cancellable, callback, user_data);
+        g_task_set_source_tag (task, source_tag);
+        g_task_set_task_data (task, job, (GDestroyNotify) backlight_job_free);
+
+#ifndef __linux__
+        /* the RandR backlight can only be used from the main thread */
+        backlight_job_run (task);
+        g_object_unref (task);
+#else
+        /* a single thread keeps the requests in order */
+        if (pool == NULL)
+                pool = g_thread_pool_new (backlight_job_thread, NULL, 1, FALSE, NULL);
+        g_thread_pool_push (pool, task, NULL);
+#endif
+}
+
+static gint
+backlight_job_finish (GnomeRRScreen  *rr_screen,
+                      GAsyncResult   *res,
+                      gpointer        source_tag,
+                      GError        **error)
+{
+        BacklightJob *job;
+
+        g_return_val_if_fail (g_task_is_valid (res, rr_screen), -1);
+        g_return_val_if_fail (g_task_get_source_tag (G_TASK (res)) == source_tag, -1);
+
+        if (!g_task_propagate_boolean (G_TASK (res), error))
+                return -1;
+
+        job = g_task_get_task_data (G_TASK (res));
+        return job->value;
+}
+
+void
+backlight_get_percentage_async (GnomeRRScreen       *rr_screen,
+                                GCancellable        *cancellable,
+                                GAsyncReadyCallback  callback,
+                                gpointer             user_data)
+{
+        backlight_job_start (rr_screen, BACKLIGHT_JOB_GET_PERCENTAGE, -1,
+                             backlight_get_percentage_async,
+                             cancellable, callback, user_data);
+}
+
+int
+backlight_get_percentage_finish (GnomeRRScreen  *rr_screen,
+                                 GAsyncResult   *res,
+                                 GError        **error)
+{
+        return backlight_job_finish (rr_screen, res,
+                                     backlight_get_percentage_async, error);
+}
+
+void
+backlight_set_percentage_async (GnomeRRScreen       *rr_screen,
+                                gint                 value,
+                                GCancellable        *cancellable,
+                                GAsyncReadyCallback  callback,
+                                gpointer             user_data)
+{
+        backlight_job_start (rr_screen, BACKLIGHT_JOB_SET_PERCENTAGE, value,
+                             backlight_set_percentage_async,
+                             cancellable, callback, user_data);
+}
+
+/* returns the percentage that was actually set, or -1 on error */
+int
+backlight_set_percentage_finish (GnomeRRScreen  *rr_screen,
+                                 GAsyncResult   *res,
+                                 GError        **error)
+{
+        return backlight_job_finish (rr_screen, res,
+                                     backlight_set_percentage_async, error);
+}
+
+void
+backlight_set_abs_async (GnomeRRScreen       *rr_screen,
+                         guint                value,
+                         GCancellable        *cancellable,
+                         GAsyncReadyCallback  callback,
+                         gpointer             user_data)
+{
+        backlight_job_start (rr_screen, BACKLIGHT_JOB_SET_ABS, value,
+                             backlight_set_abs_async,
+                             cancellable, callback, user_data);
+}
+
+gboolean
+backlight_set_abs_finish (GnomeRRScreen  *rr_screen,
+                          GAsyncResult   *res,
+                          GError        **error)
+{
+        return backlight_job_finish (rr_screen, res,
+                                     backlight_set_abs_async, error) >= 0;
+}
+
+void
+backlight_step_up_async (GnomeRRScreen       *rr_screen,
+                         GCancellable        *cancellable,
+                         GAsyncReadyCallback  callback,
+                         gpointer             user_data)
+{
+        backlight_job_start (rr_screen, BACKLIGHT_JOB_STEP_UP, -1,
+                             backlight_step_up_async,
+                             cancellable, callback, user_data);
+}
+
+int
+backlight_step_up_finish (GnomeRRScreen  *rr_screen,
+                          GAsyncResult   *res,
+                          GError        **error)
+{
+        return backlight_job_finish (rr_screen, res,
+                                     backlight_step_up_async, error);
+}
+
+void
+backlight_step_down_async (GnomeRRScreen       *rr_screen,
+                           GCancellable        *cancellable,
+                           GAsyncReadyCallback  callback,
+                           gpointer             user_data)
+{
+        backlight_job_start (rr_screen, BACKLIGHT_JOB_STEP_DOWN, -1,
+                             backlight_step_down_async,
+                             cancellable, callback, user_data);
+}
+
+int
+backlight_step_down_finish (GnomeRRScreen  *rr_screen,
+                            GAsyncResult   *res,
+                            GError        **error)
+{
+        return backlight_job_finish (rr_screen, res,
+                                     backlight_step_down_async, error);
+}
+
+void
+backlight_step_async (GnomeRRScreen       *rr_screen,
+                      gint                 steps,
+                      GCancellable        *cancellable,
+                      GAsyncReadyCallback  callback,
+                      gpointer             user_data)
+{
+        backlight_job_start (rr_screen, BACKLIGHT_JOB_STEP, steps,
+                             backlight_step_async,
+                             cancellable, callback, user_data);
+}
+
+int
+backlight_step_finish (GnomeRRScreen  *rr_screen,
+                       GAsyncResult   *res,
+                       GError        **error)
+{
+        return backlight_job_finish (rr_screen, res,
+                                     backlight_step_async, error);
+}
+
+void
+backlight_dim_async (GnomeRRScreen       *rr_screen,
+                     gint                 idle_percentage,
+                     GCancellable        *cancellable,
+                     GAsyncReadyCallback  callback,
+                     gpointer             user_data)
+{
+        backlight_job_start (rr_screen, BACKLIGHT_JOB_DIM, idle_percentage,
+                             backlight_dim_async,
+                             cancellable, callback, user_data);
+}
+
+/* @pre_dim is set to the level to restore on undim, or -1 if the
+ * backlight was already dimmer than requested and was left alone */
+gboolean
+backlight_dim_finish (GnomeRRScreen  *rr_screen,
+                      GAsyncResult   *res,
+                      gint           *pre_dim,
+                      GError        **error)
+{
+        BacklightJob *job;
+
+        g_return_val_if_fail (g_task_is_valid (res, rr_screen), FALSE);
+        g_return_val_if_fail (g_task_get_source_tag (G_TASK (res)) == backlight_dim_async, FALSE);
+
+        if (!g_task_propagate_boolean (G_TASK (res), error))
+                return FALSE;
+
+        job = g_task_get_task_data (G_TASK (res));
+        *pre_dim = job->value;
+        return TRUE;
+}
+
 void
 reset_idletime (void)
 {
@@ -23,8 +23,11 @@
 #define __GPMCOMMON_H
 
 #include <glib.h>
+#include <gio/gio.h>
 #include <libupower-glib/upower.h>
 
+#include "gsd-backlight-state.h"
+
 G_BEGIN_DECLS
 
 /* UPower helpers */
@@ -48,6 +51,7 @@ int              gsd_power_backlight_abs_to_percentage  (int min, int max, int v
 int              gsd_power_backlight_percentage_to_abs  (int min, int max, int value);
 gboolean         backlight_available                    (GnomeRRScreen *rr_screen);
 int              backlight_get_output_id                (GnomeRRScreen *rr_screen);
+GsdBacklightState *backlight_get_state                  (void);
 int              backlight_get_abs                      (GnomeRRScreen *rr_screen, GError **error);
 int              backlight_get_percentage               (GnomeRRScreen *rr_screen, GError **error);
 int              backlight_get_min                      (GnomeRRScreen *rr_screen);
@@ -57,10 +61,66 @@ gboolean         backlight_set_percentage               (GnomeRRScreen *rr_scree
                                                          GError **error);
 int              backlight_step_up                      (GnomeRRScreen *rr_screen, GError **error);
 int              backlight_step_down                    (GnomeRRScreen *rr_screen, GError **error);
+int              backlight_step                         (GnomeRRScreen *rr_screen, gint steps, GError **error);
 int              backlight_set_abs                      (GnomeRRScreen *rr_screen,
                                                          guint value,
                                                          GError **error);
 
+void             backlight_get_percentage_async         (GnomeRRScreen       *rr_screen,
+                                                         GCancellable        *cancellable,
+                                                         GAsyncReadyCallback  callback,
+                                                         gpointer             user_data);
+int              backlight_get_percentage_finish        (GnomeRRScreen       *rr_screen,
+                                                         GAsyncResult        *res,
+                                                         GError             **error);
+void             backlight_set_percentage_async         (GnomeRRScreen       *rr_screen,
+                                                         gint                 value,
+                                                         GCancellable        *cancellable,
+                                                         GAsyncReadyCallback  callback,
+                                                         gpointer             user_data);
+int              backlight_set_percentage_finish        (GnomeRRScreen       *rr_screen,
+                                                         GAsyncResult        *res,
+                                                         GError             **error);
+void             backlight_set_abs_async                (GnomeRRScreen       *rr_screen,
+                                                         guint                value,
+                                                         GCancellable        *cancellable,
+                                                         GAsyncReadyCallback  callback,
+                                                         gpointer             user_data);
+gboolean         backlight_set_abs_finish               (GnomeRRScreen       *rr_screen,
+                                                         GAsyncResult        *res,
+                                                         GError             **error);
+void             backlight_step_up_async                (GnomeRRScreen       *rr_screen,
+                                                         GCancellable        *cancellable,
+                                                         GAsyncReadyCallback  callback,
+                                                         gpointer             user_data);
+int              backlight_step_up_finish               (GnomeRRScreen       *rr_screen,
+                                                         GAsyncResult        *res,
+                                                         GError             **error);
+void             backlight_step_down_async              (GnomeRRScreen       *rr_screen,
+                                                         GCancellable        *cancellable,
+                                                         GAsyncReadyCallback  callback,
+                                                         gpointer             user_data);
+int              backlight_step_down_finish             (GnomeRRScreen       *rr_screen,
+                                                         GAsyncResult        *res,
+                                                         GError             **error);
+void             backlight_step_async                   (GnomeRRScreen       *rr_screen,
+                                                         gint                 steps,
+                                                         GCancellable        *cancellable,
+                                                         GAsyncReadyCallback  callback,
+                                                         gpointer             user_data);
+int              backlight_step_finish                  (GnomeRRScreen       *rr_screen,
+                                                         GAsyncResult        *res,
+                                                         GError             **error);
+void             backlight_dim_async                    (GnomeRRScreen       *rr_screen,
+                                                         gint                 idle_percentage,
+                                                         GCancellable        *cancellable,
+                                                         GAsyncReadyCallback  callback,
+                                                         gpointer             user_data);
+gboolean         backlight_dim_finish                   (GnomeRRScreen       *rr_screen,
+                                                         GAsyncResult        *res,
+                                                         gint                *pre_dim,
+                                                         GError             **error);
+
 /* RandR helpers */
 void             watch_external_monitor                 (GnomeRRScreen *screen);
 gboolean         external_monitor_is_connected          (GnomeRRScreen *screen);
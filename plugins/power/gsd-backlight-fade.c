@@ -0,0 +1,319 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+
+#include <math.h>
+#include <glib.h>
+#include <gio/gio.h>
+
+#define GNOME_DESKTOP_USE_UNSTABLE_API
+#include <libgnome-desktop/gnome-rr.h>
+
+#include "gpm-common.h"
+#include "gsd-backlight-fade.h"
+
+#define GSD_BACKLIGHT_FADE_FRAME_MS     20 /* ms */
+
+/*
+ * Animates the backlight between two levels over a fixed duration.
+ *
+ * A timer computes the level for each frame from the easing curve, and hands
+ * it to the writer. The writer keeps at most one write in flight: frames that
+ * arrive while the backlight job is still running replace each other, so a
+ * slow helper means fewer, larger steps rather than a growing backlog. The
+ * last frame is always the exact target.
+ */
+struct _GsdBacklightFade
+{
+        GObject                  parent_instance;
+
+        GnomeRRScreen           *rr_screen;
+        GsdBacklightState       *state;
+
+        /* ramp */
+        guint                    frame_id;
+        gint64                   start_time;
+        guint                    duration;
+        gint                     from;
+        gint                     target;
+        GsdBacklightFadeCurve    curve;
+
+        /* writer */
+        gint                     requested;     /* last level handed to the writer */
+        gint                     issued;        /* level of the write in flight */
+        gboolean                 write_in_flight;
+        gint                     write_queued;  /* -1 for none */
+
+        /* statistics for the current fade */
+        gboolean                 report_pending;
+        guint                    frames;
+        guint                    writes;
+        guint                    coalesced;
+};
+
+G_DEFINE_TYPE (GsdBacklightFade, gsd_backlight_fade, G_TYPE_OBJECT)
+
+static void writer_issue (GsdBacklightFade *fade, gint value);
+
+static void
+fade_report (GsdBacklightFade *fade,
+             const gchar      *result)
+{
+        if (!fade->report_pending)
+                return;
+        fade->report_pending = FALSE;
+        g_debug ("backlight fade to %i %s: %u frames, %u writes, %u coalesced",
+                 fade->target, result, fade->frames, fade->writes, fade->coalesced);
+}
+
+static void
+writer_cb (GObject      *source_object,
+           GAsyncResult *res,
+           gpointer      user_data)
+{
+        GsdBacklightFade *fade = GSD_BACKLIGHT_FADE (user_data);
+        GError *error = NULL;
+        gint value;
+
+        if (!backlight_set_abs_finish (GNOME_RR_SCREEN (source_object), res, &error)) {
+                g_warning ("failed to set backlight during fade: %s", error->message);
+                g_error_free (error);
+        }
+
+        fade->write_in_flight = FALSE;
+        if (fade->write_queued >= 0) {
+                value = fade->write_queued;
+                fade->write_queued = -1;
+                writer_issue (fade, value);
+        } else if (fade->frame_id == 0) {
+                fade_report (fade, "finished");
+        }
+
+        g_object_unref (fade);
+}
+
+static void
+writer_issue (GsdBacklightFade *fade,
+              gint              value)
+{
+        fade->write_in_flight = TRUE;
+        fade->issued = value;
+        fade->writes++;
+        backlight_set_abs_async (fade->rr_screen,
+                                 value,
+                                 NULL,
+                                 writer_cb,
+                                 g_object_ref (fade));
+}
+
+static void
+writer_write (GsdBacklightFade *fade,
+              gint              value)
+{
+        /* levels are coarse, most frames do not change anything */
+        if (value == fade->requested)
+                return;
+        fade->requested = value;
+
+        if (fade->write_in_flight) {
+                if (fade->write_queued >= 0)
+                        fade->coalesced++;
+                fade->write_queued = value;
+                return;
+        }
+        writer_issue (fade, value);
+}
+
+static gdouble
+fade_progress (GsdBacklightFadeCurve curve,
+               gdouble               t)
+{
+        switch (curve) {
+        case GSD_BACKLIGHT_FADE_CURVE_EASE_IN_OUT:
+                return (1.f - cos (t * G_PI)) / 2.f;
+        case GSD_BACKLIGHT_FADE_CURVE_EASE_OUT:
+                return 1.f - (1.f - t) * (1.f - t);
+        case GSD_BACKLIGHT_FADE_CURVE_LINEAR:
+        default:
+                return t;
+        }
+}
+
+static gboolean
+fade_frame_cb (gpointer user_data)
+{
+        GsdBacklightFade *fade = GSD_BACKLIGHT_FADE (user_data);
+        gint64 elapsed;
+        gdouble t;
+        gint value;
+
+        elapsed = (g_get_monotonic_time () - fade->start_time) / 1000;
+        t = fade->duration > 0 ? CLAMP ((gdouble) elapsed / fade->duration, 0.f, 1.f) : 1.f;
+
+        if (t < 1.f)
+                value = fade->from + (gint) floor ((fade->target - fade->from) * fade_progress (fade->curve, t) + 0.5);
+        else
+                value = fade->target;
+
+        fade->frames++;
+        writer_write (fade, value);
+
+        if (t < 1.f)
+                return G_SOURCE_CONTINUE;
+
+        fade->frame_id = 0;
+        if (!fade->write_in_flight)
+                fade_report (fade, "finished");
+        return G_SOURCE_REMOVE;
+}
+
+static void
+fade_stop_ramp (GsdBacklightFade *fade,
+                const gchar      *result)
+{
+        if (fade->frame_id == 0)
+                return;
+        g_source_remove (fade->frame_id);
+        fade->frame_id = 0;
+        fade_report (fade, result);
+}
+
+void
+gsd_backlight_fade_start (GsdBacklightFade      *fade,
+                          gint                   target,
+                          guint                  duration_ms,
+                          GsdBacklightFadeCurve  curve)
+{
+        g_return_if_fail (GSD_IS_BACKLIGHT_FADE (fade));
+
+        /* carry on from wherever a previous fade got to, keeping
+         * its queued frame */
+        fade->from = gsd_backlight_fade_get_level (fade);
+        fade_stop_ramp (fade, "interrupted");
+
+        fade->target = CLAMP (target, 0, gsd_backlight_state_get_max (fade->state));
+        fade->duration = duration_ms;
+        fade->curve = curve;
+        fade->start_time = g_get_monotonic_time ();
+        fade->report_pending = TRUE;
+        fade->frames = 0;
+        fade->writes = 0;
+        fade->coalesced = 0;
+
+        /* the writer drops duplicates, so restart from what the
+         * hardware has if it was changed behind our back */
+        fade->requested = fade->from;
+
+        g_debug ("starting backlight fade from %i to %i over %ums",
+                 fade->from, fade->target, duration_ms);
+        if (fade->from == fade->target || duration_ms == 0) {
+                fade_frame_cb (fade);
+                return;
+        }
+        fade->frame_id = g_timeout_add (GSD_BACKLIGHT_FADE_FRAME_MS, fade_frame_cb, fade);
+        g_source_set_name_by_id (fade->frame_id, "[gnome-settings-daemon] fade_frame_cb");
+}
+
+/* Stops the ramp where it is, dropping any queued frame so that it
+ * cannot land on top of a change made by the user. */
+void
+gsd_backlight_fade_stop (GsdBacklightFade *fade)
+{
+        g_return_if_fail (GSD_IS_BACKLIGHT_FADE (fade));
+
+        if (fade->write_queued >= 0) {
+                fade->write_queued = -1;
+                fade->requested = fade->issued;
+        }
+
+        fade_stop_ramp (fade, "stopped");
+}
+
+gboolean
+gsd_backlight_fade_is_running (GsdBacklightFade *fade)
+{
+        g_return_val_if_fail (GSD_IS_BACKLIGHT_FADE (fade), FALSE);
+
+        return fade->frame_id != 0;
+}
+
+/* The level the backlight is at, or will be at once the writer is idle */
+gint
+gsd_backlight_fade_get_level (GsdBacklightFade *fade)
+{
+        g_return_val_if_fail (GSD_IS_BACKLIGHT_FADE (fade), -1);
+
+        if (fade->frame_id != 0 || fade->write_in_flight)
+                return fade->requested;
+        return gsd_backlight_state_get_brightness (fade->state);
+}
+
+/* The level the backlight is heading to */
+gint
+gsd_backlight_fade_get_target (GsdBacklightFade *fade)
+{
+        g_return_val_if_fail (GSD_IS_BACKLIGHT_FADE (fade), -1);
+
+        if (fade->frame_id != 0)
+                return fade->target;
+        return gsd_backlight_fade_get_level (fade);
+}
+
+static void
+gsd_backlight_fade_finalize (GObject *object)
+{
+        GsdBacklightFade *fade = GSD_BACKLIGHT_FADE (object);
+
+        if (fade->frame_id != 0)
+                g_source_remove (fade->frame_id);
+        g_clear_object (&fade->rr_screen);
+        g_clear_object (&fade->state);
+
+        G_OBJECT_CLASS (gsd_backlight_fade_parent_class)->finalize (object);
+}
+
+static void
+gsd_backlight_fade_class_init (GsdBacklightFadeClass *klass)
+{
+        GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+        object_class->finalize = gsd_backlight_fade_finalize;
+}
+
+static void
+gsd_backlight_fade_init (GsdBacklightFade *fade)
+{
+        fade->requested = -1;
+        fade->issued = -1;
+        fade->write_queued = -1;
+}
+
+GsdBacklightFade *
+gsd_backlight_fade_new (GnomeRRScreen     *rr_screen,
+                        GsdBacklightState *state)
+{
+        GsdBacklightFade *fade;
+
+        g_return_val_if_fail (GSD_IS_BACKLIGHT_STATE (state), NULL);
+
+        fade = g_object_new (GSD_TYPE_BACKLIGHT_FADE, NULL);
+        fade->rr_screen = g_object_ref (rr_screen);
+        fade->state = g_object_ref (state);
+
+        return fade;
+}
@@ -0,0 +1,51 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __GSD_BACKLIGHT_FADE_H
+#define __GSD_BACKLIGHT_FADE_H
+
+#include <glib-object.h>
+
+#include "gsd-backlight-state.h"
+
+G_BEGIN_DECLS
+
+#define GSD_TYPE_BACKLIGHT_FADE (gsd_backlight_fade_get_type ())
+G_DECLARE_FINAL_TYPE (GsdBacklightFade, gsd_backlight_fade, GSD, BACKLIGHT_FADE, GObject)
+
+typedef enum {
+        GSD_BACKLIGHT_FADE_CURVE_LINEAR,
+        GSD_BACKLIGHT_FADE_CURVE_EASE_IN_OUT,
+        GSD_BACKLIGHT_FADE_CURVE_EASE_OUT
+} GsdBacklightFadeCurve;
+
+/* GnomeRRScreen comes from the includer, as for gpm-common.h */
+GsdBacklightFade *gsd_backlight_fade_new        (GnomeRRScreen         *rr_screen,
+                                                 GsdBacklightState     *state);
+
+void              gsd_backlight_fade_start      (GsdBacklightFade      *fade,
+                                                 gint                   target,
+                                                 guint                  duration_ms,
+                                                 GsdBacklightFadeCurve  curve);
+void              gsd_backlight_fade_stop       (GsdBacklightFade      *fade);
+gboolean          gsd_backlight_fade_is_running (GsdBacklightFade      *fade);
+gint              gsd_backlight_fade_get_level  (GsdBacklightFade      *fade);
+gint              gsd_backlight_fade_get_target (GsdBacklightFade      *fade);
+
+G_END_DECLS
+
+#endif /* __GSD_BACKLIGHT_FADE_H */
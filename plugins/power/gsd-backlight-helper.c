@@ -22,6 +22,7 @@
 #include "config.h"
 
 #include <stdlib.h>
+#include <stdio.h>
 #include <unistd.h>
 #include <glib-object.h>
 #include <locale.h>
@@ -134,6 +135,83 @@ clamp_minimum (gint max, gint value)
 	return MAX (value, minimum);
 }
 
+/* returns the value actually written, or -1 on failure */
+static gint
+gsd_backlight_helper_set (const gchar      *filename,
+			  GsdBacklightType  type,
+			  gint              max,
+			  gint              value,
+			  GError          **error)
+{
+	if (type == GSD_BACKLIGHT_TYPE_RAW)
+		value = clamp_minimum (max, value);
+
+	if (!gsd_backlight_helper_write (filename, value, error))
+		return -1;
+	return value;
+}
+
+/*
+ * Serve requests read from stdin, one per line, until stdin is closed:
+ *
+ *   get        -> current brightness
+ *   get-max    -> maximum brightness
+ *   set VALUE  -> the value actually written, after clamping
+ *
+ * Every reply is a single line, either the integer value or "ERROR" followed
+ * by a message. This lets the power plugin authorize through pkexec once and
+ * then reuse the helper for every brightness read and write.
+ */
+static guint
+gsd_backlight_helper_serve (const gchar *filename, GsdBacklightType type)
+{
+	gchar line[64];
+	gint max;
+	GError *error = NULL;
+
+	max = gsd_backlight_helper_get_max (filename, &error);
+	if (max < 0) {
+		g_print ("ERROR %s\n", error->message);
+		g_error_free (error);
+		return GSD_BACKLIGHT_HELPER_EXIT_CODE_FAILED;
+	}
+
+	while (fgets (line, sizeof (line), stdin) != NULL) {
+		gint value = -1;
+
+		g_strstrip (line);
+
+		if (g_strcmp0 (line, "get") == 0) {
+			value = gsd_backlight_helper_get (filename, &error);
+		} else if (g_strcmp0 (line, "get-max") == 0) {
+			value = max;
+		} else if (g_str_has_prefix (line, "set ")) {
+			gchar *endptr = NULL;
+			gint64 requested;
+
+			requested = g_ascii_strtoll (line + 4, &endptr, 10);
+			if (endptr == line + 4 || *endptr != '\0' ||
+			    requested < 0 || requested > max) {
+				g_set_error (&error, G_FILE_ERROR, G_FILE_ERROR_INVAL, "invalid value: %s", line + 4);
+			} else {
+				value = gsd_backlight_helper_set (filename, type, max, requested, &error);
+			}
+		} else {
+			g_set_error (&error, G_FILE_ERROR, G_FILE_ERROR_INVAL, "unknown request: %s", line);
+		}
+
+		if (value < 0) {
+			g_print ("ERROR %s\n", error->message);
+			g_clear_error (&error);
+		} else {
+			g_print ("%d\n", value);
+		}
+		fflush (stdout);
+	}
+
+	return GSD_BACKLIGHT_HELPER_EXIT_CODE_SUCCESS;
+}
+
 int
 main (int argc, char *argv[])
 {
@@ -145,6 +223,7 @@ main (int argc, char *argv[])
 	gint set_brightness = -1;
 	gboolean get_brightness = FALSE;
 	gboolean get_max_brightness = FALSE;
+	gboolean serve = FALSE;
 	gchar *filename = NULL;
 	GsdBacklightType type;
 
@@ -158,6 +237,9 @@ main (int argc, char *argv[])
 		{ "get-max-brightness", '\0', 0, G_OPTION_ARG_NONE, &get_max_brightness,
 		   /* command line argument */
 		  "Get the number of brightness levels supported", NULL },
+		{ "serve", '\0', 0, G_OPTION_ARG_NONE, &serve,
+		   /* command line argument */
+		  "Serve brightness requests read from standard input", NULL },
 		{ NULL}
 	};
 
@@ -174,7 +256,7 @@ main (int argc, char *argv[])
 #endif
 
 	/* no input */
-	if (set_brightness == -1 && !get_brightness && !get_max_brightness) {
+	if (set_brightness == -1 && !get_brightness && !get_max_brightness && !serve) {
 		g_print ("%s\n", "No valid option was specified");
 		retval = GSD_BACKLIGHT_HELPER_EXIT_CODE_ARGUMENTS_INVALID;
 		goto out;
@@ -238,10 +320,16 @@ main (int argc, char *argv[])
 		goto out;
 	}
 
+	/* Serve */
+	if (serve) {
+		retval = gsd_backlight_helper_serve (filename, type);
+		goto out;
+	}
+
 	/* SetBrightness */
 	if (set_brightness != -1) {
-		gboolean ret = FALSE;
 		gint max = gsd_backlight_helper_get_max (filename, &error);
+		gint value;
 
 		if (max < 0) {
 			g_print ("%s: %s\n",
@@ -252,11 +340,8 @@ main (int argc, char *argv[])
 			goto out;
 		}
 
-		if (type == GSD_BACKLIGHT_TYPE_RAW)
-			set_brightness = clamp_minimum (max, set_brightness);
-
-		ret = gsd_backlight_helper_write (filename, set_brightness, &error);
-		if (!ret) {
+		value = gsd_backlight_helper_set (filename, type, max, set_brightness, &error);
+		if (value < 0) {
 			g_print ("%s: %s\n",
 				 "Could not set the value of the backlight",
 				 error->message);
@@ -264,6 +349,9 @@ main (int argc, char *argv[])
 			retval = GSD_BACKLIGHT_HELPER_EXIT_CODE_ARGUMENTS_INVALID;
 			goto out;
 		}
+
+		/* the value actually written, after clamping */
+		g_print ("%d", value);
 	}
 
 	/* success */
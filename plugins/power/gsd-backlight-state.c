@@ -0,0 +1,248 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <glib.h>
+
+#ifdef HAVE_GUDEV
+#include <gudev/gudev.h>
+#endif
+
+#include "gsd-backlight-linux.h"
+#include "gsd-backlight-state.h"
+#include "gsd-power-manager.h"
+
+/*
+ * Caches the brightness and max_brightness of the backlight device picked by
+ * gsd_backlight_helper_get_best_backlight(), so that reading the brightness
+ * does not need the helper or any I/O.
+ *
+ * max_brightness never changes. brightness is updated when our own writes
+ * complete, and from udev change events on the device for changes made by
+ * the firmware, for example hotkeys handled by the BIOS. The brightness may
+ * be read and updated from the backlight worker thread.
+ */
+struct _GsdBacklightState
+{
+        GObject          parent_instance;
+
+        gchar           *path;          /* NULL when mocked */
+        gint             max;
+        volatile gint    brightness;
+        volatile gint    writes_in_flight;
+#ifdef HAVE_GUDEV
+        GUdevClient     *client;
+#endif
+};
+
+enum {
+        SIGNAL_CHANGED,
+
+        N_SIGNALS
+};
+
+static guint signals[N_SIGNALS] = { 0, };
+
+G_DEFINE_TYPE (GsdBacklightState, gsd_backlight_state, G_TYPE_OBJECT)
+
+static gint
+read_sysfs_value (const gchar  *path,
+                  const gchar  *attribute,
+                  GError      **error)
+{
+        gchar *filename;
+        gchar *contents = NULL;
+        gchar *endptr = NULL;
+        gint64 value = -1;
+
+        filename = g_build_filename (path, attribute, NULL);
+        if (!g_file_get_contents (filename, &contents, NULL, error))
+                goto out;
+
+        value = g_ascii_strtoll (contents, &endptr, 10);
+        if (endptr == contents || value < 0 || value > G_MAXINT) {
+                g_set_error (error,
+                             GSD_POWER_MANAGER_ERROR,
+                             GSD_POWER_MANAGER_ERROR_FAILED,
+                             "got invalid backlight value from %s", filename);
+                value = -1;
+        }
+out:
+        g_free (contents);
+        g_free (filename);
+        return value;
+}
+
+#ifdef HAVE_GUDEV
+static void
+gsd_backlight_state_uevent_cb (GUdevClient       *client,
+                               const gchar       *action,
+                               GUdevDevice       *device,
+                               GsdBacklightState *state)
+{
+        gint brightness;
+
+        if (g_strcmp0 (action, "change") != 0)
+                return;
+        if (g_strcmp0 (g_udev_device_get_sysfs_path (device), state->path) != 0)
+                return;
+
+        /* our own writes cause change events too, the cached value
+         * is updated when they complete */
+        if (g_atomic_int_get (&state->writes_in_flight) > 0)
+                return;
+
+        brightness = read_sysfs_value (state->path, "brightness", NULL);
+        if (brightness < 0 || brightness == g_atomic_int_get (&state->brightness))
+                return;
+
+        g_debug ("backlight changed externally to %i/%i", brightness, state->max);
+        g_atomic_int_set (&state->brightness, brightness);
+        g_signal_emit (state, signals[SIGNAL_CHANGED], 0, brightness);
+}
+#endif /* HAVE_GUDEV */
+
+static void
+gsd_backlight_state_finalize (GObject *object)
+{
+        GsdBacklightState *state = GSD_BACKLIGHT_STATE (object);
+
+#ifdef HAVE_GUDEV
+        g_clear_object (&state->client);
+#endif
+        g_free (state->path);
+
+        G_OBJECT_CLASS (gsd_backlight_state_parent_class)->finalize (object);
+}
+
+static void
+gsd_backlight_state_class_init (GsdBacklightStateClass *klass)
+{
+        GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+        object_class->finalize = gsd_backlight_state_finalize;
+
+        /* only emitted for changes that were not made through us */
+        signals[SIGNAL_CHANGED] = g_signal_new ("changed",
+                                                G_TYPE_FROM_CLASS (klass),
+                                                G_SIGNAL_RUN_LAST,
+                                                0,
+                                                NULL,
+                                                NULL,
+                                                NULL,
+                                                G_TYPE_NONE,
+                                                1, G_TYPE_INT);
+}
+
+static void
+gsd_backlight_state_init (GsdBacklightState *state)
+{
+        state->max = -1;
+        state->brightness = -1;
+}
+
+GsdBacklightState *
+gsd_backlight_state_new (GError **error)
+{
+        GsdBacklightState *state;
+#ifdef HAVE_GUDEV
+        const gchar * const subsystems[] = { "backlight", NULL };
+#endif
+
+        state = g_object_new (GSD_TYPE_BACKLIGHT_STATE, NULL);
+
+        state->path = gsd_backlight_helper_get_best_backlight (NULL);
+        if (state->path == NULL) {
+                g_set_error_literal (error,
+                                     GSD_POWER_MANAGER_ERROR,
+                                     GSD_POWER_MANAGER_ERROR_FAILED,
+                                     "No backlight devices present");
+                goto fail;
+        }
+
+        state->max = read_sysfs_value (state->path, "max_brightness", error);
+        if (state->max < 0)
+                goto fail;
+        state->brightness = read_sysfs_value (state->path, "brightness", error);
+        if (state->brightness < 0)
+                goto fail;
+
+#ifdef HAVE_GUDEV
+        state->client = g_udev_client_new (subsystems);
+        g_signal_connect (state->client, "uevent",
+                          G_CALLBACK (gsd_backlight_state_uevent_cb), state);
+#endif
+
+        g_debug ("tracking backlight %s at %i/%i", state->path, state->brightness, state->max);
+        return state;
+
+fail:
+        g_object_unref (state);
+        return NULL;
+}
+
+GsdBacklightState *
+gsd_backlight_state_new_mock (gint max,
+                              gint brightness)
+{
+        GsdBacklightState *state;
+
+        state = g_object_new (GSD_TYPE_BACKLIGHT_STATE, NULL);
+        state->max = max;
+        state->brightness = brightness;
+
+        return state;
+}
+
+gint
+gsd_backlight_state_get_brightness (GsdBacklightState *state)
+{
+        g_return_val_if_fail (GSD_IS_BACKLIGHT_STATE (state), -1);
+
+        return g_atomic_int_get (&state->brightness);
+}
+
+gint
+gsd_backlight_state_get_max (GsdBacklightState *state)
+{
+        g_return_val_if_fail (GSD_IS_BACKLIGHT_STATE (state), -1);
+
+        return state->max;
+}
+
+/* Every write to the backlight should be wrapped by write_begin() and
+ * write_end(), the latter with the value written or -1 on failure. */
+void
+gsd_backlight_state_write_begin (GsdBacklightState *state)
+{
+        g_return_if_fail (GSD_IS_BACKLIGHT_STATE (state));
+
+        g_atomic_int_inc (&state->writes_in_flight);
+}
+
+void
+gsd_backlight_state_write_end (GsdBacklightState *state,
+                               gint               brightness)
+{
+        g_return_if_fail (GSD_IS_BACKLIGHT_STATE (state));
+
+        if (brightness >= 0)
+                g_atomic_int_set (&state->brightness, brightness);
+        g_atomic_int_dec_and_test (&state->writes_in_flight);
+}
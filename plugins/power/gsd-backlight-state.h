@@ -0,0 +1,41 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __GSD_BACKLIGHT_STATE_H
+#define __GSD_BACKLIGHT_STATE_H
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define GSD_TYPE_BACKLIGHT_STATE (gsd_backlight_state_get_type ())
+G_DECLARE_FINAL_TYPE (GsdBacklightState, gsd_backlight_state, GSD, BACKLIGHT_STATE, GObject)
+
+GsdBacklightState *gsd_backlight_state_new             (GError **error);
+GsdBacklightState *gsd_backlight_state_new_mock        (gint max,
+                                                        gint brightness);
+
+gint               gsd_backlight_state_get_brightness  (GsdBacklightState *state);
+gint               gsd_backlight_state_get_max         (GsdBacklightState *state);
+
+void               gsd_backlight_state_write_begin     (GsdBacklightState *state);
+void               gsd_backlight_state_write_end       (GsdBacklightState *state,
+                                                        gint               brightness);
+
+G_END_DECLS
+
+#endif /* __GSD_BACKLIGHT_STATE_H */
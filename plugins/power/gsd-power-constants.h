@@ -30,6 +30,10 @@
 /* The dim delay under which we do not bother dimming */
 #define MINIMUM_IDLE_DIM_DELAY                          10 /* seconds */
 
+/* How long the backlight takes to fade to the idle level, and back */
+#define IDLE_DIM_FADE_DURATION                          1000 /* ms */
+#define IDLE_UNDIM_FADE_DURATION                        250 /* ms */
+
 /* The amount of time we'll undim if the machine is idle when plugged in */
 #define POWER_UP_TIME_ON_AC                             15 /* seconds */
 
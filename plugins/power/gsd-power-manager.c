@@ -24,6 +24,7 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 #include <glib/gi18n.h>
 #include <gtk/gtk.h>
 #include <libupower-glib/upower.h>
@@ -43,6 +44,7 @@
 #include "gsm-presence-flag.h"
 #include "gsm-manager-logout-mode.h"
 #include "gpm-common.h"
+#include "gsd-backlight-fade.h"
 #include "gnome-settings-profile.h"
 #include "gnome-settings-bus.h"
 #include "gsd-enums.h"
@@ -83,6 +85,18 @@
  * conditions, a hugher number may lead to noticable jitteryness */
 #define GSD_AMBIENT_SMOOTH          0.3f
 
+/* ambient light readings are coalesced and applied at this interval, or
+ * faster if ambient-max-write-rate allows more writes per second */
+#define GSD_AMBIENT_TICK_MS         100
+/* how far, in percent, the smoothed ambient brightness has to move away
+ * from the current target before we follow it; this stops the backlight
+ * from hunting around a steady light level */
+#define GSD_AMBIENT_HYSTERESIS      5.f
+/* smaller brightness changes, in percent, are not written */
+#define GSD_AMBIENT_MIN_DELTA       1.f
+/* number of ticks over which we ramp towards a new target */
+#define GSD_AMBIENT_RAMP_FRAMES     5
+
 static const gchar introspection_xml[] =
 "<node>"
 "  <interface name='org.gnome.SettingsDaemon.Power.Screen'>"
@@ -95,6 +109,11 @@ static const gchar introspection_xml[] =
 "      <arg type='i' name='new_percentage' direction='out'/>"
 "      <arg type='i' name='output_id' direction='out'/>"
 "    </method>"
+"    <method name='Step'>"
+"      <arg type='i' name='steps' direction='in'/>"
+"      <arg type='i' name='new_percentage' direction='out'/>"
+"      <arg type='i' name='output_id' direction='out'/>"
+"    </method>"
 "  </interface>"
 "  <interface name='org.gnome.SettingsDaemon.Power.Keyboard'>"
 "    <property name='Brightness' type='i' access='readwrite'/>"
@@ -104,6 +123,10 @@ static const gchar introspection_xml[] =
 "    <method name='StepDown'>"
 "      <arg type='i' name='new_percentage' direction='out'/>"
 "    </method>"
+"    <method name='Step'>"
+"      <arg type='i' name='steps' direction='in'/>"
+"      <arg type='i' name='new_percentage' direction='out'/>"
+"    </method>"
 "    <method name='Toggle'>"
 "      <arg type='i' name='new_percentage' direction='out'/>"
 "    </method>"
@@ -159,6 +182,7 @@ struct GsdPowerManagerPrivate
         /* Brightness */
         gboolean                 backlight_available;
         gint                     pre_dim_brightness; /* level, not percentage */
+        GsdBacklightFade        *backlight_fade;
 
         /* Keyboard */
         GDBusProxy              *upower_kbd_proxy;
@@ -175,6 +199,12 @@ struct GsdPowerManagerPrivate
         gdouble                  ambient_norm_value;
         gdouble                  ambient_percentage_old;
         gdouble                  ambient_last_absolute;
+        gboolean                 ambient_sample_pending;
+        gdouble                  ambient_target;
+        gdouble                  ambient_output;
+        gboolean                 ambient_write_pending;
+        gint64                   ambient_last_write;
+        guint                    ambient_tick_id;
 
         /* Sound */
         guint32                  critical_alert_timeout_id;
@@ -195,6 +225,11 @@ struct GsdPowerManagerPrivate
         guint                    idle_blank_id;
         guint                    idle_sleep_warning_id;
         guint                    idle_sleep_id;
+        guint                    idle_dim_timeout;      /* seconds, for the watches above */
+        guint                    idle_blank_timeout;
+        guint                    idle_sleep_warning_timeout;
+        guint                    idle_sleep_timeout;
+        guint                    idle_configure_id;
         GsdPowerIdleMode         current_idle_mode;
 
         guint                    temporary_unidle_on_ac_id;
@@ -219,6 +254,8 @@ static gboolean  idle_is_session_inhibited (GsdPowerManager *manager, guint mask
 static void      idle_triggered_idle_cb (GnomeIdleMonitor *monitor, guint watch_id, gpointer user_data);
 static void      idle_became_active_cb (GnomeIdleMonitor *monitor, guint watch_id, gpointer user_data);
 static void      iio_proxy_changed (GsdPowerManager *manager);
+static void      ambient_tick_stop (GsdPowerManager *manager);
+static gboolean  ambient_tick_cb (gpointer user_data);
 
 G_DEFINE_TYPE (GsdPowerManager, gsd_power_manager, G_TYPE_OBJECT)
 
@@ -1009,6 +1046,8 @@ iio_proxy_claim_light (GsdPowerManager *manager, gboolean active)
 
         if (active)
                 iio_proxy_changed (manager);
+        else
+                ambient_tick_stop (manager);
 }
 
 static void
@@ -1389,52 +1428,109 @@ backlight_iface_emit_changed (GsdPowerManager *manager,
                                        NULL);
 }
 
-static gboolean
-display_backlight_dim (GsdPowerManager *manager,
-                       gint idle_percentage,
-                       GError **error)
+static void
+display_backlight_undim_cb (GObject      *source_object,
+                            GAsyncResult *res,
+                            gpointer      user_data)
 {
-        gint min;
-        gint max;
-        gint now;
-        gint idle;
-        gboolean ret = FALSE;
-
-        if (!manager->priv->backlight_available)
-                return TRUE;
+        GError *error = NULL;
 
-        now = backlight_get_abs (manager->priv->rr_screen, error);
-        if (now < 0) {
-                goto out;
+        if (!backlight_set_abs_finish (GNOME_RR_SCREEN (source_object), res, &error)) {
+                if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+                        g_warning ("failed to restore backlight: %s", error->message);
+                g_error_free (error);
         }
+}
 
-        /* is the dim brightness actually *dimmer* than the
-         * brightness we have now? */
-        min = backlight_get_min (manager->priv->rr_screen);
-        max = backlight_get_max (manager->priv->rr_screen, error);
-        if (max < 0) {
-                goto out;
-        }
-        idle = PERCENTAGE_TO_ABS (min, max, idle_percentage);
-        if (idle > now) {
-                g_debug ("brightness already now %i/%i, so "
-                         "ignoring dim to %i/%i",
-                         now, max, idle, max);
-                ret = TRUE;
-                goto out;
+static void
+display_backlight_undim (GsdPowerManager *manager)
+{
+        if (manager->priv->pre_dim_brightness < 0)
+                return;
+
+        /* this also takes over from a dim that is still fading */
+        if (manager->priv->backlight_fade != NULL) {
+                gsd_backlight_fade_start (manager->priv->backlight_fade,
+                                          manager->priv->pre_dim_brightness,
+                                          IDLE_UNDIM_FADE_DURATION,
+                                          GSD_BACKLIGHT_FADE_CURVE_EASE_OUT);
+                manager->priv->pre_dim_brightness = -1;
+                return;
         }
-        ret = backlight_set_abs (manager->priv->rr_screen,
-                                 idle,
-                                 error);
-        if (!ret) {
-                goto out;
+
+        backlight_set_abs_async (manager->priv->rr_screen,
+                                 manager->priv->pre_dim_brightness,
+                                 manager->priv->cancellable,
+                                 display_backlight_undim_cb,
+                                 manager);
+        manager->priv->pre_dim_brightness = -1;
+}
+
+static void
+display_backlight_dim_cb (GObject      *source_object,
+                          GAsyncResult *res,
+                          gpointer      user_data)
+{
+        GsdPowerManager *manager = GSD_POWER_MANAGER (user_data);
+        GError *error = NULL;
+        gint pre_dim;
+
+        if (!backlight_dim_finish (GNOME_RR_SCREEN (source_object), res, &pre_dim, &error)) {
+                if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+                        g_warning ("failed to set dim backlight: %s", error->message);
+                g_error_free (error);
+                return;
         }
 
+        /* brightness was already lower than the dim level */
+        if (pre_dim < 0)
+                return;
+
         /* save for undim */
-        manager->priv->pre_dim_brightness = now;
+        manager->priv->pre_dim_brightness = pre_dim;
 
-out:
-        return ret;
+        /* the user became active while we were dimming */
+        if (manager->priv->current_idle_mode == GSD_POWER_IDLE_MODE_NORMAL)
+                display_backlight_undim (manager);
+}
+
+static void
+display_backlight_dim (GsdPowerManager *manager,
+                       gint idle_percentage)
+{
+        GsdBacklightFade *fade = manager->priv->backlight_fade;
+        gint idle;
+        gint max;
+        gint now;
+
+        if (!manager->priv->backlight_available)
+                return;
+
+        if (fade != NULL) {
+                /* if we are still undimming, the level we were
+                 * heading to is the one to come back to */
+                now = gsd_backlight_fade_get_target (fade);
+                max = gsd_backlight_state_get_max (backlight_get_state ());
+                idle = PERCENTAGE_TO_ABS (0, max, idle_percentage);
+                if (idle > now) {
+                        g_debug ("brightness already now %i/%i, so "
+                                 "ignoring dim request of %i%%",
+                                 now, max, idle_percentage);
+                        return;
+                }
+                manager->priv->pre_dim_brightness = now;
+                gsd_backlight_fade_start (fade,
+                                          idle,
+                                          IDLE_DIM_FADE_DURATION,
+                                          GSD_BACKLIGHT_FADE_CURVE_EASE_IN_OUT);
+                return;
+        }
+
+        backlight_dim_async (manager->priv->rr_screen,
+                             idle_percentage,
+                             manager->priv->cancellable,
+                             display_backlight_dim_cb,
+                             manager);
 }
 
 static gboolean
@@ -1561,13 +1657,7 @@ idle_set_mode (GsdPowerManager *manager, GsdPowerIdleMode mode)
                 /* display backlight */
                 idle_percentage = g_settings_get_int (manager->priv->settings,
                                                       "idle-brightness");
-                ret = display_backlight_dim (manager, idle_percentage, &error);
-                if (!ret) {
-                        g_warning ("failed to set dim backlight to %i%%: %s",
-                                   idle_percentage,
-                                   error->message);
-                        g_clear_error (&error);
-                }
+                display_backlight_dim (manager, idle_percentage);
 
                 /* keyboard backlight */
                 ret = kbd_backlight_dim (manager, idle_percentage, &error);
@@ -1611,19 +1701,7 @@ idle_set_mode (GsdPowerManager *manager, GsdPowerIdleMode mode)
                 backlight_enable (manager);
 
                 /* reset brightness if we dimmed */
-                if (manager->priv->pre_dim_brightness >= 0) {
-                        ret = backlight_set_abs (manager->priv->rr_screen,
-                                                 manager->priv->pre_dim_brightness,
-                                                 &error);
-                        if (!ret) {
-                                g_warning ("failed to restore backlight to %i: %s",
-                                           manager->priv->pre_dim_brightness,
-                                           error->message);
-                                g_clear_error (&error);
-                        } else {
-                                manager->priv->pre_dim_brightness = -1;
-                        }
-                }
+                display_backlight_undim (manager);
 
                 /* only toggle keyboard if present and already toggled off */
                 if (manager->priv->upower_kbd_proxy &&
@@ -1687,12 +1765,36 @@ clear_idle_watch (GnomeIdleMonitor *monitor,
         *id = 0;
 }
 
+/* Each watch costs a round-trip to the idle monitor, so only replace
+ * it when its timeout changes. A timeout of 0 means no watch. */
+static void
+set_idle_watch (GsdPowerManager *manager,
+                guint           *id,
+                guint           *current_timeout,
+                guint            timeout)
+{
+        if (*id != 0 && *current_timeout == timeout)
+                return;
+        clear_idle_watch (manager->priv->idle_monitor, id);
+        *current_timeout = 0;
+        if (timeout == 0)
+                return;
+
+        *id = gnome_idle_monitor_add_idle_watch (manager->priv->idle_monitor,
+                                                 timeout * 1000,
+                                                 idle_triggered_idle_cb, manager, NULL);
+        if (*id != 0)
+                *current_timeout = timeout;
+}
+
 static void
 idle_configure (GsdPowerManager *manager)
 {
         gboolean is_idle_inhibited;
         GsdPowerActionType action_type;
+        guint timeout_blank;
         guint timeout_sleep;
+        guint timeout_sleep_warning;
         guint timeout_dim;
         gboolean on_battery;
 
@@ -1705,19 +1807,19 @@ idle_configure (GsdPowerManager *manager)
 
         /* set up blank callback only when the screensaver is on,
          * as it's what will drive the blank */
-        clear_idle_watch (manager->priv->idle_monitor,
-                          &manager->priv->idle_blank_id);
+        timeout_blank = 0;
         if (manager->priv->screensaver_active) {
                 /* The tail is wagging the dog.
                  * The screensaver coming on will blank the screen.
                  * If an event occurs while the screensaver is on,
                  * the aggressive idle watch will handle it */
-                guint timeout_blank = SCREENSAVER_TIMEOUT_BLANK;
+                timeout_blank = SCREENSAVER_TIMEOUT_BLANK;
                 g_debug ("setting up blank callback for %is", timeout_blank);
-                manager->priv->idle_blank_id = gnome_idle_monitor_add_idle_watch (manager->priv->idle_monitor,
-                                                                                  timeout_blank * 1000,
-                                                                                  idle_triggered_idle_cb, manager, NULL);
         }
+        set_idle_watch (manager,
+                        &manager->priv->idle_blank_id,
+                        &manager->priv->idle_blank_timeout,
+                        timeout_blank);
 
         /* are we inhibited from going idle */
         if (!manager->priv->session_is_active || is_idle_inhibited) {
@@ -1727,12 +1829,18 @@ idle_configure (GsdPowerManager *manager)
                         g_debug ("inactive, so using normal state");
                 idle_set_mode (manager, GSD_POWER_IDLE_MODE_NORMAL);
 
-                clear_idle_watch (manager->priv->idle_monitor,
-                                  &manager->priv->idle_sleep_id);
-                clear_idle_watch (manager->priv->idle_monitor,
-                                  &manager->priv->idle_dim_id);
-                clear_idle_watch (manager->priv->idle_monitor,
-                                  &manager->priv->idle_sleep_warning_id);
+                set_idle_watch (manager,
+                                &manager->priv->idle_sleep_id,
+                                &manager->priv->idle_sleep_timeout,
+                                0);
+                set_idle_watch (manager,
+                                &manager->priv->idle_dim_id,
+                                &manager->priv->idle_dim_timeout,
+                                0);
+                set_idle_watch (manager,
+                                &manager->priv->idle_sleep_warning_id,
+                                &manager->priv->idle_sleep_warning_timeout,
+                                0);
                 notify_close_if_showing (&manager->priv->notification_sleep_warning);
                 return;
         }
@@ -1750,38 +1858,31 @@ idle_configure (GsdPowerManager *manager)
                 timeout_sleep = CLAMP (timeout_sleep_, 0, G_MAXINT);
         }
 
-        clear_idle_watch (manager->priv->idle_monitor,
-                          &manager->priv->idle_sleep_id);
-        clear_idle_watch (manager->priv->idle_monitor,
-                          &manager->priv->idle_sleep_warning_id);
-
+        timeout_sleep_warning = 0;
         if (timeout_sleep != 0) {
                 g_debug ("setting up sleep callback %is", timeout_sleep);
 
-                if (action_type != GSD_POWER_ACTION_NOTHING) {
-                        manager->priv->idle_sleep_id = gnome_idle_monitor_add_idle_watch (manager->priv->idle_monitor,
-                                                                                          timeout_sleep * 1000,
-                                                                                          idle_triggered_idle_cb, manager, NULL);
-                }
-
                 if (action_type == GSD_POWER_ACTION_LOGOUT ||
                     action_type == GSD_POWER_ACTION_SUSPEND ||
                     action_type == GSD_POWER_ACTION_HIBERNATE) {
-                        guint timeout_sleep_warning;
-
                         manager->priv->sleep_action_type = action_type;
                         timeout_sleep_warning = timeout_sleep * IDLE_DELAY_TO_IDLE_DIM_MULTIPLIER;
                         if (timeout_sleep_warning < MINIMUM_IDLE_DIM_DELAY)
                                 timeout_sleep_warning = 0;
 
                         g_debug ("setting up sleep warning callback %is", timeout_sleep_warning);
-
-                        manager->priv->idle_sleep_warning_id = gnome_idle_monitor_add_idle_watch (manager->priv->idle_monitor,
-                                                                                                  timeout_sleep_warning * 1000,
-                                                                                                  idle_triggered_idle_cb, manager, NULL);
                 }
         }
 
+        set_idle_watch (manager,
+                        &manager->priv->idle_sleep_id,
+                        &manager->priv->idle_sleep_timeout,
+                        action_type != GSD_POWER_ACTION_NOTHING ? timeout_sleep : 0);
+        set_idle_watch (manager,
+                        &manager->priv->idle_sleep_warning_id,
+                        &manager->priv->idle_sleep_warning_timeout,
+                        timeout_sleep_warning);
+
         if (manager->priv->idle_sleep_warning_id == 0)
                 notify_close_if_showing (&manager->priv->notification_sleep_warning);
 
@@ -1812,16 +1913,33 @@ idle_configure (GsdPowerManager *manager)
                 }
         }
 
-        clear_idle_watch (manager->priv->idle_monitor,
-                          &manager->priv->idle_dim_id);
-
-        if (timeout_dim != 0) {
+        if (timeout_dim != 0)
                 g_debug ("setting up dim callback for %is", timeout_dim);
+        set_idle_watch (manager,
+                        &manager->priv->idle_dim_id,
+                        &manager->priv->idle_dim_timeout,
+                        timeout_dim);
+}
 
-                manager->priv->idle_dim_id = gnome_idle_monitor_add_idle_watch (manager->priv->idle_monitor,
-                                                                                timeout_dim * 1000,
-                                                                                idle_triggered_idle_cb, manager, NULL);
-        }
+static gboolean
+idle_configure_idle_cb (gpointer user_data)
+{
+        GsdPowerManager *manager = GSD_POWER_MANAGER (user_data);
+
+        manager->priv->idle_configure_id = 0;
+        idle_configure (manager);
+        return G_SOURCE_REMOVE;
+}
+
+/* Settings and inhibitors tend to change in bursts, so only
+ * reconfigure once they have all been processed */
+static void
+idle_configure_queue (GsdPowerManager *manager)
+{
+        if (manager->priv->idle_configure_id != 0)
+                return;
+        manager->priv->idle_configure_id = g_idle_add (idle_configure_idle_cb, manager);
+        g_source_set_name_by_id (manager->priv->idle_configure_id, "[gnome-settings-daemon] idle_configure_idle_cb");
 }
 
 static void
@@ -2177,7 +2295,7 @@ engine_settings_key_changed_cb (GSettings *settings,
         if (g_str_has_prefix (key, "sleep-inactive") ||
             g_str_equal (key, "idle-delay") ||
             g_str_equal (key, "idle-dim")) {
-                idle_configure (manager);
+                idle_configure_queue (manager);
                 return;
         }
 }
@@ -2213,7 +2331,7 @@ engine_session_properties_changed_cb (GDBusProxy      *session,
         if (v) {
                 g_variant_unref (v);
                 g_debug ("Received gnome session inhibitor change");
-                idle_configure (manager);
+                idle_configure_queue (manager);
         }
 }
 
@@ -2413,6 +2531,47 @@ logind_proxy_signal_cb (GDBusProxy  *proxy,
         }
 }
 
+static void
+backlight_state_changed_cb (GsdBacklightState *state,
+                            gint               brightness,
+                            GsdPowerManager   *manager)
+{
+        gint percentage;
+
+        /* the user is in control now */
+        if (manager->priv->backlight_fade != NULL)
+                gsd_backlight_fade_stop (manager->priv->backlight_fade);
+
+        percentage = ABS_TO_PERCENTAGE (0, gsd_backlight_state_get_max (state), brightness);
+        g_debug ("brightness changed by firmware to %i%%", percentage);
+        backlight_iface_emit_changed (manager, GSD_POWER_DBUS_INTERFACE_SCREEN, percentage, NULL);
+
+        /* ambient brightness no longer valid */
+        manager->priv->ambient_percentage_old = percentage;
+        manager->priv->ambient_norm_required = TRUE;
+}
+
+static void
+initial_brightness_cb (GObject      *source_object,
+                       GAsyncResult *res,
+                       gpointer      user_data)
+{
+        GsdPowerManager *manager;
+        GError *error = NULL;
+        gint value;
+
+        value = backlight_get_percentage_finish (GNOME_RR_SCREEN (source_object), res, &error);
+        if (error != NULL && g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+                g_error_free (error);
+                return;
+        }
+        g_clear_error (&error);
+
+        manager = GSD_POWER_MANAGER (user_data);
+        manager->priv->ambient_percentage_old = value;
+        backlight_iface_emit_changed (manager, GSD_POWER_DBUS_INTERFACE_SCREEN, value, NULL);
+}
+
 static void
 on_rr_screen_acquired (GObject      *object,
                        GAsyncResult *result,
@@ -2442,6 +2601,12 @@ on_rr_screen_acquired (GObject      *object,
 
         /* check whether a backlight is available */
         manager->priv->backlight_available = backlight_available (manager->priv->rr_screen);
+        if (manager->priv->backlight_available && backlight_get_state () != NULL) {
+                g_signal_connect (backlight_get_state (), "changed",
+                                  G_CALLBACK (backlight_state_changed_cb), manager);
+                manager->priv->backlight_fade = gsd_backlight_fade_new (manager->priv->rr_screen,
+                                                                        backlight_get_state ());
+        }
 
         /* Set up a delay inhibitor to be informed about suspend attempts */
         g_signal_connect (manager->priv->logind_proxy, "g-signal",
@@ -2518,9 +2683,10 @@ on_rr_screen_acquired (GObject      *object,
            (likely, considering that to get here we need a reply from gnome-shell)
         */
         if (manager->priv->backlight_available) {
-                manager->priv->ambient_percentage_old = backlight_get_percentage (manager->priv->rr_screen, NULL);
-                backlight_iface_emit_changed (manager, GSD_POWER_DBUS_INTERFACE_SCREEN,
-                                              manager->priv->ambient_percentage_old, NULL);
+                backlight_get_percentage_async (manager->priv->rr_screen,
+                                                manager->priv->cancellable,
+                                                initial_brightness_cb,
+                                                manager);
         } else {
                 backlight_iface_emit_changed (manager, GSD_POWER_DBUS_INTERFACE_SCREEN, -1, NULL);
         }
@@ -2529,31 +2695,72 @@ on_rr_screen_acquired (GObject      *object,
 }
 
 static void
-iio_proxy_changed (GsdPowerManager *manager)
+iio_proxy_brightness_set_cb (GObject      *source_object,
+                             GAsyncResult *res,
+                             gpointer      user_data)
 {
+        GsdPowerManager *manager;
         GError *error = NULL;
-        GVariant *val_has = NULL;
-        GVariant *val_als = NULL;
-        gdouble brightness;
         gint pc;
 
-        /* no display hardware */
-        if (!manager->priv->backlight_available)
+        pc = backlight_set_percentage_finish (GNOME_RR_SCREEN (source_object), res, &error);
+        if (pc < 0 && g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+                g_error_free (error);
                 return;
+        }
 
-        /* disabled */
-        if (!g_settings_get_boolean (manager->priv->settings, "ambient-enabled"))
+        manager = GSD_POWER_MANAGER (user_data);
+        manager->priv->ambient_write_pending = FALSE;
+
+        if (pc < 0) {
+                g_warning ("failed to set brightness: %s", error->message);
+                g_error_free (error);
                 return;
+        }
 
-        /* get latest results, which do not have to be Lux */
-        val_has = g_dbus_proxy_get_cached_property (manager->priv->iio_proxy, "HasAmbientLight");
-        if (val_has == NULL || !g_variant_get_boolean (val_has))
-                goto out;
-        val_als = g_dbus_proxy_get_cached_property (manager->priv->iio_proxy, "LightLevel");
-        if (val_als == NULL || g_variant_get_double (val_als) == 0.0)
-                goto out;
-        manager->priv->ambient_last_absolute = g_variant_get_double (val_als);
-        g_debug ("Read last absolute light level: %f", manager->priv->ambient_last_absolute);
+        /* the value actually set after rounding to a hardware level,
+         * unless the user changed the brightness in the meantime */
+        if (!manager->priv->ambient_norm_required)
+                manager->priv->ambient_percentage_old = pc;
+}
+
+/*
+ * The ambient light pipeline: sensor readings only record the latest light
+ * level, and a tick running while there is work to do folds them into the
+ * exponential moving average, applies hysteresis to pick a target and ramps
+ * the backlight towards it over a few frames. At most one write is in flight
+ * at any time, and writes are capped at the ambient-max-write-rate setting.
+ */
+static void
+ambient_tick_stop (GsdPowerManager *manager)
+{
+        if (manager->priv->ambient_tick_id == 0)
+                return;
+        g_source_remove (manager->priv->ambient_tick_id);
+        manager->priv->ambient_tick_id = 0;
+}
+
+static void
+ambient_tick_start (GsdPowerManager *manager)
+{
+        guint max_rate;
+        guint interval;
+
+        if (manager->priv->ambient_tick_id != 0)
+                return;
+
+        /* tick at least as often as we are allowed to write */
+        max_rate = g_settings_get_uint (manager->priv->settings, "ambient-max-write-rate");
+        interval = MIN (GSD_AMBIENT_TICK_MS, 1000 / MAX (max_rate, 1));
+
+        manager->priv->ambient_tick_id = g_timeout_add (interval, ambient_tick_cb, manager);
+        g_source_set_name_by_id (manager->priv->ambient_tick_id, "[gnome-settings-daemon] ambient_tick_cb");
+}
+
+static void
+ambient_update_target (GsdPowerManager *manager)
+{
+        gdouble brightness;
 
         /* the user has asked to renormalize */
         if (manager->priv->ambient_norm_required) {
@@ -2572,17 +2779,112 @@ iio_proxy_changed (GsdPowerManager *manager)
 
         /* no valid readings yet */
         if (manager->priv->ambient_accumulator < 0.f)
-                goto out;
+                return;
 
-        /* set new value */
-        g_debug ("Setting brightness from ambient %.1f%%",
-                 manager->priv->ambient_accumulator);
-        pc = manager->priv->ambient_accumulator;
-        if (!backlight_set_percentage (manager->priv->rr_screen, &pc, &error)) {
-                g_warning ("failed to set brightness: %s", error->message);
-                g_error_free (error);
+        /* only follow changes that are big enough */
+        if (manager->priv->ambient_target < 0.f ||
+            fabs (manager->priv->ambient_accumulator - manager->priv->ambient_target) >= GSD_AMBIENT_HYSTERESIS) {
+                g_debug ("New ambient brightness target %.1f%%",
+                         manager->priv->ambient_accumulator);
+                manager->priv->ambient_target = manager->priv->ambient_accumulator;
         }
-        manager->priv->ambient_percentage_old = pc;
+}
+
+static gboolean
+ambient_tick_cb (gpointer user_data)
+{
+        GsdPowerManager *manager = GSD_POWER_MANAGER (user_data);
+        gdouble delta;
+        gdouble step;
+        gint64 now;
+        guint max_rate;
+
+        /* the brightness was changed by the user, stop any ramp there */
+        if (manager->priv->ambient_norm_required) {
+                manager->priv->ambient_target = manager->priv->ambient_percentage_old;
+                manager->priv->ambient_output = manager->priv->ambient_percentage_old;
+        }
+
+        if (manager->priv->ambient_sample_pending) {
+                manager->priv->ambient_sample_pending = FALSE;
+                ambient_update_target (manager);
+        }
+
+        if (manager->priv->ambient_target < 0.f)
+                goto done;
+
+        if (manager->priv->ambient_output < 0.f)
+                manager->priv->ambient_output = manager->priv->ambient_percentage_old;
+        if (manager->priv->ambient_output < 0.f)
+                manager->priv->ambient_output = manager->priv->ambient_target;
+
+        /* close enough, nothing left to do until the next reading */
+        delta = manager->priv->ambient_target - manager->priv->ambient_output;
+        if (fabs (delta) < GSD_AMBIENT_MIN_DELTA)
+                goto done;
+
+        /* wait for the previous frame to reach the hardware, and
+         * don't fight an idle fade */
+        if (manager->priv->ambient_write_pending)
+                return G_SOURCE_CONTINUE;
+        if (manager->priv->backlight_fade != NULL &&
+            gsd_backlight_fade_is_running (manager->priv->backlight_fade))
+                return G_SOURCE_CONTINUE;
+
+        now = g_get_monotonic_time ();
+        max_rate = g_settings_get_uint (manager->priv->settings, "ambient-max-write-rate");
+        if (now - manager->priv->ambient_last_write < G_USEC_PER_SEC / MAX (max_rate, 1))
+                return G_SOURCE_CONTINUE;
+
+        /* ramp, but never in steps smaller than we would write */
+        step = delta / GSD_AMBIENT_RAMP_FRAMES;
+        if (fabs (step) < GSD_AMBIENT_MIN_DELTA)
+                step = (delta > 0) ? MIN (delta, GSD_AMBIENT_MIN_DELTA) : MAX (delta, -GSD_AMBIENT_MIN_DELTA);
+        manager->priv->ambient_output += step;
+
+        g_debug ("Setting brightness from ambient %.1f%% (target %.1f%%)",
+                 manager->priv->ambient_output, manager->priv->ambient_target);
+        manager->priv->ambient_write_pending = TRUE;
+        manager->priv->ambient_last_write = now;
+        backlight_set_percentage_async (manager->priv->rr_screen,
+                                        (gint) (manager->priv->ambient_output + 0.5),
+                                        manager->priv->cancellable,
+                                        iio_proxy_brightness_set_cb,
+                                        manager);
+        return G_SOURCE_CONTINUE;
+
+done:
+        manager->priv->ambient_tick_id = 0;
+        return G_SOURCE_REMOVE;
+}
+
+static void
+iio_proxy_changed (GsdPowerManager *manager)
+{
+        GVariant *val_has = NULL;
+        GVariant *val_als = NULL;
+
+        /* no display hardware */
+        if (!manager->priv->backlight_available)
+                return;
+
+        /* disabled */
+        if (!g_settings_get_boolean (manager->priv->settings, "ambient-enabled"))
+                return;
+
+        /* get latest results, which do not have to be Lux */
+        val_has = g_dbus_proxy_get_cached_property (manager->priv->iio_proxy, "HasAmbientLight");
+        if (val_has == NULL || !g_variant_get_boolean (val_has))
+                goto out;
+        val_als = g_dbus_proxy_get_cached_property (manager->priv->iio_proxy, "LightLevel");
+        if (val_als == NULL || g_variant_get_double (val_als) == 0.0)
+                goto out;
+        manager->priv->ambient_last_absolute = g_variant_get_double (val_als);
+        g_debug ("Read last absolute light level: %f", manager->priv->ambient_last_absolute);
+
+        /* processed on the next tick */
+        manager->priv->ambient_sample_pending = TRUE;
+        ambient_tick_start (manager);
 out:
         g_clear_pointer (&val_has, g_variant_unref);
         g_clear_pointer (&val_als, g_variant_unref);
@@ -2682,6 +2984,9 @@ gsd_power_manager_start (GsdPowerManager *manager,
         manager->priv->ambient_norm_value = -1.f;
         manager->priv->ambient_percentage_old = -1.f;
         manager->priv->ambient_last_absolute = -1.f;
+        manager->priv->ambient_target = -1.f;
+        manager->priv->ambient_output = -1.f;
+        manager->priv->ambient_write_pending = FALSE;
 
         gnome_settings_profile_end (NULL);
         return TRUE;
@@ -2716,6 +3021,9 @@ gsd_power_manager_stop (GsdPowerManager *manager)
         g_clear_object (&manager->priv->up_client);
 
         iio_proxy_claim_light (manager, FALSE);
+        ambient_tick_stop (manager);
+        /* the write in flight was cancelled above */
+        manager->priv->ambient_write_pending = FALSE;
         g_clear_object (&manager->priv->iio_proxy);
 
         if (manager->priv->inhibit_lid_switch_fd != -1) {
@@ -2730,8 +3038,16 @@ gsd_power_manager_stop (GsdPowerManager *manager)
         }
 
         g_clear_object (&manager->priv->logind_proxy);
+
+        if (manager->priv->backlight_fade != NULL) {
+                gsd_backlight_fade_stop (manager->priv->backlight_fade);
+                g_clear_object (&manager->priv->backlight_fade);
+        }
         g_clear_object (&manager->priv->rr_screen);
 
+        if (manager->priv->backlight_available && backlight_get_state () != NULL)
+                g_signal_handlers_disconnect_by_data (backlight_get_state (), manager);
+
         g_clear_pointer (&manager->priv->devices_array, g_ptr_array_unref);
         g_clear_object (&manager->priv->device_composite);
 
@@ -2739,6 +3055,21 @@ gsd_power_manager_stop (GsdPowerManager *manager)
 
         play_loop_stop (&manager->priv->critical_alert_timeout_id);
 
+        if (manager->priv->idle_configure_id != 0) {
+                g_source_remove (manager->priv->idle_configure_id);
+                manager->priv->idle_configure_id = 0;
+        }
+        /* the watches belong to this monitor, a restart adds them afresh */
+        if (manager->priv->idle_monitor != NULL) {
+                clear_idle_watch (manager->priv->idle_monitor, &manager->priv->idle_dim_id);
+                clear_idle_watch (manager->priv->idle_monitor, &manager->priv->idle_blank_id);
+                clear_idle_watch (manager->priv->idle_monitor, &manager->priv->idle_sleep_warning_id);
+                clear_idle_watch (manager->priv->idle_monitor, &manager->priv->idle_sleep_id);
+        }
+        manager->priv->idle_dim_timeout = 0;
+        manager->priv->idle_blank_timeout = 0;
+        manager->priv->idle_sleep_warning_timeout = 0;
+        manager->priv->idle_sleep_timeout = 0;
         g_clear_object (&manager->priv->idle_monitor);
         g_clear_object (&manager->priv->upower_kbd_proxy);
 
@@ -2784,6 +3115,16 @@ handle_method_call_keyboard (GsdPowerManager *manager,
                 value = MAX (manager->priv->kbd_brightness_now - step, 0);
                 ret = upower_kbd_set_brightness (manager, value, &error);
 
+        } else if (g_strcmp0 (method_name, "Step") == 0) {
+                gint steps;
+
+                g_variant_get (parameters, "(i)", &steps);
+                g_debug ("keyboard step by %i", steps);
+                step = BRIGHTNESS_STEP_AMOUNT (manager->priv->kbd_brightness_max);
+                value = CLAMP (manager->priv->kbd_brightness_now + steps * step,
+                               0, manager->priv->kbd_brightness_max);
+                ret = upower_kbd_set_brightness (manager, value, &error);
+
         } else if (g_strcmp0 (method_name, "Toggle") == 0) {
                 value = upower_kbd_toggle (manager, &error);
                 ret = (value >= 0);
@@ -2808,50 +3149,86 @@ handle_method_call_keyboard (GsdPowerManager *manager,
         }
 }
 
+static void
+backlight_step_cb (GObject      *source_object,
+                   GAsyncResult *res,
+                   gpointer      user_data)
+{
+        GDBusMethodInvocation *invocation = G_DBUS_METHOD_INVOCATION (user_data);
+        GsdPowerManager *manager;
+        const gchar *method_name;
+        GError *error = NULL;
+        gint value;
+
+        method_name = g_dbus_method_invocation_get_method_name (invocation);
+        if (g_strcmp0 (method_name, "StepUp") == 0)
+                value = backlight_step_up_finish (GNOME_RR_SCREEN (source_object), res, &error);
+        else if (g_strcmp0 (method_name, "StepDown") == 0)
+                value = backlight_step_down_finish (GNOME_RR_SCREEN (source_object), res, &error);
+        else
+                value = backlight_step_finish (GNOME_RR_SCREEN (source_object), res, &error);
+
+        if (value < 0) {
+                g_dbus_method_invocation_take_error (invocation, error);
+                return;
+        }
+
+        manager = GSD_POWER_MANAGER (g_dbus_method_invocation_get_user_data (invocation));
+        backlight_iface_emit_changed (manager, GSD_POWER_DBUS_INTERFACE_SCREEN, value, NULL);
+
+        /* ambient brightness no longer valid */
+        manager->priv->ambient_percentage_old = value;
+        manager->priv->ambient_norm_required = TRUE;
+
+        g_dbus_method_invocation_return_value (invocation,
+                                               g_variant_new ("(ii)",
+                                                              value,
+                                                              backlight_get_output_id (manager->priv->rr_screen)));
+}
+
 static void
 handle_method_call_screen (GsdPowerManager *manager,
                            const gchar *method_name,
                            GVariant *parameters,
                            GDBusMethodInvocation *invocation)
 {
-        gint value = -1;
-        GError *error = NULL;
-
         if (!manager->priv->backlight_available) {
-               g_set_error_literal (&error,
-                                    GSD_POWER_MANAGER_ERROR,
-                                    GSD_POWER_MANAGER_ERROR_FAILED,
-                                    "Screen backlight not available");
-                goto out;
+                g_dbus_method_invocation_return_error_literal (invocation,
+                                                               GSD_POWER_MANAGER_ERROR,
+                                                               GSD_POWER_MANAGER_ERROR_FAILED,
+                                                               "Screen backlight not available");
+                return;
         }
 
+        if (manager->priv->backlight_fade != NULL)
+                gsd_backlight_fade_stop (manager->priv->backlight_fade);
+
         if (g_strcmp0 (method_name, "StepUp") == 0) {
                 g_debug ("screen step up");
-                value = backlight_step_up (manager->priv->rr_screen, &error);
-                backlight_iface_emit_changed (manager, GSD_POWER_DBUS_INTERFACE_SCREEN, value, NULL);
+                backlight_step_up_async (manager->priv->rr_screen,
+                                         manager->priv->cancellable,
+                                         backlight_step_cb,
+                                         invocation);
         } else if (g_strcmp0 (method_name, "StepDown") == 0) {
                 g_debug ("screen step down");
-                value = backlight_step_down (manager->priv->rr_screen, &error);
-                backlight_iface_emit_changed (manager, GSD_POWER_DBUS_INTERFACE_SCREEN, value, NULL);
+                backlight_step_down_async (manager->priv->rr_screen,
+                                           manager->priv->cancellable,
+                                           backlight_step_cb,
+                                           invocation);
+        } else if (g_strcmp0 (method_name, "Step") == 0) {
+                gint steps;
+
+                /* repeated key presses folded into one write */
+                g_variant_get (parameters, "(i)", &steps);
+                g_debug ("screen step by %i", steps);
+                backlight_step_async (manager->priv->rr_screen,
+                                      steps,
+                                      manager->priv->cancellable,
+                                      backlight_step_cb,
+                                      invocation);
         } else {
                 g_assert_not_reached ();
         }
-
-        /* ambient brightness no longer valid */
-        manager->priv->ambient_percentage_old = value;
-        manager->priv->ambient_norm_required = TRUE;
-
-out:
-        /* return value */
-        if (value < 0) {
-                g_dbus_method_invocation_take_error (invocation,
-                                                     error);
-        } else {
-                g_dbus_method_invocation_return_value (invocation,
-                                                       g_variant_new ("(ii)",
-                                                                      value,
-                                                                      backlight_get_output_id (manager->priv->rr_screen)));
-        }
 }
 
 static void
@@ -2869,13 +3246,22 @@ handle_method_call (GDBusConnection       *connection,
         /* Check session pointer as a proxy for whether the manager is in the
            start or stop state */
         if (manager->priv->session == NULL) {
+                if (g_strcmp0 (interface_name, "org.freedesktop.DBus.Properties") == 0)
+                        g_dbus_method_invocation_return_error_literal (invocation,
+                                                                       G_DBUS_ERROR, G_DBUS_ERROR_FAILED,
+                                                                       "No session");
                 return;
         }
 
         g_debug ("Calling method '%s.%s' for Power",
                  interface_name, method_name);
 
-        if (g_strcmp0 (interface_name, GSD_POWER_DBUS_INTERFACE_SCREEN) == 0) {
+        if (g_strcmp0 (interface_name, "org.freedesktop.DBus.Properties") == 0) {
+                handle_properties_call (manager,
+                                        method_name,
+                                        parameters,
+                                        invocation);
+        } else if (g_strcmp0 (interface_name, GSD_POWER_DBUS_INTERFACE_SCREEN) == 0) {
                 handle_method_call_screen (manager,
                                            method_name,
                                            parameters,
@@ -2890,151 +3276,219 @@ handle_method_call (GDBusConnection       *connection,
         }
 }
 
-static GVariant *
-handle_get_property_other (GsdPowerManager *manager,
-                           const gchar *interface_name,
-                           const gchar *property_name,
-                           GError **error)
+static void
+return_brightness_property (GDBusMethodInvocation *invocation,
+                            gint32                 brightness)
 {
-        GVariant *retval = NULL;
-        gint32 value;
+        GVariant *value;
 
-        if (g_strcmp0 (property_name, "Brightness") != 0) {
-                g_set_error (error, G_DBUS_ERROR, G_DBUS_ERROR_FAILED,
-                             "No such property: %s", property_name);
-                return NULL;
+        value = g_variant_new_int32 (brightness);
+        if (g_strcmp0 (g_dbus_method_invocation_get_method_name (invocation), "GetAll") == 0) {
+                GVariantBuilder builder;
+
+                g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sv}"));
+                g_variant_builder_add (&builder, "{sv}", "Brightness", value);
+                g_dbus_method_invocation_return_value (invocation,
+                                                       g_variant_new ("(a{sv})", &builder));
+        } else {
+                g_dbus_method_invocation_return_value (invocation,
+                                                       g_variant_new ("(v)", value));
         }
+}
 
-        if (g_strcmp0 (interface_name, GSD_POWER_DBUS_INTERFACE_SCREEN) == 0) {
-                value = backlight_get_percentage (manager->priv->rr_screen, NULL);
-                retval = g_variant_new_int32 (value);
-        } else if (g_strcmp0 (interface_name, GSD_POWER_DBUS_INTERFACE_KEYBOARD) == 0) {
-                value = ABS_TO_PERCENTAGE (0,
-                                           manager->priv->kbd_brightness_max,
-                                           manager->priv->kbd_brightness_now);
-                retval =  g_variant_new_int32 (value);
+/* The screen Brightness property is served from the Properties method
+ * calls rather than from the vtable's get/set handlers, so that reading or
+ * writing the backlight does not block the main loop. */
+static void
+screen_brightness_get_cb (GObject      *source_object,
+                          GAsyncResult *res,
+                          gpointer      user_data)
+{
+        GDBusMethodInvocation *invocation = G_DBUS_METHOD_INVOCATION (user_data);
+        GError *error = NULL;
+        gint32 brightness;
+
+        brightness = backlight_get_percentage_finish (GNOME_RR_SCREEN (source_object), res, &error);
+        if (error != NULL && g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+                g_dbus_method_invocation_take_error (invocation, error);
+                return;
         }
+        g_clear_error (&error);
+
+        /* failures are reported as -1, as before */
+        return_brightness_property (invocation, brightness);
+}
 
-        if (retval == NULL) {
-                g_set_error (error, G_DBUS_ERROR, G_DBUS_ERROR_FAILED,
-                             "Failed to get property: %s", property_name);
+static void
+screen_brightness_set_cb (GObject      *source_object,
+                          GAsyncResult *res,
+                          gpointer      user_data)
+{
+        GDBusMethodInvocation *invocation = G_DBUS_METHOD_INVOCATION (user_data);
+        GsdPowerManager *manager;
+        GError *error = NULL;
+        gint brightness_value;
+
+        brightness_value = backlight_set_percentage_finish (GNOME_RR_SCREEN (source_object), res, &error);
+        if (brightness_value < 0) {
+                g_dbus_method_invocation_return_error (invocation,
+                                                       G_DBUS_ERROR, G_DBUS_ERROR_FAILED,
+                                                       "Setting %s.%s failed: %s",
+                                                       GSD_POWER_DBUS_INTERFACE_SCREEN,
+                                                       "Brightness",
+                                                       error->message);
+                g_error_free (error);
+                return;
         }
-        return retval;
+
+        manager = GSD_POWER_MANAGER (g_dbus_method_invocation_get_user_data (invocation));
+        backlight_iface_emit_changed (manager, GSD_POWER_DBUS_INTERFACE_SCREEN, brightness_value, NULL);
+
+        /* ambient brightness no longer valid */
+        manager->priv->ambient_percentage_old = brightness_value;
+        manager->priv->ambient_norm_required = TRUE;
+
+        g_dbus_method_invocation_return_value (invocation, NULL);
 }
 
-static GVariant *
-handle_get_property (GDBusConnection *connection,
-                     const gchar *sender,
-                     const gchar *object_path,
-                     const gchar *interface_name,
-                     const gchar *property_name,
-                     GError **error, gpointer user_data)
+static void
+handle_properties_screen (GsdPowerManager       *manager,
+                          const gchar           *method_name,
+                          const gchar           *property_name,
+                          GVariant              *value,
+                          GDBusMethodInvocation *invocation)
 {
-        GsdPowerManager *manager = GSD_POWER_MANAGER (user_data);
+        gint32 brightness_value;
 
-        /* Check session pointer as a proxy for whether the manager is in the
-           start or stop state */
-        if (manager->priv->session == NULL) {
-                g_set_error_literal (error, G_DBUS_ERROR, G_DBUS_ERROR_FAILED,
-                                     "No session");
-                return NULL;
+        if (property_name != NULL && g_strcmp0 (property_name, "Brightness") != 0) {
+                g_dbus_method_invocation_return_error (invocation,
+                                                       G_DBUS_ERROR, G_DBUS_ERROR_FAILED,
+                                                       "No such property: %s", property_name);
+                return;
         }
 
-        if (g_strcmp0 (interface_name, GSD_POWER_DBUS_INTERFACE_SCREEN) == 0 ||
-                   g_strcmp0 (interface_name, GSD_POWER_DBUS_INTERFACE_KEYBOARD) == 0) {
-                return handle_get_property_other (manager, interface_name, property_name, error);
-        } else {
-                g_set_error (error, G_DBUS_ERROR, G_DBUS_ERROR_FAILED,
-                             "No such interface: %s", interface_name);
-                return NULL;
+        if (g_strcmp0 (method_name, "Set") == 0) {
+                if (!g_variant_is_of_type (value, G_VARIANT_TYPE_INT32)) {
+                        g_dbus_method_invocation_return_error (invocation,
+                                                               G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS,
+                                                               "Brightness must be of type 'i'");
+                        return;
+                }
+                g_variant_get (value, "i", &brightness_value);
+                if (manager->priv->backlight_fade != NULL)
+                        gsd_backlight_fade_stop (manager->priv->backlight_fade);
+                backlight_set_percentage_async (manager->priv->rr_screen,
+                                                brightness_value,
+                                                manager->priv->cancellable,
+                                                screen_brightness_set_cb,
+                                                invocation);
+                return;
         }
+
+        if (!manager->priv->backlight_available) {
+                return_brightness_property (invocation, -1);
+                return;
+        }
+
+        /* served from the cached state without any I/O */
+        if (backlight_get_state () != NULL) {
+                return_brightness_property (invocation,
+                                            backlight_get_percentage (manager->priv->rr_screen, NULL));
+                return;
+        }
+
+        backlight_get_percentage_async (manager->priv->rr_screen,
+                                        manager->priv->cancellable,
+                                        screen_brightness_get_cb,
+                                        invocation);
 }
 
-static gboolean
-handle_set_property_other (GsdPowerManager *manager,
-                           const gchar *interface_name,
-                           const gchar *property_name,
-                           GVariant *value,
-                           GError **error)
+static void
+handle_properties_keyboard (GsdPowerManager       *manager,
+                            const gchar           *method_name,
+                            const gchar           *property_name,
+                            GVariant              *value,
+                            GDBusMethodInvocation *invocation)
 {
         gint32 brightness_value;
+        GError *error = NULL;
 
-        if (g_strcmp0 (property_name, "Brightness") != 0) {
-                g_set_error (error, G_DBUS_ERROR, G_DBUS_ERROR_FAILED,
-                             "No such property: %s", property_name);
-                return FALSE;
+        if (property_name != NULL && g_strcmp0 (property_name, "Brightness") != 0) {
+                g_dbus_method_invocation_return_error (invocation,
+                                                       G_DBUS_ERROR, G_DBUS_ERROR_FAILED,
+                                                       "No such property: %s", property_name);
+                return;
         }
 
-        if (g_strcmp0 (interface_name, GSD_POWER_DBUS_INTERFACE_SCREEN) == 0) {
-                g_variant_get (value, "i", &brightness_value);
-                if (backlight_set_percentage (manager->priv->rr_screen, &brightness_value, error)) {
-                        backlight_iface_emit_changed (manager, GSD_POWER_DBUS_INTERFACE_SCREEN, brightness_value, NULL);
-
-                        /* ambient brightness no longer valid */
-                        manager->priv->ambient_percentage_old = brightness_value;
-                        manager->priv->ambient_norm_required = TRUE;
-                        return TRUE;
-                } else {
-                        g_set_error (error, G_DBUS_ERROR, G_DBUS_ERROR_FAILED,
-                                     "Setting %s.%s failed", interface_name, property_name);
-                        return FALSE;
+        if (g_strcmp0 (method_name, "Set") == 0) {
+                if (!g_variant_is_of_type (value, G_VARIANT_TYPE_INT32)) {
+                        g_dbus_method_invocation_return_error (invocation,
+                                                               G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS,
+                                                               "Brightness must be of type 'i'");
+                        return;
                 }
-        } else if (g_strcmp0 (interface_name, GSD_POWER_DBUS_INTERFACE_KEYBOARD) == 0) {
                 g_variant_get (value, "i", &brightness_value);
                 brightness_value = PERCENTAGE_TO_ABS (0, manager->priv->kbd_brightness_max,
                                                       brightness_value);
-                if (upower_kbd_set_brightness (manager, brightness_value, error)) {
-                        brightness_value = ABS_TO_PERCENTAGE (0,
-                                                              manager->priv->kbd_brightness_max,
-                                                              manager->priv->kbd_brightness_now);
-                        backlight_iface_emit_changed (manager, GSD_POWER_DBUS_INTERFACE_KEYBOARD, brightness_value, "set property");
-                        return TRUE;
-                } else {
-                        g_set_error (error, G_DBUS_ERROR, G_DBUS_ERROR_FAILED,
-                                     "Setting %s.%s failed", interface_name, property_name);
-                        return FALSE;
+                if (!upower_kbd_set_brightness (manager, brightness_value, &error)) {
+                        g_dbus_method_invocation_return_error (invocation,
+                                                               G_DBUS_ERROR, G_DBUS_ERROR_FAILED,
+                                                               "Setting %s.%s failed: %s",
+                                                               GSD_POWER_DBUS_INTERFACE_KEYBOARD,
+                                                               "Brightness",
+                                                               error->message);
+                        g_error_free (error);
+                        return;
                 }
+                brightness_value = ABS_TO_PERCENTAGE (0,
+                                                      manager->priv->kbd_brightness_max,
+                                                      manager->priv->kbd_brightness_now);
+                backlight_iface_emit_changed (manager, GSD_POWER_DBUS_INTERFACE_KEYBOARD, brightness_value, "set property");
+                g_dbus_method_invocation_return_value (invocation, NULL);
+                return;
         }
 
-        g_set_error (error, G_DBUS_ERROR, G_DBUS_ERROR_FAILED,
-                     "No such interface: %s", interface_name);
-        return FALSE;
+        brightness_value = ABS_TO_PERCENTAGE (0,
+                                              manager->priv->kbd_brightness_max,
+                                              manager->priv->kbd_brightness_now);
+        return_brightness_property (invocation, brightness_value);
 }
 
-static gboolean
-handle_set_property (GDBusConnection *connection,
-                     const gchar *sender,
-                     const gchar *object_path,
-                     const gchar *interface_name,
-                     const gchar *property_name,
-                     GVariant *value,
-                     GError **error, gpointer user_data)
+static void
+handle_properties_call (GsdPowerManager       *manager,
+                        const gchar           *method_name,
+                        GVariant              *parameters,
+                        GDBusMethodInvocation *invocation)
 {
-        GsdPowerManager *manager = GSD_POWER_MANAGER (user_data);
+        const gchar *interface_name;
+        const gchar *property_name = NULL;
+        GVariant *value = NULL;
 
-        /* Check session pointer as a proxy for whether the manager is in the
-           start or stop state */
-        if (manager->priv->session == NULL) {
-                g_set_error (error, G_DBUS_ERROR, G_DBUS_ERROR_FAILED,
-                             "Manager is starting or stopping");
-                return FALSE;
-        }
+        if (g_strcmp0 (method_name, "Get") == 0)
+                g_variant_get (parameters, "(&s&s)", &interface_name, &property_name);
+        else if (g_strcmp0 (method_name, "Set") == 0)
+                g_variant_get (parameters, "(&s&sv)", &interface_name, &property_name, &value);
+        else
+                g_variant_get (parameters, "(&s)", &interface_name);
 
-        if (g_strcmp0 (interface_name, GSD_POWER_DBUS_INTERFACE_SCREEN) == 0 ||
-            g_strcmp0 (interface_name, GSD_POWER_DBUS_INTERFACE_KEYBOARD) == 0) {
-                return handle_set_property_other (manager, interface_name, property_name, value, error);
+        if (g_strcmp0 (interface_name, GSD_POWER_DBUS_INTERFACE_SCREEN) == 0) {
+                handle_properties_screen (manager, method_name, property_name, value, invocation);
+        } else if (g_strcmp0 (interface_name, GSD_POWER_DBUS_INTERFACE_KEYBOARD) == 0) {
+                handle_properties_keyboard (manager, method_name, property_name, value, invocation);
         } else {
-                g_set_error (error, G_DBUS_ERROR, G_DBUS_ERROR_FAILED,
-                             "No such interface: %s", interface_name);
-                return FALSE;
+                g_dbus_method_invocation_return_error (invocation,
+                                                       G_DBUS_ERROR, G_DBUS_ERROR_FAILED,
+                                                       "No such interface: %s", interface_name);
         }
+
+        g_clear_pointer (&value, g_variant_unref);
 }
 
 static const GDBusInterfaceVTable interface_vtable =
 {
         handle_method_call,
-        handle_get_property,
-        handle_set_property
+        NULL, /* properties are handled in handle_method_call */
+        NULL
 };
 
 static void
@@ -10,6 +10,8 @@ SCREENSAVER_TIMEOUT_BLANK = 15;
 IDLE_DIM_BLANK_DISABLED_MIN = 60;
 IDLE_DELAY_TO_IDLE_DIM_MULTIPLIER = 4.0/5.0;
 MINIMUM_IDLE_DIM_DELAY = 10;
+IDLE_DIM_FADE_DURATION = 1000;
+IDLE_UNDIM_FADE_DURATION = 250;
 POWER_UP_TIME_ON_AC = 15;
 GSD_MOCK_DEFAULT_BRIGHTNESS = 50;
 GSD_MOCK_MAX_BRIGHTNESS = 100;
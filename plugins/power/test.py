@@ -11,6 +11,7 @@ import sys
 import time
 import os
 import os.path
+import re
 import signal
 
 project_root = os.path.dirname(os.path.dirname(os.path.dirname(os.path.abspath(__file__))))
@@ -638,6 +639,12 @@ class PowerPluginTest(gsdtestcase.GSDTestCase):
         level = self.get_brightness();
         self.assertTrue(level == dim_level, 'incorrect dim brightness (%d != %d)' % (level, dim_level))
 
+        # Check that we faded there rather than jumping
+        log = self.plugin_log.read()
+        m = re.search(r'backlight fade to %d finished: \d+ frames, (\d+) writes' % dim_level, log)
+        self.assertTrue(m, 'dim fade did not finish')
+        self.assertGreater(int(m.group(1)), 1, 'dim was not faded')
+
         self.assertEqual(self.get_status(), gsdpowerenums.GSM_PRESENCE_STATUS_AVAILABLE)
 
         # Bring down the screensaver
@@ -893,5 +900,68 @@ class PowerPluginTest(gsdtestcase.GSDTestCase):
         # And wait a little more to see us dim again
         self.check_dim(idle_delay + 2)
 
+    def benchmark_backlight_op(self, name, call, iterations):
+        '''Time the given D-Bus call.
+
+        This prints the round-trip latency percentiles, and how often the
+        mock backend, which stands in for the backlight helper, was used
+        per call.
+        '''
+        # flush the daemon log
+        self.plugin_log.read()
+
+        latencies = []
+        for i in range(iterations):
+            start = time.time()
+            call()
+            latencies.append((time.time() - start) * 1000.0)
+        latencies.sort()
+
+        # each mock read or write would be a helper invocation
+        log = self.plugin_log.read()
+        helper_calls = log.count('mock brightness:')
+
+        def percentile(p):
+            return latencies[min(len(latencies) - 1, int(len(latencies) * p / 100))]
+
+        print('BENCHMARK %-13s n=%d p50=%.2fms p95=%.2fms p99=%.2fms helper/op=%.2f' %
+              (name, iterations, percentile(50), percentile(95), percentile(99),
+               float(helper_calls) / iterations))
+
+    @unittest.skipUnless('GSD_POWER_BENCHMARK' in os.environ,
+                         'set GSD_POWER_BENCHMARK to the number of calls to time')
+    def test_benchmark_backlight(self):
+        '''Benchmark the screen brightness D-Bus API'''
+
+        iterations = int(os.environ['GSD_POWER_BENCHMARK'] or '100')
+        obj_power = self.session_bus_con.get_object('org.gnome.SettingsDaemon.Power',
+                                                    '/org/gnome/SettingsDaemon/Power')
+        iface = 'org.gnome.SettingsDaemon.Power.Screen'
+
+        # alternate so that we never get stuck at either end of the range
+        state = {'up': True, 'value': 30}
+
+        def step():
+            if state['up']:
+                obj_power.StepUp(dbus_interface=iface)
+            else:
+                obj_power.StepDown(dbus_interface=iface)
+            state['up'] = not state['up']
+
+        def set_brightness():
+            state['value'] = 100 - state['value']
+            obj_power.Set(iface, 'Brightness', dbus.Int32(state['value']),
+                          dbus_interface=dbus.PROPERTIES_IFACE)
+
+        def get_brightness():
+            obj_power.Get(iface, 'Brightness', dbus_interface=dbus.PROPERTIES_IFACE)
+
+        self.benchmark_backlight_op('StepUp/Down', step, iterations)
+        self.benchmark_backlight_op('SetBrightness', set_brightness, iterations)
+        self.benchmark_backlight_op('GetBrightness', get_brightness, iterations)
+
+        # the last write went through
+        self.assertEqual(self.get_brightness(), state['value'])
+
 # avoid writing to stderr
 unittest.main(testRunner=unittest.TextTestRunner(stream=sys.stdout, verbosity=2))